@@ -0,0 +1,142 @@
+#include "SmartMenuSystem.h"
+
+// Optimistic device commands. The new value is shown as soon as the knob is
+// turned and marked as pending; the transport reports back through a queue
+// and the value is either confirmed (optionally replaced by the value the
+// backend answered with) or rolled back to the last confirmed one and
+// flagged as failed. Results are applied on the main loop only.
+
+static QueueHandle_t resultQueue = nullptr;
+static uint32_t nextSequence = 1;
+static unsigned long lastTimeoutCheck = 0;
+
+void initializeCommands()
+{
+    resultQueue = xQueueCreate(COMMAND_RESULT_QUEUE_LENGTH, sizeof(CommandResult));
+}
+
+// Marks the device as waiting for the backend, returns the command's sequence
+uint32_t beginDeviceCommand(Device &device)
+{
+    device.commandSequence = nextSequence++;
+    device.pending = true;
+    device.failed = false;
+    device.pendingSince = millis();
+    return device.commandSequence;
+}
+
+// Safe to call from any task
+void postCommandResult(uint32_t sequence, const char *deviceId, const char *type, const char *value, int code)
+{
+    if (resultQueue == nullptr || sequence == 0)
+        return;
+
+    CommandResult result;
+    result.sequence = sequence;
+    result.code = code;
+    strlcpy(result.deviceId, deviceId, sizeof(result.deviceId));
+    strlcpy(result.type, type, sizeof(result.type));
+    strlcpy(result.value, value, sizeof(result.value));
+
+    if (xQueueSend(resultQueue, &result, 0) != pdTRUE)
+    {
+        // The timeout check rolls the device back
+        Serial.println("Command result queue full");
+    }
+}
+
+void confirmDevice(Device &device)
+{
+    device.confirmedState = device.state;
+    device.confirmedBrightness = device.brightness;
+    device.confirmedColor = device.color;
+    device.pending = false;
+    device.failed = false;
+    markSnapshotDirty();
+}
+
+static void rollbackDevice(Device &device)
+{
+    device.state = device.confirmedState;
+    device.brightness = device.confirmedBrightness;
+    device.color = device.confirmedColor;
+    device.pending = false;
+    device.failed = true;
+}
+
+// Redraws the device if it is on screen
+void refreshDevice(const Device &device)
+{
+    if (currentState != DEVICE_CONTROL || currentMenuIndex >= mainMenu.size() ||
+        currentSubmenuIndex >= mainMenu[currentMenuIndex].rooms.size())
+        return;
+
+    std::vector<Device> &devices = mainMenu[currentMenuIndex].rooms[currentSubmenuIndex].devices;
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        if (&devices[i] != &device)
+            continue;
+
+        if (inEditMode && i == currentDeviceIndex)
+        {
+            requestRedraw();
+        }
+        else
+        {
+            redrawDeviceLine(i);
+        }
+        return;
+    }
+}
+
+// Network task: applies transport results and expires commands that took
+// longer than request_timeout_ms
+void handleCommandResults()
+{
+    CommandResult result;
+    while (resultQueue != nullptr && xQueueReceive(resultQueue, &result, 0) == pdTRUE)
+    {
+        Device *device = findDeviceById(result.deviceId);
+
+        // Superseded by a newer command for the same device
+        if (device == nullptr || device->commandSequence != result.sequence)
+            continue;
+
+        if (result.code >= 200 && result.code < 300)
+        {
+            // Also applies late replies that arrive after a timeout
+            applyDeviceValue(*device, result.type, result.value);
+            confirmDevice(*device);
+        }
+        else if (device->pending)
+        {
+            Serial.printf("Device %s command failed (%d), rolling back\n", result.deviceId, result.code);
+            rollbackDevice(*device);
+        }
+        else
+        {
+            continue;
+        }
+        refreshDevice(*device);
+    }
+
+    if (millis() - lastTimeoutCheck < COMMAND_TIMEOUT_CHECK_MS)
+        return;
+    lastTimeoutCheck = millis();
+
+    for (auto &menu : mainMenu)
+    {
+        for (auto &room : menu.rooms)
+        {
+            for (auto &device : room.devices)
+            {
+                if (device.pending && millis() - device.pendingSince > request_timeout_ms)
+                {
+                    Serial.printf("Device %s command timed out, rolling back\n", device.device_id.c_str());
+                    rollbackDevice(device);
+                    refreshDevice(device);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,344 @@
+#include "SmartMenuSystem.h"
+
+// Full-screen edit controls for the round display: an arc gauge for
+// brightness and a hue ring with a saturation arc for color. All geometry
+// comes from lookup tables built once at boot, and an encoder step only
+// repaints the arc segments or the marker that actually changed.
+
+// Screen center
+static const int16_t CENTER_X = 120;
+static const int16_t CENTER_Y = 120;
+
+// Arcs open at the bottom: 270 degrees, starting bottom left, clockwise
+static const float ARC_START_DEGREES = 135.0f;
+static const float ARC_SWEEP_DEGREES = 270.0f;
+static const int ARC_MAX_POINTS = 101;
+
+// Brightness gauge
+static const int16_t GAUGE_OUTER_RADIUS = 110;
+static const int16_t GAUGE_INNER_RADIUS = 90;
+static const int16_t GAUGE_NAME_Y = 95;
+static const int16_t GAUGE_VALUE_Y = 140;
+
+// Color wheel: hue ring outside, saturation arc inside, swatch in the middle
+static const int HUE_SEGMENTS = 36;
+static const int16_t HUE_OUTER_RADIUS = 118;
+static const int16_t HUE_INNER_RADIUS = 100;
+static const int16_t HUE_MARKER_RADIUS = 92;
+static const int16_t HUE_MARKER_SIZE = 4;
+static const int SATURATION_STEPS = 10;
+static const int16_t SATURATION_OUTER_RADIUS = 80;
+static const int16_t SATURATION_INNER_RADIUS = 70;
+static const int16_t SWATCH_Y = 108;
+static const int16_t SWATCH_RADIUS = 24;
+static const int16_t COLOR_LABEL_Y = 78;
+static const int16_t COLOR_HEX_Y = 150;
+
+// Command status, in the opening at the bottom of both screens
+static const int16_t EDIT_STATUS_Y = 172;
+
+struct ArcLut
+{
+    uint8_t steps; // Number of segments, points = steps + 1
+    int16_t outerX[ARC_MAX_POINTS];
+    int16_t outerY[ARC_MAX_POINTS];
+    int16_t innerX[ARC_MAX_POINTS];
+    int16_t innerY[ARC_MAX_POINTS];
+};
+
+static ArcLut brightnessArc; // 0..100%, one segment per percent
+static ArcLut saturationArc; // 0..100% in 10% segments
+
+// Hue ring: HUE_SEGMENTS colored segments around the full circle
+static int16_t hueOuterX[HUE_SEGMENTS];
+static int16_t hueOuterY[HUE_SEGMENTS];
+static int16_t hueInnerX[HUE_SEGMENTS];
+static int16_t hueInnerY[HUE_SEGMENTS];
+static int16_t hueMarkerX[HUE_SEGMENTS];
+static int16_t hueMarkerY[HUE_SEGMENTS];
+static uint16_t hueColors[HUE_SEGMENTS];
+
+// Current color being edited
+static int hueIndex = 0;
+static int saturationStep = SATURATION_STEPS;
+static bool editingSaturation = false;
+
+static void buildArc(ArcLut &arc, uint8_t steps, int16_t innerRadius, int16_t outerRadius)
+{
+    arc.steps = steps;
+    for (int i = 0; i <= steps; i++)
+    {
+        float radians = (ARC_START_DEGREES + ARC_SWEEP_DEGREES * i / steps) * DEG_TO_RAD;
+        float c = cosf(radians);
+        float s = sinf(radians);
+        arc.outerX[i] = CENTER_X + lroundf(outerRadius * c);
+        arc.outerY[i] = CENTER_Y + lroundf(outerRadius * s);
+        arc.innerX[i] = CENTER_X + lroundf(innerRadius * c);
+        arc.innerY[i] = CENTER_Y + lroundf(innerRadius * s);
+    }
+}
+
+static void hsvToRgb(int hue, int saturation, uint8_t &r, uint8_t &g, uint8_t &b)
+{
+    // Value is always 100%, brightness has its own control
+    int region = hue / 60;
+    int remainder = (hue % 60) * 255 / 60;
+    uint8_t p = 255 - 255 * saturation / 100;
+    uint8_t q = 255 - (255 * saturation / 100) * remainder / 255;
+    uint8_t t = 255 - (255 * saturation / 100) * (255 - remainder) / 255;
+
+    switch (region)
+    {
+    case 0: r = 255, g = t, b = p; break;
+    case 1: r = q, g = 255, b = p; break;
+    case 2: r = p, g = 255, b = t; break;
+    case 3: r = p, g = q, b = 255; break;
+    case 4: r = t, g = p, b = 255; break;
+    default: r = 255, g = p, b = q; break;
+    }
+}
+
+static uint16_t toRgb565(uint8_t r, uint8_t g, uint8_t b)
+{
+    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+}
+
+void initializeControls()
+{
+    buildArc(brightnessArc, 100, GAUGE_INNER_RADIUS, GAUGE_OUTER_RADIUS);
+    buildArc(saturationArc, SATURATION_STEPS, SATURATION_INNER_RADIUS, SATURATION_OUTER_RADIUS);
+
+    for (int i = 0; i < HUE_SEGMENTS; i++)
+    {
+        // Segment i starts at the top and runs clockwise
+        float radians = (270.0f + 360.0f * i / HUE_SEGMENTS) * DEG_TO_RAD;
+        float c = cosf(radians);
+        float s = sinf(radians);
+        hueOuterX[i] = CENTER_X + lroundf(HUE_OUTER_RADIUS * c);
+        hueOuterY[i] = CENTER_Y + lroundf(HUE_OUTER_RADIUS * s);
+        hueInnerX[i] = CENTER_X + lroundf(HUE_INNER_RADIUS * c);
+        hueInnerY[i] = CENTER_Y + lroundf(HUE_INNER_RADIUS * s);
+
+        float middle = (270.0f + 360.0f * (i + 0.5f) / HUE_SEGMENTS) * DEG_TO_RAD;
+        hueMarkerX[i] = CENTER_X + lroundf(HUE_MARKER_RADIUS * cosf(middle));
+        hueMarkerY[i] = CENTER_Y + lroundf(HUE_MARKER_RADIUS * sinf(middle));
+
+        uint8_t r, g, b;
+        hsvToRgb(i * 360 / HUE_SEGMENTS, 100, r, g, b);
+        hueColors[i] = toRgb565(r, g, b);
+    }
+}
+
+// Paints segments [from, to) of an arc as quads made of two triangles
+static void fillArcSegments(const ArcLut &arc, int from, int to, uint16_t color)
+{
+    // Out of range values would read past the end of the tables
+    from = constrain(from, 0, arc.steps);
+    to = constrain(to, 0, arc.steps);
+    for (int i = from; i < to; i++)
+    {
+        gfx->fillTriangle(arc.outerX[i], arc.outerY[i], arc.outerX[i + 1], arc.outerY[i + 1], arc.innerX[i], arc.innerY[i], color);
+        gfx->fillTriangle(arc.innerX[i], arc.innerY[i], arc.outerX[i + 1], arc.outerY[i + 1], arc.innerX[i + 1], arc.innerY[i + 1], color);
+    }
+}
+
+static void fillHueSegment(int i)
+{
+    int next = (i + 1) % HUE_SEGMENTS;
+    gfx->fillTriangle(hueOuterX[i], hueOuterY[i], hueOuterX[next], hueOuterY[next], hueInnerX[i], hueInnerY[i], hueColors[i]);
+    gfx->fillTriangle(hueInnerX[i], hueInnerY[i], hueOuterX[next], hueOuterY[next], hueInnerX[next], hueInnerY[next], hueColors[i]);
+}
+
+// Prints text centered in a cleared box, y is the baseline
+static void drawValueText(const String &text, int y, int boxWidth, uint8_t size)
+{
+    gfx->fillRect(CENTER_X - boxWidth / 2, y - 12 * size, boxWidth, 15 * size, COLOR_BACKGROUND);
+    gfx->setTextSize(size);
+    gfx->setTextColor(COLOR_TEXT);
+    gfx->setCursor(CENTER_X - 7 * size * text.length() / 2, y);
+    gfx->print(text);
+}
+
+// Waiting for the backend, or rolled back after a failure, like the marks
+// on the device list
+void drawEditStatus(const Device &device)
+{
+    gfx->fillRect(CENTER_X - 35, EDIT_STATUS_Y - 12, 70, 15, COLOR_BACKGROUND);
+    if (!device.pending && !device.failed)
+        return;
+
+    const char *text = device.pending ? "sending" : "failed";
+    gfx->setTextSize(1);
+    gfx->setTextColor(device.pending ? COLOR_PENDING : COLOR_ERROR);
+    gfx->setCursor(CENTER_X - 7 * strlen(text) / 2, EDIT_STATUS_Y);
+    gfx->print(text);
+}
+
+// Brightness gauge
+
+void drawBrightnessGauge(const Device &device)
+{
+    gfx->setTextSize(1);
+    gfx->setTextColor(COLOR_TITLE);
+    centeredText(device.name, GAUGE_NAME_Y);
+
+    fillArcSegments(brightnessArc, 0, device.brightness, COLOR_GAUGE);
+    fillArcSegments(brightnessArc, device.brightness, 100, COLOR_TRACK);
+    drawValueText(String(device.brightness) + "%", GAUGE_VALUE_Y, 70, 2);
+    drawEditStatus(device);
+}
+
+void updateBrightnessGauge(int oldValue, int newValue)
+{
+    TRACE_SCOPE("render gauge");
+    uint32_t start = micros();
+    if (newValue > oldValue)
+    {
+        fillArcSegments(brightnessArc, oldValue, newValue, COLOR_GAUGE);
+    }
+    else if (newValue < oldValue)
+    {
+        fillArcSegments(brightnessArc, newValue, oldValue, COLOR_TRACK);
+    }
+    drawValueText(String(newValue) + "%", GAUGE_VALUE_Y, 70, 2);
+    noteFrame(micros() - start);
+}
+
+// Color wheel
+
+static String currentColorHex()
+{
+    uint8_t r, g, b;
+    hsvToRgb(hueIndex * 360 / HUE_SEGMENTS, saturationStep * 100 / SATURATION_STEPS, r, g, b);
+
+    char hex[8];
+    snprintf(hex, sizeof(hex), "#%02X%02X%02X", r, g, b);
+    return String(hex);
+}
+
+static uint16_t currentColor565()
+{
+    uint8_t r, g, b;
+    hsvToRgb(hueIndex * 360 / HUE_SEGMENTS, saturationStep * 100 / SATURATION_STEPS, r, g, b);
+    return toRgb565(r, g, b);
+}
+
+static void drawHueMarker(int index, uint16_t color)
+{
+    gfx->fillCircle(hueMarkerX[index], hueMarkerY[index], HUE_MARKER_SIZE, color);
+}
+
+static void drawColorSwatch()
+{
+    gfx->fillCircle(CENTER_X, SWATCH_Y, SWATCH_RADIUS, currentColor565());
+    drawValueText(currentColorHex(), COLOR_HEX_Y, 60, 1);
+}
+
+// Picks the closest hue segment and saturation step for a "#RRGGBB" color.
+// Greys have no hue and come out as saturation 0.
+static void parseColor(const String &color)
+{
+    hueIndex = 0;
+    saturationStep = 0;
+    if (color.length() != 7 || color[0] != '#')
+        return;
+
+    long rgb = strtol(color.c_str() + 1, nullptr, 16);
+    int r = (rgb >> 16) & 0xFF, g = (rgb >> 8) & 0xFF, b = rgb & 0xFF;
+    int maxValue = max(r, max(g, b));
+    int minValue = min(r, min(g, b));
+    int delta = maxValue - minValue;
+    if (maxValue == 0 || delta == 0)
+        return;
+
+    int hue;
+    if (maxValue == r)
+        hue = (60 * (g - b) / delta + 360) % 360;
+    else if (maxValue == g)
+        hue = 60 * (b - r) / delta + 120;
+    else
+        hue = 60 * (r - g) / delta + 240;
+
+    hueIndex = ((hue * HUE_SEGMENTS + 180) / 360) % HUE_SEGMENTS;
+    saturationStep = (delta * SATURATION_STEPS + maxValue / 2) / maxValue;
+}
+
+void beginColorEdit(const Device &device)
+{
+    parseColor(device.color);
+    editingSaturation = false;
+}
+
+// Second press switches from hue to saturation, third press finishes
+bool advanceColorEdit()
+{
+    if (editingSaturation)
+        return false;
+
+    editingSaturation = true;
+    return true;
+}
+
+void drawColorWheel(const Device &device)
+{
+    // The color changed under us (rolled back or pushed by the backend).
+    // Left alone otherwise, a grey would lose the hue being edited.
+    if (device.color != currentColorHex())
+    {
+        parseColor(device.color);
+    }
+
+    gfx->setTextSize(1);
+    gfx->setTextColor(COLOR_TITLE);
+    centeredText(editingSaturation ? "SATURATION" : "HUE", COLOR_LABEL_Y);
+
+    for (int i = 0; i < HUE_SEGMENTS; i++)
+    {
+        fillHueSegment(i);
+    }
+    drawHueMarker(hueIndex, editingSaturation ? COLOR_TRACK : COLOR_TEXT);
+
+    fillArcSegments(saturationArc, 0, saturationStep, editingSaturation ? COLOR_GAUGE : COLOR_TRACK_ACTIVE);
+    fillArcSegments(saturationArc, saturationStep, SATURATION_STEPS, COLOR_TRACK);
+    drawColorSwatch();
+    drawEditStatus(device);
+}
+
+// Applies one encoder step and returns the new "#RRGGBB" color
+String updateColorWheel(int direction)
+{
+    TRACE_SCOPE("render color wheel");
+    uint32_t start = micros();
+
+    if (editingSaturation)
+    {
+        int oldStep = saturationStep;
+        saturationStep = constrain(saturationStep + direction, 0, SATURATION_STEPS);
+        if (saturationStep > oldStep)
+        {
+            fillArcSegments(saturationArc, oldStep, saturationStep, COLOR_GAUGE);
+        }
+        else if (saturationStep < oldStep)
+        {
+            fillArcSegments(saturationArc, saturationStep, oldStep, COLOR_TRACK);
+        }
+    }
+    else
+    {
+        drawHueMarker(hueIndex, COLOR_BACKGROUND);
+        hueIndex = (hueIndex + direction + HUE_SEGMENTS) % HUE_SEGMENTS;
+        drawHueMarker(hueIndex, COLOR_TEXT);
+
+        // Every hue is the same grey without saturation, turning the hue of
+        // a white light should give it a color
+        if (saturationStep == 0)
+        {
+            saturationStep = SATURATION_STEPS;
+            fillArcSegments(saturationArc, 0, saturationStep, COLOR_TRACK_ACTIVE);
+        }
+    }
+
+    drawColorSwatch();
+    noteFrame(micros() - start);
+    return currentColorHex();
+}
@@ -0,0 +1,193 @@
+#include "SmartMenuSystem.h"
+#include <esp_heap_caps.h>
+
+// Performance HUD (Settings > Diagnostics). Frame counters are bumped by the
+// renderer and turned into rates once per DIAGNOSTICS_INTERVAL_MS by a
+// housekeeping task. While the screen is open, only the value fields whose
+// text changed are cleared and redrawn, the labels stay on screen.
+
+static uint8_t DIAG_TITLE_Y = 20;
+static uint8_t DIAG_LINE_HEIGHT = 16;
+static uint8_t DIAG_LINE_DESCENT = 3;
+static uint8_t DIAG_START_Y = 45;
+static uint8_t DIAG_LABEL_X = 40;
+static uint8_t DIAG_VALUE_X = 110;
+
+enum DiagnosticsField
+{
+    DIAG_FPS,
+    DIAG_FRAME_TIME,
+    DIAG_LOOP_RATE,
+    DIAG_INPUT_LATENCY,
+    DIAG_UPSTREAM_RTT,
+    DIAG_UPSTREAM_ERRORS,
+    DIAG_RSSI,
+    DIAG_FREE_HEAP,
+    DIAG_LARGEST_BLOCK,
+    DIAG_FIELD_COUNT
+};
+
+static const char *const diagnosticsLabels[DIAG_FIELD_COUNT] = {
+    "FPS", "Frame", "Loop", "Input", "RTT", "Errors", "RSSI", "Heap", "Block"};
+
+struct DiagnosticsStats
+{
+    uint32_t fpsTenths;
+    uint32_t frameMicros;
+    uint32_t loopsPerSecond;
+    uint32_t inputLatencyMicros;
+    uint32_t upstreamRttMs;
+    uint32_t upstreamErrors;
+    int rssi;
+    uint32_t freeHeap;
+    uint32_t largestBlock;
+};
+
+static DiagnosticsStats stats;
+static uint32_t frameCount = 0;
+static uint32_t lastFrameMicros = 0;
+
+// Counts at the previous sample
+static uint32_t sampledFrames = 0;
+static uint32_t sampledPasses = 0;
+static unsigned long sampledAt = 0;
+
+// Text currently on screen for each value field
+static char shownValues[DIAG_FIELD_COUNT][DIAGNOSTICS_VALUE_SIZE];
+
+// Called by the renderer for every full or partial frame
+void noteFrame(uint32_t durationMicros)
+{
+    frameCount++;
+    lastFrameMicros = durationMicros;
+}
+
+static void sampleDiagnostics()
+{
+    unsigned long now = millis();
+    unsigned long elapsed = now - sampledAt;
+    uint32_t passes = getSchedulerPasses();
+
+    if (elapsed > 0)
+    {
+        stats.fpsTenths = (frameCount - sampledFrames) * 10000UL / elapsed;
+        stats.loopsPerSecond = (passes - sampledPasses) * 1000UL / elapsed;
+    }
+    sampledFrames = frameCount;
+    sampledPasses = passes;
+    sampledAt = now;
+
+    stats.frameMicros = lastFrameMicros;
+    stats.inputLatencyMicros = getLastFrameLatency();
+    getUpstreamSummary(stats.upstreamRttMs, stats.upstreamErrors);
+    stats.rssi = WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : 0;
+    stats.freeHeap = ESP.getFreeHeap();
+    stats.largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+}
+
+static void formatField(int field, char *out, size_t size)
+{
+    switch (field)
+    {
+    case DIAG_FPS:
+        snprintf(out, size, "%lu.%lu", (unsigned long)(stats.fpsTenths / 10), (unsigned long)(stats.fpsTenths % 10));
+        break;
+    case DIAG_FRAME_TIME:
+        snprintf(out, size, "%lu.%lu ms", (unsigned long)(stats.frameMicros / 1000), (unsigned long)(stats.frameMicros % 1000 / 100));
+        break;
+    case DIAG_LOOP_RATE:
+        snprintf(out, size, "%lu/s", (unsigned long)stats.loopsPerSecond);
+        break;
+    case DIAG_INPUT_LATENCY:
+        snprintf(out, size, "%lu.%lu ms", (unsigned long)(stats.inputLatencyMicros / 1000), (unsigned long)(stats.inputLatencyMicros % 1000 / 100));
+        break;
+    case DIAG_UPSTREAM_RTT:
+        snprintf(out, size, "%lu ms", (unsigned long)stats.upstreamRttMs);
+        break;
+    case DIAG_UPSTREAM_ERRORS:
+        snprintf(out, size, "%lu", (unsigned long)stats.upstreamErrors);
+        break;
+    case DIAG_RSSI:
+        if (stats.rssi == 0)
+            strlcpy(out, "-", size);
+        else
+            snprintf(out, size, "%d dBm", stats.rssi);
+        break;
+    case DIAG_FREE_HEAP:
+        snprintf(out, size, "%lu", (unsigned long)stats.freeHeap);
+        break;
+    case DIAG_LARGEST_BLOCK:
+        snprintf(out, size, "%lu", (unsigned long)stats.largestBlock);
+        break;
+    }
+}
+
+static void drawValue(int field, bool clear)
+{
+    int y = DIAG_START_Y + field * DIAG_LINE_HEIGHT;
+    if (clear)
+    {
+        gfx->fillRect(DIAG_VALUE_X, y - DIAG_LINE_HEIGHT + DIAG_LINE_DESCENT, gfx->width() - DIAG_VALUE_X, DIAG_LINE_HEIGHT, COLOR_BACKGROUND);
+    }
+
+    gfx->setTextColor(COLOR_TEXT);
+    gfx->setCursor(DIAG_VALUE_X, y);
+    gfx->print(shownValues[field]);
+}
+
+void displayDiagnostics()
+{
+    gfx->setTextColor(COLOR_TITLE);
+    centeredText("DIAGNOSTICS", DIAG_TITLE_Y);
+
+    for (int i = 0; i < DIAG_FIELD_COUNT; i++)
+    {
+        gfx->setTextColor(COLOR_SELECTED);
+        gfx->setCursor(DIAG_LABEL_X, DIAG_START_Y + i * DIAG_LINE_HEIGHT);
+        gfx->print(diagnosticsLabels[i]);
+
+        formatField(i, shownValues[i], sizeof(shownValues[i]));
+        drawValue(i, false);
+    }
+
+    // The only item, pressing anywhere goes back
+    gfx->setTextColor(COLOR_SELECTED);
+    gfx->setCursor(20, DIAG_START_Y + DIAG_FIELD_COUNT * DIAG_LINE_HEIGHT + 10);
+    gfx->println("> Back");
+}
+
+// Housekeeping: refreshes the stats and, while the screen is shown, the
+// value fields that changed
+void updateDiagnostics()
+{
+    sampleDiagnostics();
+
+    // A full redraw is on its way anyway
+    if (currentState != DIAGNOSTICS || displayDirty || powerState == POWER_OFF)
+        return;
+
+    TRACE_SCOPE("render diagnostics");
+    char value[DIAGNOSTICS_VALUE_SIZE];
+    for (int i = 0; i < DIAG_FIELD_COUNT; i++)
+    {
+        formatField(i, value, sizeof(value));
+        if (strcmp(value, shownValues[i]) == 0)
+            continue;
+
+        strlcpy(shownValues[i], value, sizeof(shownValues[i]));
+        drawValue(i, true);
+    }
+}
+
+void writeDiagnostics(JsonObject out)
+{
+    out["fps"] = stats.fpsTenths / 10.0;
+    out["frame_us"] = stats.frameMicros;
+    out["loops_per_s"] = stats.loopsPerSecond;
+    out["input_to_frame_us"] = stats.inputLatencyMicros;
+    out["upstream_rtt_ms"] = stats.upstreamRttMs;
+    out["upstream_errors"] = stats.upstreamErrors;
+    out["rssi"] = stats.rssi;
+    out["free_heap"] = stats.freeHeap;
+    out["largest_free_block"] = stats.largestBlock;
+}
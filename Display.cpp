@@ -3,6 +3,7 @@
 // Line height:
 
 static uint8_t LINE_HEIGHT = 25;
+static uint8_t LINE_DESCENT = 4;
 static uint8_t MENU_NAME_START_X = 60;
 static uint8_t MENU_NAME_START_Y = 20;
 // static uint8_t MENU_NAME_SIZE = 2;
@@ -13,6 +14,28 @@ static uint8_t MENU_ITEM_REQUESTS_SIZE = 1;
 static uint8_t MENU_ITEM_ROOMS_SIZE = 1;
 static uint8_t MENU_ITEM_DEVICES_SIZE = 1;
 
+bool displayDirty = false;
+
+// Marks the screen for redrawing on the next render task run, so several
+// input events between two frames only cost one redraw.
+void requestRedraw()
+{
+    displayDirty = true;
+}
+
+void renderDisplay()
+{
+    if (!displayDirty)
+        return;
+
+    TRACE_SCOPE("render frame");
+    displayDirty = false;
+    uint32_t start = micros();
+    displayCurrentMenu();
+    noteFrame(micros() - start);
+    markFrame();
+}
+
 void displayCurrentMenu()
 {
     gfx->fillScreen(COLOR_BACKGROUND);
@@ -32,6 +55,9 @@ void displayCurrentMenu()
     case SETTINGS_MENU:
         displaySettingsMenu();
         break;
+    case DIAGNOSTICS:
+        displayDiagnostics();
+        break;
     }
 }
 
@@ -120,6 +146,43 @@ void displaySubmenu()
     gfx->println(prefix + "Back");
 }
 
+static void drawDeviceLine(Device &device, int index, int y)
+{
+    gfx->setTextSize(MENU_ITEM_DEVICES_SIZE);
+    gfx->setTextColor(index == currentDeviceIndex ? COLOR_SELECTED : COLOR_TEXT);
+    gfx->setCursor(20, y);
+
+    String line = (index == currentDeviceIndex ? "> " : "  ") + device.name;
+
+    if (device.type == "onoff")
+    {
+        line += " [" + String(device.state ? "ON" : "OFF") + "]";
+        gfx->setTextColor(device.state ? COLOR_ON : COLOR_OFF);
+    }
+    else if (device.type == "brightness")
+    {
+        line += " [" + String(device.brightness) + "%]";
+    }
+    else if (device.type == "color")
+    {
+        line += " [" + device.color + "]";
+    }
+
+    // Waiting for the backend, or rolled back after a failure
+    if (device.pending)
+    {
+        line += " *";
+        gfx->setTextColor(COLOR_PENDING);
+    }
+    else if (device.failed)
+    {
+        line += " !";
+        gfx->setTextColor(COLOR_ERROR);
+    }
+
+    gfx->println(line);
+}
+
 void displayDeviceControl()
 {
     if (currentMenuIndex >= mainMenu.size() || currentSubmenuIndex >= mainMenu[currentMenuIndex].rooms.size())
@@ -127,6 +190,22 @@ void displayDeviceControl()
 
     Room &room = mainMenu[currentMenuIndex].rooms[currentSubmenuIndex];
 
+    // Full-screen control while a value is being edited
+    if (inEditMode && currentDeviceIndex < room.devices.size())
+    {
+        Device &device = room.devices[currentDeviceIndex];
+        if (device.type == "brightness")
+        {
+            drawBrightnessGauge(device);
+            return;
+        }
+        if (device.type == "color")
+        {
+            drawColorWheel(device);
+            return;
+        }
+    }
+
     gfx->setTextColor(COLOR_TITLE);
     gfx->setCursor(MENU_NAME_START_X, MENU_NAME_START_Y);
     String roomName = room.name;
@@ -134,37 +213,11 @@ void displayDeviceControl()
     gfx->println(roomName);
 
     int y = MENU_ITEM_START_Y;
-    int x = 20;
     int index = 0;
 
-    gfx->setTextSize(MENU_ITEM_DEVICES_SIZE);
     for (auto &device : room.devices)
     {
-        gfx->setTextColor(index == currentDeviceIndex ? COLOR_SELECTED : COLOR_TEXT);
-        gfx->setCursor(x, y);
-
-        String line = (index == currentDeviceIndex ? "> " : "  ") + device.name;
-
-        if (device.type == "onoff")
-        {
-            line += " [" + String(device.state ? "ON" : "OFF") + "]";
-            gfx->setTextColor(device.state ? COLOR_ON : COLOR_OFF);
-        }
-        else if (device.type == "brightness")
-        {
-            line += " [" + String(device.brightness) + "%]";
-            if (inEditMode && index == currentDeviceIndex)
-            {
-                gfx->setTextColor(COLOR_SELECTED);
-                line += " EDIT";
-            }
-        }
-        else if (device.type == "color")
-        {
-            line += " [" + device.color + "]";
-        }
-
-        gfx->println(line);
+        drawDeviceLine(device, index, y);
         y += LINE_HEIGHT;
         // x -= 4; // Adjust x position for next item
         index++;
@@ -180,6 +233,26 @@ void displayDeviceControl()
     gfx->println(prefix + "Back");
 }
 
+// Redraws a single device line in place, used when only its value changed
+void redrawDeviceLine(int index)
+{
+    if (currentState != DEVICE_CONTROL || currentMenuIndex >= mainMenu.size() || currentSubmenuIndex >= mainMenu[currentMenuIndex].rooms.size())
+        return;
+
+    Room &room = mainMenu[currentMenuIndex].rooms[currentSubmenuIndex];
+    if (index >= room.devices.size() || inEditMode)
+        return;
+
+    TRACE_SCOPE("render line");
+
+    // The cursor is on the text baseline, clear from one line above it
+    uint32_t start = micros();
+    int y = MENU_ITEM_START_Y + index * LINE_HEIGHT;
+    gfx->fillRect(0, y - LINE_HEIGHT + LINE_DESCENT, gfx->width(), LINE_HEIGHT, COLOR_BACKGROUND);
+    drawDeviceLine(room.devices[index], index, y);
+    noteFrame(micros() - start);
+}
+
 void displaySettingsMenu()
 {
     gfx->setTextColor(COLOR_TITLE);
@@ -190,10 +263,11 @@ void displaySettingsMenu()
         "WiFi: " + (ap_mode ? "AP Mode" : wifi_ssid),
         "IP: " + (ap_mode ? WiFi.softAPIP().toString() : WiFi.localIP().toString()),
         ap_mode ? "Switch to STA" : "Switch to AP",
+        "Diagnostics",
         "Back"};
 
     int y = MENU_ITEM_START_Y;
-    for (int i = 0; i < 4; i++)
+    for (int i = 0; i < 5; i++)
     {
         gfx->setTextColor(i == currentSettingIndex ? COLOR_SELECTED : COLOR_TEXT);
         gfx->setCursor(20, y);
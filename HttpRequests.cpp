@@ -1,58 +1,419 @@
 #include "SmartMenuSystem.h"
+#include <atomic>
 
-void executeRequest(String url)
+// Outbound requests are handed to a worker task so that a slow or dead
+// backend never blocks input and rendering on the main loop. Commands are
+// copied into fixed-size slots; a newer command for a device that is still
+// waiting replaces the older one instead of queueing behind it.
+static OutboundRequest outboundQueue[OUTBOUND_QUEUE_LENGTH];
+static int outboundCount = 0;
+static SemaphoreHandle_t outboundMutex = nullptr;
+static TaskHandle_t outboundTask = nullptr;
+
+// Hedged GETs for actions. Both copies of an action run on the action
+// workers, so the outbound worker moves on to device commands at once. An
+// action is open while its slot holds its id; the first copy to answer
+// closes it and is the only one the circuit breaker and latency stats see.
+struct HedgeJob
+{
+    char url[OUTBOUND_URL_SIZE];
+    uint32_t id;
+    uint32_t inputMicros;
+    TickType_t fireAt; // 0 for the first copy
+};
+
+static QueueHandle_t hedgeQueue = nullptr;
+static uint32_t lastActionId = 0;
+static std::atomic<uint32_t> openActions[HEDGE_QUEUE_LENGTH];
+
+// Reads {"value": ...} from the backend's reply, if there is one
+static bool readReplyValue(HTTPClient &http, char *value, size_t size)
+{
+    int length = http.getSize();
+    if (length <= 0 || length > OUTBOUND_REPLY_SIZE)
+        return false;
+
+    // Runs on the worker task, so it cannot use the shared JSON arena
+    StaticJsonDocument<OUTBOUND_REPLY_SIZE> doc;
+    if (deserializeJson(doc, http.getStream()) || !doc["value"].is<const char *>())
+        return false;
+
+    strlcpy(value, doc["value"].as<const char *>(), size);
+    return true;
+}
+
+// Sends the request through the upstream layer: per-host timeouts and fail
+// fast while the host's circuit is open. Returns the HTTP status or a
+// negative error; the caller feeds the outcome to the circuit with
+// recordHttp().
+static int sendHttp(HTTPClient &http, const char *url, bool probe, const uint8_t *body, size_t bodyLength,
+                    uint32_t &rttMs)
+{
+    rttMs = 0;
+    uint32_t connectTimeoutMs, readTimeoutMs;
+    if (!upstreamAllow(url, probe, connectTimeoutMs, readTimeoutMs))
+        return UPSTREAM_CIRCUIT_OPEN;
+
+    http.setConnectTimeout(connectTimeoutMs);
+    http.setTimeout(readTimeoutMs);
+    http.begin(url);
+
+    unsigned long start = millis();
+    int httpResponseCode;
+    if (body == nullptr)
+    {
+        httpResponseCode = http.GET();
+    }
+    else
+    {
+        http.addHeader("Content-Type", "application/json");
+        httpResponseCode = http.POST((uint8_t *)body, bodyLength);
+    }
+
+    rttMs = millis() - start;
+    return httpResponseCode;
+}
+
+// Requests that never left because the circuit is open are not an outcome
+static void recordHttp(const char *url, int httpResponseCode, uint32_t rttMs)
+{
+    if (httpResponseCode != UPSTREAM_CIRCUIT_OPEN)
+        upstreamRecord(url, httpResponseCode, rttMs);
+}
+
+static void logResult(bool isAction, int httpResponseCode)
+{
+    const char *what = isAction ? "Request" : "Device request";
+    if (httpResponseCode > 0)
+        Serial.printf("%s sent successfully: %d\n", what, httpResponseCode);
+    else if (httpResponseCode == UPSTREAM_CIRCUIT_OPEN)
+        Serial.printf("%s skipped, upstream is down\n", what);
+    else
+        Serial.printf("%s failed: %d\n", what, httpResponseCode);
+}
+
+// Returns true for the first copy of an action to get here
+static bool closeAction(uint32_t id)
+{
+    uint32_t expected = id;
+    return openActions[id % HEDGE_QUEUE_LENGTH].compare_exchange_strong(expected, 0);
+}
+
+static bool actionOpen(uint32_t id)
+{
+    return openActions[id % HEDGE_QUEUE_LENGTH].load() == id;
+}
+
+// Action worker: runs the first copy of an action right away and the hedge
+// once hedge_delay_ms has passed without an answer. There are two, so the
+// hedge can run while the first copy is still waiting.
+static void hedgeWorker(void *)
 {
-    if (WiFi.status() == WL_CONNECTED)
+    HedgeJob job;
+
+    for (;;)
     {
+        xQueueReceive(hedgeQueue, &job, portMAX_DELAY);
+        bool isHedge = job.fireAt != 0;
+
+        if (isHedge)
+        {
+            int32_t wait = (int32_t)(job.fireAt - xTaskGetTickCount());
+            if (wait > 0)
+                vTaskDelay(wait);
+
+            if (!actionOpen(job.id) || WiFi.status() != WL_CONNECTED)
+                continue;
+        }
+
+        TRACE_SCOPE(isHedge ? "outbound hedge" : "outbound GET");
         HTTPClient http;
-        http.begin(url);
-        int httpResponseCode = http.GET();
+        uint32_t rttMs;
+        int httpResponseCode = sendHttp(http, job.url, false, nullptr, 0, rttMs);
+        http.end();
 
+        // A hedge turned away by a circuit that opened meanwhile leaves the
+        // answer to the first copy. The loser's outcome says nothing new
+        // about the host.
+        if ((isHedge && httpResponseCode == UPSTREAM_CIRCUIT_OPEN) || !closeAction(job.id))
+            continue;
+
+        recordHttp(job.url, httpResponseCode, rttMs);
         if (httpResponseCode > 0)
         {
-            Serial.println("Request executed successfully: " + String(httpResponseCode));
+            markBackendReply(job.inputMicros);
+            if (isHedge)
+                Serial.printf("Hedged request won: %d\n", httpResponseCode);
         }
-        else
+        logResult(true, httpResponseCode);
+    }
+}
+
+// Hands an action to the action workers, false if they are busy
+static bool dispatchHedgedAction(const OutboundRequest &request)
+{
+    HedgeJob job;
+    strlcpy(job.url, request.url, sizeof(job.url));
+    job.id = ++lastActionId;
+    job.inputMicros = request.inputMicros;
+    job.fireAt = 0;
+
+    if (uxQueueSpacesAvailable(hedgeQueue) < 2)
+        return false;
+
+    openActions[job.id % HEDGE_QUEUE_LENGTH].store(job.id);
+    xQueueSend(hedgeQueue, &job, 0);
+
+    TickType_t fireAt = xTaskGetTickCount() + pdMS_TO_TICKS(hedge_delay_ms);
+    job.fireAt = fireAt != 0 ? fireAt : 1;
+    xQueueSend(hedgeQueue, &job, 0);
+    return true;
+}
+
+static void performRequest(const OutboundRequest &request)
+{
+    if (WiFi.status() != WL_CONNECTED)
+    {
+        if (request.isProbe)
+            upstreamRecord(request.url, -1, 0);
+        postCommandResult(request.sequence, request.deviceId, request.type, request.value, -1);
+        return;
+    }
+
+    uint32_t rttMs;
+    if (request.isProbe)
+    {
+        TRACE_SCOPE("outbound probe");
+        HTTPClient http;
+        int httpResponseCode = sendHttp(http, request.url, true, nullptr, 0, rttMs);
+        http.end();
+        recordHttp(request.url, httpResponseCode, rttMs);
+        return;
+    }
+
+    // Actions are plain GETs and safe to repeat, hedge them if configured
+    if (request.isAction && hedge_delay_ms > 0 && dispatchHedgedAction(request))
+        return;
+
+    TRACE_SCOPE(request.isAction ? "outbound GET" : "outbound POST");
+    HTTPClient http;
+    int httpResponseCode;
+    if (request.isAction)
+    {
+        httpResponseCode = sendHttp(http, request.url, false, nullptr, 0, rttMs);
+    }
+    else
+    {
+        httpResponseCode = sendHttp(http, request.url, false, (const uint8_t *)request.body, request.bodyLength, rttMs);
+    }
+    recordHttp(request.url, httpResponseCode, rttMs);
+
+    if (httpResponseCode > 0)
+    {
+        markBackendReply(request.inputMicros);
+    }
+    logResult(request.isAction, httpResponseCode);
+
+    if (!request.isAction)
+    {
+        char value[OUTBOUND_VALUE_SIZE];
+        if (httpResponseCode < 200 || httpResponseCode >= 300 || !readReplyValue(http, value, sizeof(value)))
         {
-            Serial.println("Request failed: " + String(httpResponseCode));
+            strlcpy(value, request.value, sizeof(value));
         }
+        postCommandResult(request.sequence, request.deviceId, request.type, value, httpResponseCode);
+    }
 
-        http.end();
+    http.end();
+}
+
+static void outboundWorker(void *)
+{
+    OutboundRequest request;
+
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        for (;;)
+        {
+            xSemaphoreTake(outboundMutex, portMAX_DELAY);
+            if (outboundCount == 0)
+            {
+                xSemaphoreGive(outboundMutex);
+                break;
+            }
+            request = outboundQueue[0];
+            outboundCount--;
+            memmove(&outboundQueue[0], &outboundQueue[1], outboundCount * sizeof(OutboundRequest));
+            xSemaphoreGive(outboundMutex);
+
+            performRequest(request);
+        }
     }
 }
 
+void initializeOutbound()
+{
+    outboundMutex = xSemaphoreCreateMutex();
+    hedgeQueue = xQueueCreate(HEDGE_QUEUE_LENGTH, sizeof(HedgeJob));
+    xTaskCreate(outboundWorker, "outbound", OUTBOUND_TASK_STACK, nullptr, OUTBOUND_TASK_PRIORITY, &outboundTask);
+    xTaskCreate(hedgeWorker, "action1", OUTBOUND_TASK_STACK, nullptr, OUTBOUND_TASK_PRIORITY, nullptr);
+    xTaskCreate(hedgeWorker, "action2", OUTBOUND_TASK_STACK, nullptr, OUTBOUND_TASK_PRIORITY, nullptr);
+}
+
+static bool enqueueRequest(const OutboundRequest &request)
+{
+    if (outboundMutex == nullptr)
+        return false;
+
+    xSemaphoreTake(outboundMutex, portMAX_DELAY);
+
+    int slot = outboundCount;
+    if (!request.isAction)
+    {
+        for (int i = 0; i < outboundCount; i++)
+        {
+            if (!outboundQueue[i].isAction && strcmp(outboundQueue[i].deviceId, request.deviceId) == 0)
+            {
+                slot = i;
+                break;
+            }
+        }
+    }
+
+    if (slot == OUTBOUND_QUEUE_LENGTH)
+    {
+        xSemaphoreGive(outboundMutex);
+        Serial.println("Outbound queue full, dropping request");
+        return false;
+    }
+
+    outboundQueue[slot] = request;
+    if (slot == outboundCount)
+    {
+        outboundCount++;
+    }
+    xSemaphoreGive(outboundMutex);
+
+    xTaskNotifyGive(outboundTask);
+    return true;
+}
+
+// Health check for a host whose circuit is open, see Upstream.cpp
+bool enqueueProbe(const char *url)
+{
+    OutboundRequest request;
+    request.isAction = true;
+    request.isProbe = true;
+    strlcpy(request.url, url, sizeof(request.url));
+    request.deviceId[0] = '\0';
+    request.bodyLength = 0;
+    request.inputMicros = 0;
+    request.sequence = 0;
+
+    return enqueueRequest(request);
+}
+
+// URLs are copied into fixed-size queue slots, longer ones are dropped
+void executeRequest(String url)
+{
+    if (WiFi.status() != WL_CONNECTED)
+        return;
+
+    if (url.length() >= OUTBOUND_URL_SIZE)
+    {
+        Serial.printf("Request URL too long (%u characters, at most %d), dropping\n", url.length(),
+                      OUTBOUND_URL_SIZE - 1);
+        return;
+    }
+
+    OutboundRequest request;
+    request.isAction = true;
+    request.isProbe = false;
+    strlcpy(request.url, url.c_str(), sizeof(request.url));
+    request.deviceId[0] = '\0';
+    request.bodyLength = 0;
+    request.sequence = 0;
+    request.inputMicros = inputEventMicros;
+
+    enqueueRequest(request);
+}
+
 void sendDeviceRequest(String deviceId, String type, String value)
 {
-    if (main_url.length() == 0 || WiFi.status() != WL_CONNECTED)
+    bool mqtt = usingMqtt();
+
+    // The device keeps showing the new value, marked as pending, until the
+    // transport reports back (see Commands.cpp)
+    Device *device = findDeviceById(deviceId);
+    uint32_t sequence = device != nullptr ? beginDeviceCommand(*device) : 0;
+
+    if (!mqtt && main_url.length() == 0)
+    {
+        // No backend configured, the knob is the only source of truth
+        if (device != nullptr)
+            confirmDevice(*device);
         return;
+    }
 
-    HTTPClient http;
-    http.begin(main_url);
-    http.addHeader("Content-Type", "application/json");
+    if (!mqtt && main_url.length() >= OUTBOUND_URL_SIZE)
+    {
+        Serial.printf("main_url too long (%u characters, at most %d), dropping device request\n",
+                      main_url.length(), OUTBOUND_URL_SIZE - 1);
+        postCommandResult(sequence, deviceId.c_str(), type.c_str(), value.c_str(), -1);
+        return;
+    }
 
-    DynamicJsonDocument doc(200);
+    if (WiFi.status() != WL_CONNECTED || deviceId.length() >= OUTBOUND_DEVICE_ID_SIZE ||
+        type.length() >= OUTBOUND_TYPE_SIZE || value.length() >= OUTBOUND_VALUE_SIZE)
+    {
+        Serial.println("Device request cannot be sent");
+        postCommandResult(sequence, deviceId.c_str(), type.c_str(), value.c_str(), -1);
+        return;
+    }
+
+    JsonDocument &doc = beginJson();
     doc["device_id"] = deviceId;
     doc["type"] = type;
     doc["value"] = value;
 
-    String jsonString;
-    serializeJson(doc, jsonString);
-
-    int httpResponseCode = http.POST(jsonString);
-
-    if (httpResponseCode > 0)
+    size_t length = serializeJsonArena();
+    if (length == 0 || length > OUTBOUND_BODY_SIZE)
     {
-        Serial.println("Device request sent successfully: " + String(httpResponseCode));
+        postCommandResult(sequence, deviceId.c_str(), type.c_str(), value.c_str(), -1);
+        return;
     }
-    else
+
+    if (mqtt)
     {
-        Serial.println("Device request failed: " + String(httpResponseCode));
+        // The MQTT task reports back once it has published
+        if (!publishDeviceCommand(sequence, deviceId, type, value, jsonOutBuffer, length))
+        {
+            postCommandResult(sequence, deviceId.c_str(), type.c_str(), value.c_str(), -1);
+        }
+        return;
     }
 
-    http.end();
+    OutboundRequest request;
+    request.isAction = false;
+    request.isProbe = false;
+    strlcpy(request.url, main_url.c_str(), sizeof(request.url));
+    strlcpy(request.deviceId, deviceId.c_str(), sizeof(request.deviceId));
+    strlcpy(request.type, type.c_str(), sizeof(request.type));
+    strlcpy(request.value, value.c_str(), sizeof(request.value));
+    memcpy(request.body, jsonOutBuffer, length);
+    request.bodyLength = length;
+    request.inputMicros = inputEventMicros;
+    request.sequence = sequence;
+
+    if (!enqueueRequest(request))
+    {
+        postCommandResult(sequence, deviceId.c_str(), type.c_str(), value.c_str(), -1);
+    }
 }
 
-void updateDeviceState(String deviceId, String type, String value)
+Device *findDeviceById(const String &deviceId)
 {
     for (auto &menu : mainMenu)
     {
@@ -61,22 +422,46 @@ void updateDeviceState(String deviceId, String type, String value)
             for (auto &device : room.devices)
             {
                 if (device.device_id == deviceId)
-                {
-                    if (type == "onoff")
-                    {
-                        device.state = (value == "1");
-                    }
-                    else if (type == "brightness")
-                    {
-                        device.brightness = value.toInt();
-                    }
-                    else if (type == "color")
-                    {
-                        device.color = value;
-                    }
-                    return;
-                }
+                    return &device;
             }
         }
     }
+    return nullptr;
+}
+
+void applyDeviceValue(Device &device, const String &type, const String &value)
+{
+    if (type == "onoff")
+    {
+        device.state = (value == "1");
+    }
+    else if (type == "brightness")
+    {
+        // The backend may report anything, the gauge only has 0..100
+        device.brightness = constrain(value.toInt(), 0, 100);
+    }
+    else if (type == "color")
+    {
+        device.color = value;
+    }
+}
+
+void updateDeviceState(String deviceId, String type, String value)
+{
+    Device *device = findDeviceById(deviceId);
+    if (device == nullptr)
+        return;
+
+    applyDeviceValue(*device, type, value);
+}
+
+// State reported by the backend itself replaces whatever is pending
+void confirmDeviceState(String deviceId, String type, String value)
+{
+    Device *device = findDeviceById(deviceId);
+    if (device == nullptr)
+        return;
+
+    applyDeviceValue(*device, type, value);
+    confirmDevice(*device);
 }
@@ -0,0 +1,44 @@
+#include "SmartMenuSystem.h"
+#include <esp_heap_caps.h>
+
+// One JSON document and one output buffer are shared by every network path.
+// The web server and the main loop run on the same task, so only one request
+// is ever being encoded or decoded at a time and the memory is allocated once
+// at boot instead of per request.
+DynamicJsonDocument jsonArena(JSON_ARENA_SIZE);
+char jsonOutBuffer[JSON_OUT_BUFFER_SIZE];
+size_t jsonOutLength = 0;
+
+// Clears the shared document and hands it out for a new request.
+JsonDocument &beginJson()
+{
+    jsonArena.clear();
+    return jsonArena;
+}
+
+// Serializes the shared document into jsonOutBuffer. Returns 0 if the
+// payload does not fit, so callers never send a truncated document.
+size_t serializeJsonArena()
+{
+    TRACE_SCOPE("json serialize");
+    if (measureJson(jsonArena) >= JSON_OUT_BUFFER_SIZE)
+    {
+        Serial.println("JSON payload too large for output buffer");
+        jsonOutLength = 0;
+        return 0;
+    }
+
+    jsonOutLength = serializeJson(jsonArena, jsonOutBuffer, JSON_OUT_BUFFER_SIZE);
+    return jsonOutLength;
+}
+
+// Menu configs are only parsed at boot or on a reload and can be far larger
+// than the arena, so they get a document of their own that is freed once the
+// menu is built. Parsed strings and slots take about twice the text of a
+// compact config; the size is capped by what the heap can still give.
+size_t menuJsonCapacity(size_t jsonLength)
+{
+    size_t capacity = jsonLength * 2 + JSON_ARENA_SIZE;
+    size_t available = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) / 2;
+    return capacity < available ? capacity : available;
+}
@@ -1,4 +1,5 @@
 #include <U8g2lib.h>
+#include <LittleFS.h>
 #include "SmartMenuSystem.h"
 #include "WebInterface.h"
 
@@ -20,6 +21,14 @@ std::vector<MenuLevel> mainMenu;
 String wifi_ssid = "";
 String wifi_password = "";
 String main_url = "";
+uint32_t request_timeout_ms = DEFAULT_REQUEST_TIMEOUT_MS;
+String transport = "http";
+String mqtt_host = "";
+int mqtt_port = 1883;
+String mqtt_prefix = "knobble";
+String mqtt_user = "";
+String mqtt_password = "";
+String admin_password = "";
 bool ap_mode = false;
 
 // Navigation State
@@ -65,11 +74,17 @@ void setup()
     preferences.begin("menu_config", false);
     Serial.println("Preferences initialized");
 
+    // Mount the filesystem holding the menu config
+    initializeStorage();
+
     // Initialize display
     Serial.println("Initializing display...");
     initializeDisplay();
     Serial.println("Display initialized");
 
+    // Precompute the edit control geometry
+    initializeControls();
+
     // Test display with simple content
     // Serial.println("Testing display...");
     // testDisplay();
@@ -77,42 +92,83 @@ void setup()
     // Initialize input
     initializeInput();
 
+    // Start the idle timers with the backlight on
+    initializePower();
+
     // Load configuration
     loadConfiguration();
 
+    // Record Wi-Fi events in the trace
+    initializeTrace();
+
+    // Start the outbound request worker
+    initializeUpstream();
+    initializeCommands();
+    initializeOutbound();
+
+    // Load menu structure
+    loadMenuStructure();
+
+    // Back to where we were before the reboot
+    restoreSnapshot();
+
+    // Display initial menu, before waiting for WiFi
+    displayCurrentMenu();
+
     // Initialize WiFi
     initializeWiFi();
 
+    // The settings screen shows the address we only know now
+    if (currentState == SETTINGS_MENU)
+    {
+        requestRedraw();
+    }
+
     // Initialize web server
     initializeWebServer();
 
-    // Load menu structure
-    loadMenuStructure();
+    // Connect to the MQTT broker if configured
+    initializeTransport();
 
-    // Display initial menu
-    displayCurrentMenu();
+    // Register loop tasks
+    initializeScheduler();
+
+    // Everything came up, keep this firmware on the next boot
+    markFirmwareValid();
 
     Serial.println("Smart Menu System initialized");
 }
 
-void loop()
+static void handleWebClients()
 {
-    // Keep the loop simple for debugging
     server.handleClient();
+}
 
-    // Handle encoder input
-    handleEncoderInput();
+static void heartbeat()
+{
+    Serial.println("System running... (heartbeat)");
+    reportSchedulerStats();
+}
 
-    // Handle button input
-    handleButtonInput();
+void initializeScheduler()
+{
+    addTask("input", PRIORITY_INPUT, 0, INPUT_TASK_BUDGET_US, handleInput);
+    addTask("render", PRIORITY_RENDER, 0, RENDER_TASK_BUDGET_US, renderDisplay);
+    addTask("network", PRIORITY_NETWORK, 0, NETWORK_TASK_BUDGET_US, handleWebClients);
+    addTask("mqtt", PRIORITY_NETWORK, 0, NETWORK_TASK_BUDGET_US, handleTransport);
+    addTask("commands", PRIORITY_NETWORK, 0, NETWORK_TASK_BUDGET_US, handleCommandResults);
+    addTask("heartbeat", PRIORITY_HOUSEKEEPING, 5000, HOUSEKEEPING_TASK_BUDGET_US, heartbeat);
+    addTask("snapshot", PRIORITY_HOUSEKEEPING, SNAPSHOT_CHECK_MS, HOUSEKEEPING_TASK_BUDGET_US, updateSnapshot);
+    addTask("diagnostics", PRIORITY_HOUSEKEEPING, DIAGNOSTICS_INTERVAL_MS, HOUSEKEEPING_TASK_BUDGET_US, updateDiagnostics);
+    addTask("upstream probes", PRIORITY_HOUSEKEEPING, 1000, HOUSEKEEPING_TASK_BUDGET_US, probeUpstreams);
+}
 
-    // Simple heartbeat to show the system is running
-    static unsigned long lastHeartbeat = 0;
-    if (millis() - lastHeartbeat > 5000)
-    {
-        Serial.println("System running... (heartbeat)");
-        lastHeartbeat = millis();
-    }
+void loop()
+{
+    runScheduler();
+
+    // Dim the backlight and slow down when idle
+    updatePower();
 }
 
 void testDisplay()
@@ -222,6 +278,14 @@ void loadConfiguration()
     wifi_ssid = preferences.getString("wifi_ssid", "");
     wifi_password = preferences.getString("wifi_password", "");
     main_url = preferences.getString("main_url", "");
+    request_timeout_ms = preferences.getUInt("req_timeout", DEFAULT_REQUEST_TIMEOUT_MS);
+    transport = preferences.getString("transport", "http");
+    mqtt_host = preferences.getString("mqtt_host", "");
+    mqtt_port = preferences.getInt("mqtt_port", 1883);
+    mqtt_prefix = preferences.getString("mqtt_prefix", "knobble");
+    mqtt_user = preferences.getString("mqtt_user", "");
+    mqtt_password = preferences.getString("mqtt_password", "");
+    admin_password = preferences.getString("admin_pass", "");
     ap_mode = preferences.getBool("ap_mode", false);
 }
 
@@ -230,6 +294,14 @@ void saveConfiguration()
     preferences.putString("wifi_ssid", wifi_ssid);
     preferences.putString("wifi_password", wifi_password);
     preferences.putString("main_url", main_url);
+    preferences.putUInt("req_timeout", request_timeout_ms);
+    preferences.putString("transport", transport);
+    preferences.putString("mqtt_host", mqtt_host);
+    preferences.putInt("mqtt_port", mqtt_port);
+    preferences.putString("mqtt_prefix", mqtt_prefix);
+    preferences.putString("mqtt_user", mqtt_user);
+    preferences.putString("mqtt_password", mqtt_password);
+    preferences.putString("admin_pass", admin_password);
     preferences.putBool("ap_mode", ap_mode);
 }
 
@@ -288,6 +360,10 @@ void initializeWebServer()
     server.on("/menu", HTTP_POST, handleMenuConfig);
     server.on("/control", HTTP_POST, handleDeviceControl);
     server.on("/status", HTTP_GET, handleStatus);
+    server.on("/update", HTTP_POST, handleUpdateDone, handleUpdateUpload);
+    server.on("/latency", HTTP_GET, handleLatency);
+    server.on("/bench", HTTP_POST, handleBench);
+    server.on("/trace", HTTP_GET, handleTrace);
 
     server.begin();
     Serial.println("Web server started");
@@ -295,76 +371,150 @@ void initializeWebServer()
 
 void loadMenuStructure()
 {
-    String menuJson = preferences.getString("menu_json", getDefaultMenuJson());
+    DynamicJsonDocument doc(0);
+    DeserializationError error = DeserializationError::EmptyInput;
 
-    DynamicJsonDocument doc(4096);
-    deserializeJson(doc, menuJson);
+    // Stream the stored config from flash, falling back to the previous one
+    const char *paths[] = {MENU_CONFIG_PATH, MENU_CONFIG_BACKUP_PATH};
+    for (const char *path : paths)
+    {
+        File file = LittleFS.open(path, "r");
+        if (!file)
+            continue;
+
+        TRACE_BEGIN("json parse menu");
+        doc = DynamicJsonDocument(menuJsonCapacity(file.size()));
+        error = deserializeJson(doc, file);
+        TRACE_END("json parse menu");
+        file.close();
+        if (!error)
+            break;
+
+        Serial.printf("Failed to parse %s: %s\n", path, error.c_str());
+        doc.clear();
+    }
+
+    // Configs saved by older firmware live in preferences
+    if (error)
+    {
+        String menuJson = preferences.getString("menu_json", getDefaultMenuJson());
+        TRACE_SCOPE("json parse menu");
+        doc = DynamicJsonDocument(menuJsonCapacity(menuJson.length()));
+        error = deserializeJson(doc, menuJson);
+    }
 
-    mainMenu.clear();
+    // Out of memory or broken everywhere, keep what is on screen
+    if (error && !mainMenu.empty())
+    {
+        Serial.printf("Keeping current menu: %s\n", error.c_str());
+        return;
+    }
+
+    // Load settings from JSON
+    if (doc.containsKey("settings"))
+    {
+        JsonObject settings = doc["settings"];
+        if (settings.containsKey("wifi_ssid"))
+        {
+            wifi_ssid = settings["wifi_ssid"].as<String>();
+        }
+        if (settings.containsKey("wifi_password"))
+        {
+            wifi_password = settings["wifi_password"].as<String>();
+        }
+        if (settings.containsKey("main_url"))
+        {
+            main_url = settings["main_url"].as<String>();
+        }
+        if (settings.containsKey("request_timeout_ms"))
+        {
+            request_timeout_ms = settings["request_timeout_ms"].as<uint32_t>();
+        }
+        if (settings.containsKey("upstream"))
+        {
+            configureUpstream(settings["upstream"]);
+        }
+        if (settings.containsKey("transport"))
+        {
+            transport = settings["transport"].as<String>();
+        }
+        if (settings.containsKey("mqtt"))
+        {
+            JsonObject mqtt = settings["mqtt"];
+            mqtt_host = mqtt["host"] | mqtt_host;
+            mqtt_port = mqtt["port"] | mqtt_port;
+            mqtt_prefix = mqtt["prefix"] | mqtt_prefix;
+            mqtt_user = mqtt["user"] | mqtt_user;
+            mqtt_password = mqtt["password"] | mqtt_password;
+        }
+        saveConfiguration();
+    }
+
+    // Built in place: vectors are reserved up front because a growing vector
+    // copies Strings instead of moving them
+    std::vector<MenuLevel> parsedMenu;
 
     JsonArray menuArray = doc["menu"].as<JsonArray>();
+    parsedMenu.reserve(menuArray.size());
     for (JsonObject menuItem : menuArray)
     {
-        MenuLevel level;
+        parsedMenu.emplace_back();
+        MenuLevel &level = parsedMenu.back();
         level.name = menuItem["name"].as<String>();
 
         if (menuItem.containsKey("submenus"))
         {
             JsonArray submenus = menuItem["submenus"];
+            level.rooms.reserve(submenus.size());
             for (JsonObject submenu : submenus)
             {
-                Room room;
+                level.rooms.emplace_back();
+                Room &room = level.rooms.back();
                 room.name = submenu["name"].as<String>();
 
                 if (submenu.containsKey("devices"))
                 {
                     JsonArray devices = submenu["devices"];
+                    room.devices.reserve(devices.size());
                     for (JsonObject device : devices)
                     {
-                        Device dev;
+                        room.devices.emplace_back();
+                        Device &dev = room.devices.back();
                         dev.name = device["name"].as<String>();
                         dev.type = device["type"].as<String>();
                         dev.device_id = device["device_id"].as<String>();
-                        room.devices.push_back(dev);
                     }
                 }
-                level.rooms.push_back(room);
             }
         }
 
         if (menuItem.containsKey("actions"))
         {
             JsonArray actions = menuItem["actions"];
+            level.requests.reserve(actions.size());
             for (JsonObject action : actions)
             {
-                Request req;
+                level.requests.emplace_back();
+                Request &req = level.requests.back();
                 req.name = action["name"].as<String>();
                 req.url = action["url"].as<String>();
-                level.requests.push_back(req);
             }
         }
-
-        mainMenu.push_back(level);
     }
 
-    // Load settings from JSON
-    if (doc.containsKey("settings"))
-    {
-        JsonObject settings = doc["settings"];
-        if (settings.containsKey("wifi_ssid"))
-        {
-            wifi_ssid = settings["wifi_ssid"].as<String>();
-        }
-        if (settings.containsKey("wifi_password"))
-        {
-            wifi_password = settings["wifi_password"].as<String>();
-        }
-        if (settings.containsKey("main_url"))
-        {
-            main_url = settings["main_url"].as<String>();
-        }
-        saveConfiguration();
-    }
+    // The parsed text is no longer needed, free it before the merge
+    doc = DynamicJsonDocument(0);
+
+    // Merge into the running menu, keeping device state and the cursor
+    applyMenuStructure(parsedMenu);
+}
+
+// Applies a newly saved config while running: the menu, and the settings
+// in it that the transport was set up with
+void reloadMenuConfig()
+{
+    loadMenuStructure();
+    initializeTransport();
 }
 
 String getDefaultMenuJson()
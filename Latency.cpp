@@ -0,0 +1,312 @@
+#include "SmartMenuSystem.h"
+#include <algorithm>
+
+// Input latency measurements. Every encoder step or button press is
+// timestamped; the time until the next completed frame and until the
+// backend answered the resulting device request are kept in small sample
+// rings and reported as percentiles on /latency. Scripted input traces can
+// be replayed through the same input path with /bench.
+
+struct LatencySamples
+{
+    uint32_t samples[LATENCY_SAMPLE_COUNT];
+    uint32_t count;
+    uint32_t next;
+};
+
+static LatencySamples frameLatency;
+static LatencySamples backendLatency;
+static portMUX_TYPE latencyLock = portMUX_INITIALIZER_UNLOCKED;
+
+// First input not yet on screen, and the input currently being handled
+static uint32_t unrenderedInputMicros = 0;
+uint32_t inputEventMicros = 0;
+
+static void addSample(LatencySamples &ring, uint32_t value)
+{
+    portENTER_CRITICAL(&latencyLock);
+    ring.samples[ring.next] = value;
+    ring.next = (ring.next + 1) % LATENCY_SAMPLE_COUNT;
+    if (ring.count < LATENCY_SAMPLE_COUNT)
+        ring.count++;
+    portEXIT_CRITICAL(&latencyLock);
+}
+
+void markInput()
+{
+    uint32_t now = micros();
+    // Keep 0 free to mean "no input"
+    inputEventMicros = now == 0 ? 1 : now;
+    if (unrenderedInputMicros == 0)
+        unrenderedInputMicros = inputEventMicros;
+}
+
+// Device requests sent after this are no longer caused by an input event
+void finishInput()
+{
+    inputEventMicros = 0;
+}
+
+void markFrame()
+{
+    if (unrenderedInputMicros == 0)
+        return;
+
+    addSample(frameLatency, micros() - unrenderedInputMicros);
+    unrenderedInputMicros = 0;
+}
+
+// Most recent input-to-frame latency, 0 before the first input
+uint32_t getLastFrameLatency()
+{
+    portENTER_CRITICAL(&latencyLock);
+    uint32_t value = frameLatency.count == 0 ? 0 : frameLatency.samples[(frameLatency.next + LATENCY_SAMPLE_COUNT - 1) % LATENCY_SAMPLE_COUNT];
+    portEXIT_CRITICAL(&latencyLock);
+    return value;
+}
+
+// Called from the outbound worker when the backend answered
+void markBackendReply(uint32_t inputMicros)
+{
+    if (inputMicros == 0)
+        return;
+
+    addSample(backendLatency, micros() - inputMicros);
+}
+
+static void writePercentiles(JsonObject out, LatencySamples &ring)
+{
+    static uint32_t sorted[LATENCY_SAMPLE_COUNT];
+
+    portENTER_CRITICAL(&latencyLock);
+    uint32_t count = ring.count;
+    memcpy(sorted, ring.samples, count * sizeof(uint32_t));
+    portEXIT_CRITICAL(&latencyLock);
+
+    out["count"] = count;
+    if (count == 0)
+        return;
+
+    std::sort(sorted, sorted + count);
+    out["p50_us"] = sorted[(count - 1) * 50 / 100];
+    out["p95_us"] = sorted[(count - 1) * 95 / 100];
+    out["p99_us"] = sorted[(count - 1) * 99 / 100];
+    out["max_us"] = sorted[count - 1];
+}
+
+void resetLatencyStats()
+{
+    portENTER_CRITICAL(&latencyLock);
+    frameLatency.count = frameLatency.next = 0;
+    backendLatency.count = backendLatency.next = 0;
+    portEXIT_CRITICAL(&latencyLock);
+}
+
+// Where the cursor has to be for a trace to do what it is meant to
+enum TraceStart
+{
+    TRACE_START_LIST,       // Any list, turns only
+    TRACE_START_BRIGHTNESS, // A brightness device
+    TRACE_START_TOGGLE      // An on/off device or a request
+};
+
+// Scripted input traces: a step is an encoder turn (+1/-1) or a press (0)
+struct InputTrace
+{
+    const char *name;
+    TraceStart start;
+    int8_t steps[64];
+    uint8_t length;
+};
+
+static const InputTrace inputTraces[] = {
+    // Fast spin down a long list and back up
+    {"spin", TRACE_START_LIST, {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+              -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     40},
+    // Enter edit mode on a brightness device, sweep up and down, leave
+    {"sweep", TRACE_START_BRIGHTNESS, {0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+               -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0},
+     42},
+    // Toggle the selected device or run the selected request
+    {"toggle", TRACE_START_TOGGLE, {0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, 10},
+};
+
+static const InputTrace *activeTrace = nullptr;
+static uint8_t traceStep = 0;
+static uint8_t traceRepeat = 0;
+static uint8_t traceRepeats = 1;
+static uint32_t traceIntervalMs = 16;
+static unsigned long lastTraceStep = 0;
+
+// The item the trace started on, its presses only land there
+static MenuState traceState = MAIN_MENU;
+static int traceMenuIndex = 0;
+static int traceSubmenuIndex = 0;
+static int traceDeviceIndex = 0;
+
+static const Device *selectedDevice()
+{
+    if (currentState != DEVICE_CONTROL || currentMenuIndex >= mainMenu.size() ||
+        currentSubmenuIndex >= mainMenu[currentMenuIndex].rooms.size())
+        return nullptr;
+
+    const Room &room = mainMenu[currentMenuIndex].rooms[currentSubmenuIndex];
+    return currentDeviceIndex < room.devices.size() ? &room.devices[currentDeviceIndex] : nullptr;
+}
+
+static bool requestSelected()
+{
+    if (currentState != SUBMENU || currentMenuIndex >= mainMenu.size())
+        return false;
+
+    const MenuLevel &menu = mainMenu[currentMenuIndex];
+    return currentSubmenuIndex >= menu.rooms.size() &&
+           currentSubmenuIndex < menu.rooms.size() + menu.requests.size();
+}
+
+// A trace replays blind, so it only starts where its presses land on what
+// it was written for. Presses never reach Settings (Switch to AP, Restart).
+static const char *traceStartError(const InputTrace &trace)
+{
+    if (inEditMode)
+        return "Leave edit mode first";
+
+    const Device *device = selectedDevice();
+    switch (trace.start)
+    {
+    case TRACE_START_LIST:
+        if (currentState == DIAGNOSTICS)
+            return "Select a menu list first";
+        break;
+    case TRACE_START_BRIGHTNESS:
+        if (device == nullptr || device->type != "brightness")
+            return "Select a brightness device first";
+        break;
+    case TRACE_START_TOGGLE:
+        if ((device == nullptr || device->type != "onoff") && !requestSelected())
+            return "Select an on/off device or a request first";
+        break;
+    }
+    return nullptr;
+}
+
+static bool onTraceStartItem()
+{
+    if (currentState != traceState || currentMenuIndex != traceMenuIndex || currentSubmenuIndex != traceSubmenuIndex)
+        return false;
+    return currentState != DEVICE_CONTROL || currentDeviceIndex == traceDeviceIndex;
+}
+
+// Returns nullptr once the trace runs, otherwise why it did not start
+const char *startInputTrace(const String &name, uint32_t intervalMs, uint8_t repeats)
+{
+    for (auto &trace : inputTraces)
+    {
+        if (name == trace.name)
+        {
+            const char *error = traceStartError(trace);
+            if (error != nullptr)
+                return error;
+
+            // A dark screen would take the first step as a wake up only
+            registerUserActivity();
+
+            resetLatencyStats();
+            activeTrace = &trace;
+            traceState = currentState;
+            traceMenuIndex = currentMenuIndex;
+            traceSubmenuIndex = currentSubmenuIndex;
+            traceDeviceIndex = currentDeviceIndex;
+            traceStep = 0;
+            traceRepeat = 0;
+            traceRepeats = max(repeats, (uint8_t)1);
+            traceIntervalMs = intervalMs;
+            lastTraceStep = millis();
+            return nullptr;
+        }
+    }
+    return "Unknown trace";
+}
+
+// Input task: feeds the next step of the active trace when it is due
+void replayInputTrace()
+{
+    if (activeTrace == nullptr || millis() - lastTraceStep < traceIntervalMs)
+        return;
+
+    lastTraceStep = millis();
+    int8_t step = activeTrace->steps[traceStep];
+
+    // Someone else moved the cursor meanwhile, don't press blindly. A spin
+    // moves the cursor itself and never presses.
+    if (activeTrace->start != TRACE_START_LIST && !onTraceStartItem())
+    {
+        Serial.printf("Input trace %s stopped, cursor left the start item\n", activeTrace->name);
+        activeTrace = nullptr;
+        return;
+    }
+
+    if (step == 0)
+    {
+        applyButtonPress();
+    }
+    else
+    {
+        applyEncoderStep(step);
+    }
+
+    if (++traceStep == activeTrace->length)
+    {
+        traceStep = 0;
+        if (++traceRepeat == traceRepeats)
+        {
+            Serial.printf("Input trace %s finished\n", activeTrace->name);
+            activeTrace = nullptr;
+        }
+    }
+}
+
+// GET /latency: percentiles in microseconds, ?reset=1 clears them
+void handleLatency()
+{
+    TRACE_SCOPE("http /latency");
+    registerNetworkActivity();
+
+    JsonDocument &doc = beginJson();
+    doc["trace"] = activeTrace != nullptr ? activeTrace->name : "";
+    doc["running"] = activeTrace != nullptr;
+    writePercentiles(doc.createNestedObject("input_to_frame"), frameLatency);
+    writePercentiles(doc.createNestedObject("input_to_backend"), backendLatency);
+
+    serializeJsonArena();
+    sendJsonResponse(200);
+
+    if (server.arg("reset") == "1")
+        resetLatencyStats();
+}
+
+// POST /bench?trace=spin|sweep|toggle&interval_ms=16&repeat=1
+void handleBench()
+{
+    TRACE_SCOPE("http /bench");
+    registerNetworkActivity();
+    if (!requireAdmin())
+        return;
+
+    uint32_t intervalMs = server.hasArg("interval_ms") ? server.arg("interval_ms").toInt() : 16;
+    uint8_t repeats = server.hasArg("repeat") ? constrain(server.arg("repeat").toInt(), 1, 255) : 1;
+
+    const char *error = startInputTrace(server.arg("trace"), intervalMs, repeats);
+    if (error != nullptr)
+    {
+        JsonDocument &doc = beginJson();
+        doc["status"] = "error";
+        doc["message"] = error;
+        serializeJsonArena();
+        sendJsonResponse(400);
+        return;
+    }
+
+    server.send(200, "application/json", "{\"status\":\"started\"}");
+}
@@ -0,0 +1,578 @@
+#include "SmartMenuSystem.h"
+#include <map>
+
+// Applies a freshly parsed menu to the running one, in place. Levels and
+// rooms are matched by name and devices by device_id, first at the same
+// position and then by searching, so a part of the menu that did not change
+// is only compared: its nodes are neither rebuilt nor copied, and only the
+// fields that differ are moved over from the new menu. Runtime values stay
+// with their device even if it moved to another room, the cursor stays on
+// the same item when it still exists, and only the lines that changed on the
+// current screen are redrawn.
+//
+// The config itself is still parsed in full (see loadMenuStructure()), so a
+// reload always costs one pass over every device; what the merge saves is
+// rebuilding the running menu, losing state and repainting the screen.
+
+struct MergeContext
+{
+    MenuDiffStats stats;
+    std::vector<Device> orphans;      // Running devices that lost their place
+    std::vector<Device *> unresolved; // New devices that may have moved from elsewhere
+};
+
+// Moves the config of a new device onto the running one, keeping its runtime
+// state. Returns true if anything changed.
+static bool updateDeviceConfig(Device &running, Device &incoming)
+{
+    bool changed = false;
+    if (running.name != incoming.name)
+    {
+        running.name = std::move(incoming.name);
+        changed = true;
+    }
+    if (running.type != incoming.type)
+    {
+        running.type = std::move(incoming.type);
+        changed = true;
+    }
+    return changed;
+}
+
+static void copyRuntimeState(Device &to, const Device &from)
+{
+    to.state = from.state;
+    to.brightness = from.brightness;
+    to.color = from.color;
+    to.confirmedState = from.confirmedState;
+    to.confirmedBrightness = from.confirmedBrightness;
+    to.confirmedColor = from.confirmedColor;
+    to.commandSequence = from.commandSequence;
+    to.pendingSince = from.pendingSince;
+    to.pending = from.pending;
+    to.failed = from.failed;
+}
+
+static void countDevice(MergeContext &ctx, bool changed)
+{
+    if (changed)
+        ctx.stats.changed++;
+    else
+        ctx.stats.unchanged++;
+}
+
+// Index of the first item not matched yet whose key equals key, starting at
+// hint so that items that kept their place are found straight away
+template <typename T>
+static int findUnmatched(const std::vector<T> &items, const std::vector<bool> &taken, size_t hint, const String &key, String T::*field)
+{
+    for (size_t n = 0; n < items.size(); n++)
+    {
+        size_t i = (hint + n) % items.size();
+        if (!taken[i] && items[i].*field == key)
+            return i;
+    }
+    return -1;
+}
+
+static void addNewDevices(Room &room, MergeContext &ctx)
+{
+    for (auto &device : room.devices)
+    {
+        ctx.unresolved.push_back(&device);
+    }
+}
+
+static void orphanDevices(Room &room, MergeContext &ctx)
+{
+    for (auto &device : room.devices)
+    {
+        ctx.orphans.push_back(std::move(device));
+    }
+}
+
+// The merged vectors are reserved up front: pointers to new devices are kept
+// until the end of the merge, and String has no noexcept move, so a vector
+// that grows would copy its elements instead of moving them.
+static void mergeDevices(Room &running, Room &incoming, MergeContext &ctx)
+{
+    std::vector<Device> &current = running.devices;
+    std::vector<Device> &next = incoming.devices;
+
+    // Same devices in the same order, the common case: update in place
+    bool sameOrder = current.size() == next.size();
+    for (size_t i = 0; sameOrder && i < next.size(); i++)
+    {
+        sameOrder = current[i].device_id == next[i].device_id;
+    }
+    if (sameOrder)
+    {
+        for (size_t i = 0; i < next.size(); i++)
+        {
+            countDevice(ctx, updateDeviceConfig(current[i], next[i]));
+        }
+        return;
+    }
+
+    std::vector<bool> taken(current.size(), false);
+    std::vector<Device> merged;
+    merged.reserve(next.size());
+    for (size_t i = 0; i < next.size(); i++)
+    {
+        int index = findUnmatched(current, taken, i, next[i].device_id, &Device::device_id);
+        if (index >= 0)
+        {
+            taken[index] = true;
+            countDevice(ctx, updateDeviceConfig(current[index], next[i]));
+            merged.push_back(std::move(current[index]));
+        }
+        else
+        {
+            merged.push_back(std::move(next[i]));
+            ctx.unresolved.push_back(&merged.back());
+        }
+    }
+
+    for (size_t i = 0; i < current.size(); i++)
+    {
+        if (!taken[i])
+            ctx.orphans.push_back(std::move(current[i]));
+    }
+    current.swap(merged);
+}
+
+static bool sameRequests(const MenuLevel &a, const MenuLevel &b)
+{
+    if (a.requests.size() != b.requests.size())
+        return false;
+
+    for (size_t i = 0; i < a.requests.size(); i++)
+    {
+        if (a.requests[i].name != b.requests[i].name || a.requests[i].url != b.requests[i].url)
+            return false;
+    }
+    return true;
+}
+
+static void mergeRooms(MenuLevel &running, MenuLevel &incoming, MergeContext &ctx)
+{
+    if (!sameRequests(running, incoming))
+    {
+        running.requests.swap(incoming.requests);
+    }
+
+    std::vector<Room> &current = running.rooms;
+    std::vector<Room> &next = incoming.rooms;
+
+    bool sameOrder = current.size() == next.size();
+    for (size_t i = 0; sameOrder && i < next.size(); i++)
+    {
+        sameOrder = current[i].name == next[i].name;
+    }
+    if (sameOrder)
+    {
+        for (size_t i = 0; i < next.size(); i++)
+        {
+            mergeDevices(current[i], next[i], ctx);
+        }
+        return;
+    }
+
+    std::vector<bool> taken(current.size(), false);
+    std::vector<Room> merged;
+    merged.reserve(next.size());
+    for (size_t i = 0; i < next.size(); i++)
+    {
+        int index = findUnmatched(current, taken, i, next[i].name, &Room::name);
+        if (index >= 0)
+        {
+            taken[index] = true;
+            mergeDevices(current[index], next[i], ctx);
+            merged.push_back(std::move(current[index]));
+        }
+        else
+        {
+            merged.push_back(std::move(next[i]));
+            addNewDevices(merged.back(), ctx);
+        }
+    }
+
+    for (size_t i = 0; i < current.size(); i++)
+    {
+        if (!taken[i])
+            orphanDevices(current[i], ctx);
+    }
+    current.swap(merged);
+}
+
+static void mergeLevels(std::vector<MenuLevel> &current, std::vector<MenuLevel> &next, MergeContext &ctx)
+{
+    bool sameOrder = current.size() == next.size();
+    for (size_t i = 0; sameOrder && i < next.size(); i++)
+    {
+        sameOrder = current[i].name == next[i].name;
+    }
+    if (sameOrder)
+    {
+        for (size_t i = 0; i < next.size(); i++)
+        {
+            mergeRooms(current[i], next[i], ctx);
+        }
+        return;
+    }
+
+    std::vector<bool> taken(current.size(), false);
+    std::vector<MenuLevel> merged;
+    merged.reserve(next.size());
+    for (size_t i = 0; i < next.size(); i++)
+    {
+        int index = findUnmatched(current, taken, i, next[i].name, &MenuLevel::name);
+        if (index >= 0)
+        {
+            taken[index] = true;
+            mergeRooms(current[index], next[i], ctx);
+            merged.push_back(std::move(current[index]));
+        }
+        else
+        {
+            merged.push_back(std::move(next[i]));
+            for (auto &room : merged.back().rooms)
+            {
+                addNewDevices(room, ctx);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < current.size(); i++)
+    {
+        if (taken[i])
+            continue;
+        for (auto &room : current[i].rooms)
+        {
+            orphanDevices(room, ctx);
+        }
+    }
+    current.swap(merged);
+}
+
+// Gives devices that moved to another room or level their runtime state back.
+// Only needed when the structure changed, so the index is built on demand.
+static void resolveMovedDevices(MergeContext &ctx)
+{
+    uint32_t claimed = 0;
+    if (!ctx.unresolved.empty() && !ctx.orphans.empty())
+    {
+        struct IdLess
+        {
+            bool operator()(const char *a, const char *b) const { return strcmp(a, b) < 0; }
+        };
+        std::map<const char *, Device *, IdLess> orphansById;
+        for (auto &device : ctx.orphans)
+        {
+            orphansById.emplace(device.device_id.c_str(), &device);
+        }
+
+        for (Device *device : ctx.unresolved)
+        {
+            auto it = orphansById.find(device->device_id.c_str());
+            if (it == orphansById.end())
+            {
+                ctx.stats.added++;
+                continue;
+            }
+
+            const Device &previous = *it->second;
+            copyRuntimeState(*device, previous);
+            countDevice(ctx, device->name != previous.name || device->type != previous.type);
+            orphansById.erase(it);
+            claimed++;
+        }
+    }
+    else
+    {
+        ctx.stats.added += ctx.unresolved.size();
+    }
+    ctx.stats.removed += ctx.orphans.size() - claimed;
+}
+
+static int findLevel(const std::vector<MenuLevel> &menu, const String &name)
+{
+    for (size_t i = 0; i < menu.size(); i++)
+    {
+        if (menu[i].name == name)
+            return i;
+    }
+    return -1;
+}
+
+static int findRoom(const MenuLevel &level, const String &name)
+{
+    for (size_t i = 0; i < level.rooms.size(); i++)
+    {
+        if (level.rooms[i].name == name)
+            return i;
+    }
+    return -1;
+}
+
+static int findDevice(const Room &room, const String &deviceId)
+{
+    for (size_t i = 0; i < room.devices.size(); i++)
+    {
+        if (room.devices[i].device_id == deviceId)
+            return i;
+    }
+    return -1;
+}
+
+// Name of the submenu item under the cursor, rooms first, then requests
+static String submenuItemName(const MenuLevel &level, int index)
+{
+    int roomCount = level.rooms.size();
+    if (index < roomCount)
+        return level.rooms[index].name;
+    if (index < roomCount + (int)level.requests.size())
+        return level.requests[index - roomCount].name;
+    return "";
+}
+
+static int findSubmenuItem(const MenuLevel &level, const String &name)
+{
+    if (name.length() == 0)
+        return -1;
+
+    int roomIndex = findRoom(level, name);
+    if (roomIndex >= 0)
+        return roomIndex;
+
+    for (size_t i = 0; i < level.requests.size(); i++)
+    {
+        if (level.requests[i].name == name)
+            return level.rooms.size() + i;
+    }
+    return -1;
+}
+
+static String describeDevice(const Device &device)
+{
+    char values[48];
+    snprintf(values, sizeof(values), "|%d|%d|%d|%d|", device.state, device.brightness, device.pending, device.failed);
+    return device.name + "|" + device.type + "|" + device.device_id + values + device.color;
+}
+
+// What the current screen shows, used to find out what a reload changed on
+// it. The first entry covers the screen and cursor, the second the title; on
+// the device list every following entry is one device line.
+static void describeScreen(std::vector<String> &lines)
+{
+    char header[48];
+    snprintf(header, sizeof(header), "%d|%d|%d|%d|%d", currentState, currentMenuIndex, currentSubmenuIndex,
+             currentDeviceIndex, inEditMode);
+    lines.clear();
+    lines.reserve(2 + (currentState == MAIN_MENU ? mainMenu.size() : 0) +
+                  (currentState == SUBMENU && currentMenuIndex < (int)mainMenu.size()
+                       ? mainMenu[currentMenuIndex].rooms.size() + mainMenu[currentMenuIndex].requests.size()
+                       : 0) +
+                  (currentState == DEVICE_CONTROL && currentMenuIndex < (int)mainMenu.size() &&
+                           currentSubmenuIndex < (int)mainMenu[currentMenuIndex].rooms.size()
+                       ? mainMenu[currentMenuIndex].rooms[currentSubmenuIndex].devices.size()
+                       : 0));
+    lines.push_back(header);
+
+    switch (currentState)
+    {
+    case MAIN_MENU:
+        lines.push_back("");
+        for (auto &level : mainMenu)
+        {
+            lines.push_back(level.name);
+        }
+        break;
+
+    case SUBMENU:
+    {
+        if (currentMenuIndex >= (int)mainMenu.size())
+            break;
+
+        MenuLevel &level = mainMenu[currentMenuIndex];
+        lines.push_back(level.name);
+        for (auto &room : level.rooms)
+        {
+            lines.push_back(room.name);
+        }
+        for (auto &request : level.requests)
+        {
+            lines.push_back(request.name);
+        }
+        break;
+    }
+
+    case DEVICE_CONTROL:
+    {
+        if (currentMenuIndex >= (int)mainMenu.size() || currentSubmenuIndex >= (int)mainMenu[currentMenuIndex].rooms.size())
+            break;
+
+        Room &room = mainMenu[currentMenuIndex].rooms[currentSubmenuIndex];
+        lines.push_back(room.name);
+        if (inEditMode)
+        {
+            // Only the control of the edited device is on screen
+            if (currentDeviceIndex < (int)room.devices.size())
+                lines.push_back(describeDevice(room.devices[currentDeviceIndex]));
+            break;
+        }
+        for (auto &device : room.devices)
+        {
+            lines.push_back(describeDevice(device));
+        }
+        break;
+    }
+
+    case SETTINGS_MENU:
+    case DIAGNOSTICS:
+        // Nothing from the menu config is on these screens
+        break;
+    }
+}
+
+MenuDiffStats applyMenuStructure(std::vector<MenuLevel> &incoming)
+{
+    // Remember what the cursor points at before the old menu changes
+    MenuState previousState = currentState;
+    // At boot the running menu is still empty and the cursor is not on anything
+    bool onSettings = !mainMenu.empty() && currentMenuIndex >= (int)mainMenu.size();
+    String levelName = currentMenuIndex < (int)mainMenu.size() ? mainMenu[currentMenuIndex].name : "";
+    String submenuName = "";
+    String deviceId = "";
+    if (currentMenuIndex < (int)mainMenu.size())
+    {
+        MenuLevel &level = mainMenu[currentMenuIndex];
+        submenuName = submenuItemName(level, currentSubmenuIndex);
+        if (currentSubmenuIndex < (int)level.rooms.size() && currentDeviceIndex < (int)level.rooms[currentSubmenuIndex].devices.size())
+        {
+            deviceId = level.rooms[currentSubmenuIndex].devices[currentDeviceIndex].device_id;
+        }
+    }
+
+    std::vector<String> screenBefore;
+    describeScreen(screenBefore);
+
+    MergeContext ctx;
+    mergeLevels(mainMenu, incoming, ctx);
+    resolveMovedDevices(ctx);
+
+    // Remap the cursor onto the new menu, falling back one level at a time
+    int newLevelIndex = findLevel(mainMenu, levelName);
+    if (currentState == SETTINGS_MENU || currentState == DIAGNOSTICS || (currentState == MAIN_MENU && onSettings))
+    {
+        currentMenuIndex = mainMenu.size();
+    }
+    else if (newLevelIndex < 0)
+    {
+        currentState = MAIN_MENU;
+        currentMenuIndex = constrain(currentMenuIndex, 0, (int)mainMenu.size());
+        inEditMode = false;
+    }
+    else
+    {
+        currentMenuIndex = newLevelIndex;
+        MenuLevel &level = mainMenu[currentMenuIndex];
+        int maxSubmenuIndex = level.rooms.size() + level.requests.size(); // +1 for Back
+        int submenuIndex = findSubmenuItem(level, submenuName);
+
+        if (submenuIndex >= 0)
+        {
+            currentSubmenuIndex = submenuIndex;
+        }
+        else
+        {
+            currentSubmenuIndex = constrain(currentSubmenuIndex, 0, maxSubmenuIndex);
+        }
+
+        if (currentState == DEVICE_CONTROL && (submenuIndex < 0 || currentSubmenuIndex >= (int)level.rooms.size()))
+        {
+            currentState = SUBMENU;
+        }
+
+        if (currentState == DEVICE_CONTROL)
+        {
+            Room &room = level.rooms[currentSubmenuIndex];
+            int deviceIndex = deviceId.length() > 0 ? findDevice(room, deviceId) : -1;
+            if (deviceIndex >= 0)
+            {
+                currentDeviceIndex = deviceIndex;
+            }
+            else
+            {
+                currentDeviceIndex = constrain(currentDeviceIndex, 0, (int)room.devices.size());
+            }
+        }
+    }
+
+    // Editing only survives if the cursor is still on the same brightness or color device
+    if (inEditMode)
+    {
+        bool stillEditing = currentState == DEVICE_CONTROL &&
+                            currentDeviceIndex < (int)mainMenu[currentMenuIndex].rooms[currentSubmenuIndex].devices.size();
+        if (stillEditing)
+        {
+            Device &device = mainMenu[currentMenuIndex].rooms[currentSubmenuIndex].devices[currentDeviceIndex];
+            stillEditing = device.device_id == deviceId && (device.type == "brightness" || device.type == "color");
+        }
+        if (!stillEditing)
+        {
+            inEditMode = false;
+        }
+    }
+
+    // Work out how much of the screen has to be redrawn. Only device lines
+    // can be redrawn one by one, any other change repaints the screen.
+    std::vector<String> screenAfter;
+    describeScreen(screenAfter);
+
+    MenuRedraw redraw = MENU_REDRAW_NONE;
+    std::vector<int> changedLines;
+    bool lineRedraw = currentState == DEVICE_CONTROL && !inEditMode;
+    if (currentState != previousState || screenBefore.size() != screenAfter.size())
+    {
+        redraw = MENU_REDRAW_FULL;
+    }
+    else
+    {
+        for (size_t i = 0; i < screenAfter.size() && redraw != MENU_REDRAW_FULL; i++)
+        {
+            if (screenBefore[i] == screenAfter[i])
+                continue;
+
+            if (lineRedraw && i >= 2)
+            {
+                changedLines.push_back(i - 2);
+                redraw = MENU_REDRAW_LINES;
+            }
+            else
+            {
+                redraw = MENU_REDRAW_FULL;
+            }
+        }
+    }
+
+    if (redraw == MENU_REDRAW_FULL)
+    {
+        requestRedraw();
+    }
+    else if (redraw == MENU_REDRAW_LINES)
+    {
+        for (int line : changedLines)
+        {
+            redrawDeviceLine(line);
+        }
+    }
+
+    // The cursor may have moved
+    markSnapshotDirty();
+
+    ctx.stats.redraw = redraw;
+    Serial.printf("Menu reloaded: %u added, %u removed, %u changed, %u unchanged\n",
+                  ctx.stats.added, ctx.stats.removed, ctx.stats.changed, ctx.stats.unchanged);
+    return ctx.stats;
+}
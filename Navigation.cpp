@@ -1,5 +1,12 @@
 #include "SmartMenuSystem.h"
 
+void handleInput()
+{
+    handleEncoderInput();
+    handleButtonInput();
+    replayInputTrace();
+}
+
 void handleEncoderInput()
 {
     int32_t currentEncoderValue = myKnob.read() / 2;
@@ -8,18 +15,7 @@ void handleEncoderInput()
     if (encoderDiff != 0)
     {
         lastEncoderValue = currentEncoderValue;
-
-        if (!inEditMode)
-        {
-            navigateMenu(encoderDiff > 0 ? 1 : -1);
-        }
-        else
-        {
-            adjustValue(encoderDiff > 0 ? 1 : -1);
-        }
-
-        displayCurrentMenu();
-        delay(100);
+        applyEncoderStep(encoderDiff > 0 ? 1 : -1);
     }
 }
 
@@ -29,12 +25,80 @@ void handleButtonInput()
 
     if (button.pressed())
     {
-        handleMenuSelection();
-        delay(200);
-        displayCurrentMenu();
+        applyButtonPress();
     }
 }
 
+// Whether a press here would act on something outside the knob: toggle a
+// device, run a request or restart into AP mode
+static bool pressActsOutside()
+{
+    switch (currentState)
+    {
+    case SUBMENU:
+    {
+        if (currentMenuIndex >= mainMenu.size())
+            return false;
+        const MenuLevel &menu = mainMenu[currentMenuIndex];
+        return currentSubmenuIndex >= menu.rooms.size() &&
+               currentSubmenuIndex < menu.rooms.size() + menu.requests.size();
+    }
+    case DEVICE_CONTROL:
+    {
+        if (currentMenuIndex >= mainMenu.size() || currentSubmenuIndex >= mainMenu[currentMenuIndex].rooms.size())
+            return false;
+        const Room &room = mainMenu[currentMenuIndex].rooms[currentSubmenuIndex];
+        return currentDeviceIndex < room.devices.size() && room.devices[currentDeviceIndex].type == "onoff";
+    }
+    case SETTINGS_MENU:
+        return currentSettingIndex == 2;
+    default:
+        return false;
+    }
+}
+
+// Shared by the hardware and the scripted input traces. Input that wakes a
+// dark screen is handled like any other, unless it would change something
+// the user cannot see yet; then it only wakes the screen.
+void applyEncoderStep(int direction)
+{
+    TRACE_SCOPE("input encoder");
+
+    if (registerUserActivity() && inEditMode)
+        return;
+
+    markInput();
+
+    if (!inEditMode)
+    {
+        navigateMenu(direction);
+        requestRedraw();
+    }
+    else
+    {
+        // Edit controls redraw only what changed
+        adjustValue(direction);
+        markFrame();
+    }
+
+    markSnapshotDirty();
+    finishInput();
+}
+
+void applyButtonPress()
+{
+    TRACE_SCOPE("input button");
+
+    if (registerUserActivity() && pressActsOutside())
+        return;
+
+    markInput();
+    handleMenuSelection();
+    requestRedraw();
+    markSnapshotDirty();
+    finishInput();
+}
+
 void navigateMenu(int direction)
 {
     switch (currentState)
@@ -60,7 +124,11 @@ void navigateMenu(int direction)
         break;
 
     case SETTINGS_MENU:
-        currentSettingIndex = constrain(currentSettingIndex + direction, 0, 3); // 4 settings + Back
+        currentSettingIndex = constrain(currentSettingIndex + direction, 0, 4); // 4 settings + Back
+        break;
+
+    case DIAGNOSTICS:
+        // Nothing to scroll, the screen only has Back
         break;
     }
 }
@@ -70,11 +138,33 @@ void adjustValue(int direction)
     if (currentState == DEVICE_CONTROL && currentDeviceIndex < mainMenu[currentMenuIndex].rooms[currentSubmenuIndex].devices.size())
     {
         Device &device = mainMenu[currentMenuIndex].rooms[currentSubmenuIndex].devices[currentDeviceIndex];
+        bool wasPending = device.pending;
+        bool wasFailed = device.failed;
 
         if (device.type == "brightness")
         {
+            int previous = device.brightness;
             device.brightness = constrain(device.brightness + direction * 5, 0, 100);
-            sendDeviceRequest(device.device_id, "brightness", String(device.brightness));
+            if (device.brightness != previous)
+            {
+                updateBrightnessGauge(previous, device.brightness);
+                sendDeviceRequest(device.device_id, "brightness", String(device.brightness));
+            }
+        }
+        else if (device.type == "color")
+        {
+            // Turning past the end of the saturation arc changes nothing
+            String color = updateColorWheel(direction);
+            if (color != device.color)
+            {
+                device.color = color;
+                sendDeviceRequest(device.device_id, "color", device.color);
+            }
+        }
+
+        if (device.pending != wasPending || device.failed != wasFailed)
+        {
+            drawEditStatus(device);
         }
     }
 }
@@ -108,6 +198,10 @@ void handleMenuSelection()
     case SETTINGS_MENU:
         handleSettingsSelection();
         break;
+
+    case DIAGNOSTICS:
+        currentState = SETTINGS_MENU;
+        break;
     }
 }
 
@@ -161,12 +255,16 @@ void handleDeviceSelection()
         }
         else if (device.type == "color")
         {
-            // For simplicity, cycle through predefined colors
-            static int colorIndex = 0;
-            String colors[] = {"#FF0000", "#00FF00", "#0000FF", "#FFFF00", "#FF00FF", "#00FFFF", "#FFFFFF"};
-            colorIndex = (colorIndex + 1) % 7;
-            device.color = colors[colorIndex];
-            sendDeviceRequest(device.device_id, "color", device.color);
+            // Press to pick the hue, again for saturation, again to finish
+            if (!inEditMode)
+            {
+                beginColorEdit(device);
+                inEditMode = true;
+            }
+            else if (!advanceColorEdit())
+            {
+                inEditMode = false;
+            }
         }
     }
     else
@@ -190,9 +288,14 @@ void handleSettingsSelection()
         // Switch to AP mode
         ap_mode = !ap_mode;
         saveConfiguration();
+        flushSnapshot();
         ESP.restart();
         break;
     case 3:
+        // Live performance numbers
+        currentState = DIAGNOSTICS;
+        break;
+    case 4:
         // Back to main menu
         currentState = MAIN_MENU;
         break;
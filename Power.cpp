@@ -0,0 +1,143 @@
+#include "SmartMenuSystem.h"
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+
+// Idle policy
+static unsigned long lastUserActivity = 0;
+static unsigned long lastNetworkActivity = 0;
+PowerState powerState = POWER_ACTIVE;
+static uint32_t cpuFrequencyMhz = CPU_FREQ_ACTIVE_MHZ;
+
+static void setCpuFrequency(uint32_t mhz)
+{
+    if (mhz == cpuFrequencyMhz)
+        return;
+
+    setCpuFrequencyMhz(mhz);
+    cpuFrequencyMhz = mhz;
+}
+
+static void setBacklight(uint8_t level)
+{
+#ifdef GFX_BL
+    // Backlight is active low
+    analogWrite(GFX_BL, 255 - level);
+#endif
+}
+
+static void enterPowerState(PowerState state)
+{
+    if (state == powerState)
+        return;
+
+    switch (state)
+    {
+    case POWER_ACTIVE:
+        setCpuFrequency(CPU_FREQ_ACTIVE_MHZ);
+        setBacklight(BACKLIGHT_LEVEL_ON);
+        break;
+    case POWER_DIMMED:
+        setCpuFrequency(CPU_FREQ_IDLE_MHZ);
+        setBacklight(BACKLIGHT_LEVEL_DIM);
+        break;
+    case POWER_OFF:
+        setCpuFrequency(CPU_FREQ_IDLE_MHZ);
+        setBacklight(0);
+        break;
+    }
+
+    powerState = state;
+}
+
+void initializePower()
+{
+    lastUserActivity = millis();
+    lastNetworkActivity = lastUserActivity;
+    setBacklight(BACKLIGHT_LEVEL_ON);
+}
+
+// Encoder, button: wakes the screen and restores full speed. Returns true
+// if the screen was dark.
+bool registerUserActivity()
+{
+    bool wasOff = powerState == POWER_OFF;
+    lastUserActivity = millis();
+    enterPowerState(POWER_ACTIVE);
+    return wasOff;
+}
+
+// Web requests: keep the CPU awake but leave the backlight alone.
+void registerNetworkActivity()
+{
+    lastNetworkActivity = millis();
+    if (powerState != POWER_ACTIVE)
+        setCpuFrequency(CPU_FREQ_ACTIVE_MHZ);
+}
+
+#if POWER_LIGHT_SLEEP
+// Sleeps for at most one slice. Any edge on the encoder or the button wakes
+// the chip straight away; the timer bounds how late a web request is served.
+// Manual light sleep pauses Wi-Fi, so this is opt-in.
+static void lightSleepSlice()
+{
+    gpio_num_t pins[] = {(gpio_num_t)ROTARY_ENCODER_A_PIN, (gpio_num_t)ROTARY_ENCODER_B_PIN, ROTARY_ENCODER_BUTTON_PIN};
+    for (gpio_num_t pin : pins)
+    {
+        // Level wakeup only: wait for the opposite of the current level
+        gpio_wakeup_enable(pin, gpio_get_level(pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    }
+    esp_sleep_enable_gpio_wakeup();
+    esp_sleep_enable_timer_wakeup(POWER_SLEEP_SLICE_MS * 1000ULL);
+
+    esp_light_sleep_start();
+
+    for (gpio_num_t pin : pins)
+    {
+        gpio_wakeup_disable(pin);
+    }
+}
+#endif
+
+// Called once per loop pass, after input and web requests were handled.
+void updatePower()
+{
+    unsigned long now = millis();
+    unsigned long userIdle = now - lastUserActivity;
+    unsigned long networkIdle = now - lastNetworkActivity;
+
+    if (userIdle >= BACKLIGHT_OFF_TIMEOUT_MS)
+    {
+        enterPowerState(POWER_OFF);
+    }
+    else if (userIdle >= BACKLIGHT_DIM_TIMEOUT_MS)
+    {
+        enterPowerState(POWER_DIMMED);
+    }
+
+    if (powerState == POWER_ACTIVE)
+    {
+        // Give the idle task a chance to halt the CPU between passes
+        delay(POWER_ACTIVE_YIELD_MS);
+        return;
+    }
+
+    if (networkIdle < POWER_NETWORK_GRACE_MS)
+    {
+        // A web client is talking to us, serve it at full speed
+        delay(POWER_ACTIVE_YIELD_MS);
+        return;
+    }
+    setCpuFrequency(CPU_FREQ_IDLE_MHZ);
+
+#if POWER_LIGHT_SLEEP
+    if (powerState == POWER_OFF && !ap_mode)
+    {
+        lightSleepSlice();
+        return;
+    }
+#endif
+
+    // The encoder is counted by interrupts, so sleeping here never loses a
+    // detent; it is picked up at most one slice later.
+    delay(POWER_SLEEP_SLICE_MS);
+}
@@ -0,0 +1,91 @@
+#include "SmartMenuSystem.h"
+
+// Cooperative scheduler for the main loop. Tasks run in priority order on
+// every pass; once a pass has used up its budget, lower priority tasks are
+// deferred to the next pass (but never for longer than SCHEDULER_MAX_DEFER_MS)
+// so input and rendering keep going while the network side catches up.
+static std::vector<ScheduledTask> tasks;
+static uint32_t schedulerPasses = 0;
+
+void addTask(const char *name, TaskPriority priority, uint32_t intervalMs, uint32_t budgetUs, void (*run)())
+{
+    ScheduledTask task;
+    task.name = name;
+    task.priority = priority;
+    task.intervalMs = intervalMs;
+    task.budgetUs = budgetUs;
+    task.run = run;
+
+    // Keep the list sorted by priority, tasks of equal priority in insertion order
+    auto it = tasks.begin();
+    while (it != tasks.end() && it->priority <= priority)
+    {
+        it++;
+    }
+    tasks.insert(it, task);
+}
+
+static void runTask(ScheduledTask &task, unsigned long now)
+{
+    unsigned long start = micros();
+    TRACE_BEGIN(task.name);
+    task.run();
+    TRACE_END(task.name);
+    uint32_t duration = micros() - start;
+
+    task.lastRun = now;
+    task.lastDurationUs = duration;
+    task.runs++;
+    if (duration > task.maxDurationUs)
+    {
+        task.maxDurationUs = duration;
+    }
+    if (task.budgetUs > 0 && duration > task.budgetUs)
+    {
+        task.overruns++;
+    }
+}
+
+void runScheduler()
+{
+    unsigned long passStart = micros();
+    schedulerPasses++;
+
+    for (auto &task : tasks)
+    {
+        unsigned long now = millis();
+        if (now - task.lastRun < task.intervalMs)
+            continue;
+
+        bool overBudget = micros() - passStart > SCHEDULER_PASS_BUDGET_US;
+        // Counted from when the task became due, not from its last run
+        bool starved = now - task.lastRun - task.intervalMs >= SCHEDULER_MAX_DEFER_MS;
+        if (overBudget && task.priority > PRIORITY_RENDER && !starved)
+        {
+            task.deferrals++;
+            continue;
+        }
+
+        runTask(task, now);
+    }
+}
+
+// Prints tasks that went over their budget since the last report.
+void reportSchedulerStats()
+{
+    for (auto &task : tasks)
+    {
+        if (task.overruns == task.reportedOverruns)
+            continue;
+
+        Serial.printf("Task %s: %u overruns (budget %uus, max %uus, last %uus)\n",
+                      task.name, task.overruns - task.reportedOverruns,
+                      task.budgetUs, task.maxDurationUs, task.lastDurationUs);
+        task.reportedOverruns = task.overruns;
+    }
+}
+
+uint32_t getSchedulerPasses()
+{
+    return schedulerPasses;
+}
@@ -33,6 +33,11 @@ extern bool IPS;
 #define COLOR_TITLE RGB565_YELLOW
 #define COLOR_ON RGB565_GREEN
 #define COLOR_OFF RGB565_RED
+#define COLOR_GAUGE RGB565_CYAN
+#define COLOR_TRACK RGB565_DARKGREY
+#define COLOR_TRACK_ACTIVE RGB565_LIGHTGREY
+#define COLOR_PENDING RGB565_DARKGREY
+#define COLOR_ERROR RGB565_ORANGE
 
 // Menu System Structures
 struct Device
@@ -43,6 +48,16 @@ struct Device
     bool state = false;
     int brightness = 0;
     String color = "#FFFFFF";
+
+    // Optimistic updates: last values the backend confirmed, restored when a
+    // command fails (see Commands.cpp)
+    bool confirmedState = false;
+    int confirmedBrightness = 0;
+    String confirmedColor = "#FFFFFF";
+    uint32_t commandSequence = 0;
+    unsigned long pendingSince = 0;
+    bool pending = false;
+    bool failed = false;
 };
 
 struct Room
@@ -64,15 +79,232 @@ struct MenuLevel
     std::vector<Request> requests;
 };
 
+// Power Management
+#define BACKLIGHT_LEVEL_ON 255
+#define BACKLIGHT_LEVEL_DIM 40
+#define BACKLIGHT_DIM_TIMEOUT_MS 30000
+#define BACKLIGHT_OFF_TIMEOUT_MS 60000
+#define CPU_FREQ_ACTIVE_MHZ 160
+#define CPU_FREQ_IDLE_MHZ 80    // Lowest frequency that keeps Wi-Fi running
+#define POWER_ACTIVE_YIELD_MS 1
+#define POWER_SLEEP_SLICE_MS 10 // Bounds wake latency of the first detent
+#define POWER_NETWORK_GRACE_MS 2000
+#define POWER_LIGHT_SLEEP 0     // Light sleep when the screen is off (pauses Wi-Fi)
+
+// Scheduler
+#define SCHEDULER_PASS_BUDGET_US 20000
+#define SCHEDULER_MAX_DEFER_MS 200
+#define INPUT_TASK_BUDGET_US 2000
+#define RENDER_TASK_BUDGET_US 40000 // A full-screen redraw over SPI
+#define NETWORK_TASK_BUDGET_US 20000
+#define HOUSEKEEPING_TASK_BUDGET_US 5000
+
+// Upstream resilience (see Upstream.cpp)
+#define UPSTREAM_MAX_HOSTS 8
+#define UPSTREAM_HOST_SIZE 64
+#define UPSTREAM_PROBE_URL_SIZE 80
+#define UPSTREAM_CONNECT_TIMEOUT_MS 2000
+#define UPSTREAM_READ_TIMEOUT_MS 3000
+#define UPSTREAM_FAILURE_THRESHOLD 3
+#define UPSTREAM_OPEN_MS 10000 // Time between probes while a host is down
+#define UPSTREAM_CIRCUIT_OPEN -100 // Returned instead of an HTTP status when failing fast
+#define HEDGE_QUEUE_LENGTH 4
+
+// Device commands (see Commands.cpp)
+#define DEFAULT_REQUEST_TIMEOUT_MS 5000
+#define COMMAND_RESULT_QUEUE_LENGTH 16
+#define COMMAND_TIMEOUT_CHECK_MS 100
+
+// Outbound requests (see HttpRequests.cpp)
+#define OUTBOUND_QUEUE_LENGTH 8
+#define OUTBOUND_URL_SIZE 128
+#define OUTBOUND_DEVICE_ID_SIZE 48
+#define OUTBOUND_BODY_SIZE 192
+#define OUTBOUND_TYPE_SIZE 16
+#define OUTBOUND_VALUE_SIZE 32
+#define OUTBOUND_REPLY_SIZE 384
+#define OUTBOUND_TASK_STACK 8192
+#define OUTBOUND_TASK_PRIORITY 1 // Same as loop(), spends its time blocked on sockets
+
+// Menu config files (LittleFS)
+#define MENU_CONFIG_PATH "/menu.json"
+#define MENU_CONFIG_BACKUP_PATH "/menu.bak"
+#define MENU_CONFIG_STAGED_PATH "/menu.tmp"
+
+// Admin endpoints (/update) need HTTP basic auth with this user and the
+// admin password, and are off while no password is set
+#define ADMIN_USER "admin"
+
+// MQTT transport (see Transport.cpp)
+#define MQTT_BUFFER_SIZE 512
+#define MQTT_SOCKET_TIMEOUT_S 2
+#define MQTT_KEEPALIVE_S 30
+#define MQTT_RETRY_MIN_MS 2000
+#define MQTT_RETRY_MAX_MS 60000
+#define MQTT_QUEUE_LENGTH 8
+#define MQTT_POLL_MS 20
+#define MQTT_TASK_STACK 6144
+
+// Latency measurements (see Latency.cpp)
+#define LATENCY_SAMPLE_COUNT 256
+
+// Diagnostics screen (see Diagnostics.cpp)
+#define DIAGNOSTICS_INTERVAL_MS 1000
+#define DIAGNOSTICS_VALUE_SIZE 16
+
+// UI snapshot in NVS (see Snapshot.cpp)
+#define SNAPSHOT_KEY "ui_snapshot"
+#define SNAPSHOT_MAGIC 0x4B53 // "SK"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_CHECK_MS 500
+#define SNAPSHOT_QUIET_MS 3000      // Write once the knob has been still this long
+#define SNAPSHOT_MAX_DELAY_MS 30000 // but never later than this after the first change
+
+// Tracing (see Trace.cpp), set TRACE_ENABLED to 0 to compile all spans out
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+#define TRACE_BUFFER_SIZE 1024
+#define TRACE_MAX_THREADS 8
+#define TRACE_CHUNK_SIZE 1024
+#define TRACE_MAX_EVENT_JSON 160
+
+// JSON buffers shared by all network paths (see JsonBuffers.cpp)
+#define JSON_ARENA_SIZE 4096
+#define JSON_OUT_BUFFER_SIZE 2048
+
+struct OutboundRequest
+{
+    bool isAction; // GET to url, otherwise POST body to url
+    bool isProbe;  // Health check for a host whose circuit is open
+    char url[OUTBOUND_URL_SIZE];
+    char deviceId[OUTBOUND_DEVICE_ID_SIZE];
+    char body[OUTBOUND_BODY_SIZE];
+    size_t bodyLength;
+    uint32_t inputMicros; // Input event that caused it, 0 if none
+    uint32_t sequence;    // Device command it belongs to, 0 for actions
+    char type[OUTBOUND_TYPE_SIZE];
+    char value[OUTBOUND_VALUE_SIZE];
+};
+
+struct CommandResult
+{
+    uint32_t sequence;
+    int code; // HTTP status, negative if the request never completed
+    char deviceId[OUTBOUND_DEVICE_ID_SIZE];
+    char type[OUTBOUND_TYPE_SIZE];
+    char value[OUTBOUND_VALUE_SIZE];
+};
+
+enum CircuitState
+{
+    CIRCUIT_CLOSED,
+    CIRCUIT_OPEN,
+    CIRCUIT_PROBING
+};
+
+struct UpstreamHost
+{
+    char host[UPSTREAM_HOST_SIZE] = "";
+    char probeUrl[UPSTREAM_PROBE_URL_SIZE] = "";
+    uint32_t connectTimeoutMs = UPSTREAM_CONNECT_TIMEOUT_MS;
+    uint32_t readTimeoutMs = UPSTREAM_READ_TIMEOUT_MS;
+    CircuitState state = CIRCUIT_CLOSED;
+    unsigned long openedAt = 0;
+    uint32_t consecutiveFailures = 0;
+    uint32_t successes = 0;
+    uint32_t failures = 0;
+    uint32_t rejected = 0;
+    int lastCode = 0;
+    uint32_t lastRttMs = 0;
+};
+
+// Scheduler tasks, highest priority first
+enum TaskPriority
+{
+    PRIORITY_INPUT,
+    PRIORITY_RENDER,
+    PRIORITY_NETWORK,
+    PRIORITY_HOUSEKEEPING
+};
+
+struct ScheduledTask
+{
+    const char *name;
+    TaskPriority priority;
+    uint32_t intervalMs = 0;
+    uint32_t budgetUs = 0;
+    void (*run)() = nullptr;
+    unsigned long lastRun = 0;
+    uint32_t runs = 0;
+    uint32_t lastDurationUs = 0;
+    uint32_t maxDurationUs = 0;
+    uint32_t overruns = 0;
+    uint32_t reportedOverruns = 0;
+    uint32_t deferrals = 0;
+};
+
+// Result of merging a reloaded menu into the running one
+enum MenuRedraw
+{
+    MENU_REDRAW_NONE,
+    MENU_REDRAW_LINES,
+    MENU_REDRAW_FULL
+};
+
+struct MenuDiffStats
+{
+    uint32_t added = 0;
+    uint32_t removed = 0;
+    uint32_t changed = 0;
+    uint32_t unchanged = 0;
+    MenuRedraw redraw = MENU_REDRAW_NONE;
+};
+
 // Navigation State
 enum MenuState
 {
     MAIN_MENU,
     SUBMENU,
     DEVICE_CONTROL,
-    SETTINGS_MENU
+    SETTINGS_MENU,
+    DIAGNOSTICS
+};
+
+enum PowerState
+{
+    POWER_ACTIVE,
+    POWER_DIMMED,
+    POWER_OFF
 };
 
+#if TRACE_ENABLED
+void traceEvent(const char *name, char phase);
+
+// Records a begin event now and the matching end event when it goes out of scope
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name) : name(name) { traceEvent(name, 'B'); }
+    ~TraceScope() { traceEvent(name, 'E'); }
+
+private:
+    const char *name;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_BEGIN(name) traceEvent(name, 'B')
+#define TRACE_END(name) traceEvent(name, 'E')
+#define TRACE_INSTANT(name) traceEvent(name, 'i')
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_INSTANT(name)
+#define TRACE_SCOPE(name)
+#endif
+
 // Global variables declarations
 extern Arduino_DataBus *bus;
 extern Arduino_GFX *gfx;
@@ -80,11 +312,23 @@ extern Encoder myKnob;
 extern Bounce2::Button button;
 extern WebServer server;
 extern Preferences preferences;
+extern DynamicJsonDocument jsonArena;
+extern char jsonOutBuffer[JSON_OUT_BUFFER_SIZE];
+extern size_t jsonOutLength;
 
 extern std::vector<MenuLevel> mainMenu;
 extern String wifi_ssid;
 extern String wifi_password;
 extern String main_url;
+extern uint32_t request_timeout_ms;
+extern uint32_t hedge_delay_ms;
+extern String transport; // "http" or "mqtt"
+extern String mqtt_host;
+extern int mqtt_port;
+extern String mqtt_prefix;
+extern String mqtt_user;
+extern String mqtt_password;
+extern String admin_password;
 extern bool ap_mode;
 
 extern MenuState currentState;
@@ -94,6 +338,9 @@ extern int currentDeviceIndex;
 extern int currentSettingIndex;
 extern int32_t lastEncoderValue;
 extern bool inEditMode;
+extern PowerState powerState;
+extern bool displayDirty;
+extern uint32_t inputEventMicros;
 
 // Function declarations
 void testDisplay();
@@ -101,33 +348,138 @@ void initializeDisplay();
 void initializeInput();
 void initializeWiFi();
 void initializeWebServer();
+void initializeScheduler();
 void loadConfiguration();
 void saveConfiguration();
 void startAPMode();
 void connectToWiFi();
+void initializeStorage();
 void loadMenuStructure();
+void reloadMenuConfig();
+bool saveMenuConfig(const String &menuJson);
+void markFirmwareValid();
 String getDefaultMenuJson();
+MenuDiffStats applyMenuStructure(std::vector<MenuLevel> &incoming);
+void handleInput();
 void handleEncoderInput();
 void handleButtonInput();
+void applyEncoderStep(int direction);
+void applyButtonPress();
 void navigateMenu(int direction);
 void adjustValue(int direction);
 void handleMenuSelection();
 void handleSubmenuSelection();
 void handleDeviceSelection();
 void handleSettingsSelection();
+void initializeOutbound();
+bool enqueueProbe(const char *url);
 void executeRequest(String url);
 void sendDeviceRequest(String deviceId, String type, String value);
 void updateDeviceState(String deviceId, String type, String value);
+void confirmDeviceState(String deviceId, String type, String value);
+void applyDeviceValue(Device &device, const String &type, const String &value);
+Device *findDeviceById(const String &deviceId);
+
+// Upstream functions
+void initializeUpstream();
+void configureUpstream(JsonObject settings);
+bool upstreamAllow(const char *url, bool probe, uint32_t &connectTimeoutMs, uint32_t &readTimeoutMs);
+void upstreamRecord(const char *url, int httpCode, uint32_t rttMs);
+void probeUpstreams();
+void writeUpstreamStatus(JsonArray out);
+void getUpstreamSummary(uint32_t &lastRttMs, uint32_t &errors);
+
+// Device command functions
+void initializeCommands();
+uint32_t beginDeviceCommand(Device &device);
+void postCommandResult(uint32_t sequence, const char *deviceId, const char *type, const char *value, int code);
+void confirmDevice(Device &device);
+void refreshDevice(const Device &device);
+void handleCommandResults();
+
+// Transport functions
+void initializeTransport();
+void handleTransport();
+bool usingMqtt();
+bool mqttConnected();
+bool publishDeviceCommand(uint32_t sequence, const String &deviceId, const String &type, const String &value,
+                          const char *body, size_t length);
 void displayCurrentMenu();
+void requestRedraw();
+void renderDisplay();
 void displayMainMenu();
 void displaySubmenu();
 void displayDeviceControl();
+void redrawDeviceLine(int index);
 void displaySettingsMenu();
 
+// Snapshot functions
+void markSnapshotDirty();
+void flushSnapshot();
+void updateSnapshot();
+void restoreSnapshot();
+void writeSnapshotStatus(JsonObject out);
+
+// Diagnostics functions
+void noteFrame(uint32_t durationMicros);
+void displayDiagnostics();
+void updateDiagnostics();
+void writeDiagnostics(JsonObject out);
+
+// Trace functions
+void initializeTrace();
+void handleTrace();
+
+// Latency functions
+void markInput();
+void finishInput();
+void markFrame();
+void markBackendReply(uint32_t inputMicros);
+uint32_t getLastFrameLatency();
+void resetLatencyStats();
+const char *startInputTrace(const String &name, uint32_t intervalMs, uint8_t repeats);
+void replayInputTrace();
+
+// Scheduler functions
+void addTask(const char *name, TaskPriority priority, uint32_t intervalMs, uint32_t budgetUs, void (*run)());
+void runScheduler();
+void reportSchedulerStats();
+uint32_t getSchedulerPasses();
+
+// Edit control functions
+void initializeControls();
+void centeredText(const String &text, int y);
+void drawBrightnessGauge(const Device &device);
+void updateBrightnessGauge(int oldValue, int newValue);
+void beginColorEdit(const Device &device);
+bool advanceColorEdit();
+void drawColorWheel(const Device &device);
+void drawEditStatus(const Device &device);
+String updateColorWheel(int direction);
+
+// Power management functions
+void initializePower();
+void updatePower();
+bool registerUserActivity();
+void registerNetworkActivity();
+
+// JSON buffer functions
+JsonDocument &beginJson();
+size_t serializeJsonArena();
+size_t menuJsonCapacity(size_t jsonLength);
+
 // Web handler functions
 void handleRoot();
 void handleConfig();
 void handleMenuConfig();
 void handleDeviceControl();
+bool adminAuthorized();
+bool requireAdmin();
 void handleStatus();
+void sendJsonResponse(int code);
+void sendJsonStreamed(int code);
+void handleLatency();
+void handleBench();
+void handleUpdateUpload();
+void handleUpdateDone();
 String getWebInterface();
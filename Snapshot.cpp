@@ -0,0 +1,252 @@
+#include "SmartMenuSystem.h"
+
+// Navigation and device values saved to NVS, so the knob comes back on the
+// same screen with the same values after a reboot, before Wi-Fi is up.
+// Changes only mark the snapshot dirty; a housekeeping task writes it once
+// the knob has been quiet for SNAPSHOT_QUIET_MS (or SNAPSHOT_MAX_DELAY_MS
+// after the first change), and only if the bytes differ from the last write.
+
+struct __attribute__((packed)) SnapshotHeader
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t state;
+    uint16_t menuIndex;
+    uint16_t submenuIndex;
+    uint16_t deviceIndex;
+    uint8_t settingIndex;
+    uint16_t deviceCount;
+};
+
+// Devices are matched by a hash of device_id, so the snapshot survives
+// menu edits that add, remove or reorder devices
+struct __attribute__((packed)) SnapshotDevice
+{
+    uint32_t idHash;
+    uint8_t state;
+    uint8_t brightness;
+    uint8_t rgb[3];
+};
+
+// Sized from the menu on every build, so every device is kept
+static std::vector<uint8_t> snapshotBuffer;
+static std::vector<uint8_t> savedSnapshot;
+
+static bool snapshotDirty = false;
+static unsigned long firstChangeAt = 0;
+static unsigned long lastChangeAt = 0;
+static uint32_t snapshotWrites = 0;
+static uint32_t snapshotSkips = 0;
+
+// FNV-1a
+static uint32_t hashDeviceId(const String &deviceId)
+{
+    uint32_t hash = 2166136261UL;
+    for (size_t i = 0; i < deviceId.length(); i++)
+    {
+        hash ^= (uint8_t)deviceId[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+static void buildSnapshot(std::vector<uint8_t> &buffer)
+{
+    size_t deviceCount = 0;
+    for (auto &menu : mainMenu)
+    {
+        for (auto &room : menu.rooms)
+        {
+            deviceCount += room.devices.size();
+        }
+    }
+    if (deviceCount > UINT16_MAX)
+    {
+        Serial.printf("Snapshot keeps %u of %u devices\n", (unsigned)UINT16_MAX, (unsigned)deviceCount);
+        deviceCount = UINT16_MAX;
+    }
+    buffer.resize(sizeof(SnapshotHeader) + deviceCount * sizeof(SnapshotDevice));
+
+    SnapshotHeader header;
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.state = currentState;
+    header.menuIndex = currentMenuIndex;
+    header.submenuIndex = currentSubmenuIndex;
+    header.deviceIndex = currentDeviceIndex;
+    header.settingIndex = currentSettingIndex;
+    header.deviceCount = 0;
+
+    // Confirmed values only, a command still in flight may yet be rolled back
+    SnapshotDevice *entries = (SnapshotDevice *)(buffer.data() + sizeof(SnapshotHeader));
+    for (auto &menu : mainMenu)
+    {
+        for (auto &room : menu.rooms)
+        {
+            for (auto &device : room.devices)
+            {
+                if (header.deviceCount == deviceCount)
+                    break;
+
+                uint32_t rgb = strtoul(device.confirmedColor.c_str() + 1, nullptr, 16);
+                SnapshotDevice &entry = entries[header.deviceCount++];
+                entry.idHash = hashDeviceId(device.device_id);
+                entry.state = device.confirmedState;
+                entry.brightness = constrain(device.confirmedBrightness, 0, 100);
+                entry.rgb[0] = rgb >> 16;
+                entry.rgb[1] = rgb >> 8;
+                entry.rgb[2] = rgb;
+            }
+        }
+    }
+
+    memcpy(buffer.data(), &header, sizeof(header));
+}
+
+void markSnapshotDirty()
+{
+    unsigned long now = millis();
+    if (!snapshotDirty)
+    {
+        snapshotDirty = true;
+        firstChangeAt = now;
+    }
+    lastChangeAt = now;
+}
+
+// Writes the snapshot now if anything changed, used before a restart
+void flushSnapshot()
+{
+    if (!snapshotDirty)
+        return;
+
+    snapshotDirty = false;
+    buildSnapshot(snapshotBuffer);
+    if (snapshotBuffer == savedSnapshot)
+    {
+        // Back where we started, nothing to write
+        snapshotSkips++;
+        return;
+    }
+
+    TRACE_SCOPE("snapshot write");
+    // A menu too large for the NVS partition is not kept across reboots
+    if (preferences.putBytes(SNAPSHOT_KEY, snapshotBuffer.data(), snapshotBuffer.size()) != snapshotBuffer.size())
+    {
+        Serial.println("Failed to write snapshot");
+        return;
+    }
+
+    savedSnapshot.swap(snapshotBuffer);
+    snapshotWrites++;
+}
+
+// Housekeeping: batches changes into one write once the knob is quiet
+void updateSnapshot()
+{
+    if (!snapshotDirty)
+        return;
+
+    unsigned long now = millis();
+    if (now - lastChangeAt < SNAPSHOT_QUIET_MS && now - firstChangeAt < SNAPSHOT_MAX_DELAY_MS)
+        return;
+
+    flushSnapshot();
+}
+
+static bool validNavigation(const SnapshotHeader &header)
+{
+    int menuCount = mainMenu.size();
+
+    switch (header.state)
+    {
+    case MAIN_MENU:
+        return header.menuIndex <= menuCount;
+
+    case SUBMENU:
+        return header.menuIndex < menuCount &&
+               header.submenuIndex <= mainMenu[header.menuIndex].rooms.size() + mainMenu[header.menuIndex].requests.size();
+
+    case DEVICE_CONTROL:
+        return header.menuIndex < menuCount &&
+               header.submenuIndex < mainMenu[header.menuIndex].rooms.size() &&
+               header.deviceIndex <= mainMenu[header.menuIndex].rooms[header.submenuIndex].devices.size();
+
+    case SETTINGS_MENU:
+    case DIAGNOSTICS:
+        return header.menuIndex == menuCount && header.settingIndex <= 4;
+    }
+    return false;
+}
+
+// Applies the saved snapshot to the freshly loaded menu, called before the
+// first frame
+void restoreSnapshot()
+{
+    std::vector<uint8_t> stored(preferences.getBytesLength(SNAPSHOT_KEY));
+    size_t length = stored.size();
+    if (length < sizeof(SnapshotHeader) || preferences.getBytes(SNAPSHOT_KEY, stored.data(), length) != length)
+        return;
+
+    SnapshotHeader header;
+    memcpy(&header, stored.data(), sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+        length != sizeof(SnapshotHeader) + header.deviceCount * sizeof(SnapshotDevice))
+    {
+        Serial.println("Ignoring incompatible snapshot");
+        return;
+    }
+    savedSnapshot.swap(stored);
+
+    const SnapshotDevice *entries = (const SnapshotDevice *)(savedSnapshot.data() + sizeof(SnapshotHeader));
+    int restored = 0;
+    int expected = 0;
+    for (auto &menu : mainMenu)
+    {
+        for (auto &room : menu.rooms)
+        {
+            for (auto &device : room.devices)
+            {
+                // Unless the menu changed, entries are in menu order and the
+                // search ends at the first one it looks at
+                uint32_t idHash = hashDeviceId(device.device_id);
+                for (int n = 0; n < header.deviceCount; n++)
+                {
+                    int i = (expected + n) % header.deviceCount;
+                    if (entries[i].idHash != idHash)
+                        continue;
+
+                    expected = i + 1;
+
+                    char color[8];
+                    snprintf(color, sizeof(color), "#%02X%02X%02X", entries[i].rgb[0], entries[i].rgb[1], entries[i].rgb[2]);
+                    device.state = device.confirmedState = entries[i].state != 0;
+                    device.brightness = device.confirmedBrightness = entries[i].brightness;
+                    device.color = device.confirmedColor = color;
+                    restored++;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Menu edits since the snapshot can leave the cursor nowhere, start over then
+    if (validNavigation(header))
+    {
+        currentState = (MenuState)header.state;
+        currentMenuIndex = header.menuIndex;
+        currentSubmenuIndex = header.submenuIndex;
+        currentDeviceIndex = header.deviceIndex;
+        currentSettingIndex = header.settingIndex;
+    }
+
+    Serial.printf("Snapshot restored: %d devices, %u bytes\n", restored, (unsigned)length);
+}
+
+void writeSnapshotStatus(JsonObject out)
+{
+    out["bytes"] = savedSnapshot.size();
+    out["writes"] = snapshotWrites;
+    out["skipped"] = snapshotSkips;
+    out["pending"] = snapshotDirty;
+}
@@ -0,0 +1,167 @@
+#include "SmartMenuSystem.h"
+
+#if TRACE_ENABLED
+#include <atomic>
+
+// Fixed-size ring of trace events. Writers claim a slot with one atomic
+// increment and never wait, so spans can be recorded from the loop, the
+// outbound worker and the Wi-Fi event task alike. Old events are simply
+// overwritten. Each slot stores the sequence number it was written for, which
+// lets the exporter skip slots that were reused while it was reading.
+struct TraceEvent
+{
+    std::atomic<uint32_t> sequence;
+    uint32_t timestamp;
+    const char *name;
+    TaskHandle_t task;
+    char phase;
+};
+
+static TraceEvent traceBuffer[TRACE_BUFFER_SIZE];
+static std::atomic<uint32_t> traceHead(0);
+
+void traceEvent(const char *name, char phase)
+{
+    uint32_t index = traceHead.fetch_add(1, std::memory_order_relaxed);
+    TraceEvent &event = traceBuffer[index % TRACE_BUFFER_SIZE];
+
+    event.sequence.store(0, std::memory_order_relaxed);
+    event.timestamp = micros();
+    event.name = name;
+    event.task = xTaskGetCurrentTaskHandle();
+    event.phase = phase;
+    event.sequence.store(index + 1, std::memory_order_release);
+}
+
+static const char *wifiEventName(arduino_event_id_t event)
+{
+    switch (event)
+    {
+    case ARDUINO_EVENT_WIFI_STA_START:
+        return "wifi sta start";
+    case ARDUINO_EVENT_WIFI_STA_CONNECTED:
+        return "wifi connected";
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+        return "wifi disconnected";
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+        return "wifi got ip";
+    case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+        return "wifi lost ip";
+    case ARDUINO_EVENT_WIFI_AP_START:
+        return "wifi ap start";
+    case ARDUINO_EVENT_WIFI_AP_STACONNECTED:
+        return "wifi ap client connected";
+    case ARDUINO_EVENT_WIFI_AP_STADISCONNECTED:
+        return "wifi ap client disconnected";
+    default:
+        return "wifi event";
+    }
+}
+
+static void traceWiFiEvent(arduino_event_id_t event)
+{
+    traceEvent(wifiEventName(event), 'i');
+}
+
+void initializeTrace()
+{
+    WiFi.onEvent(traceWiFiEvent);
+}
+
+// Small table so every FreeRTOS task gets a stable thread id in the export
+static int traceThreadId(TaskHandle_t task, TaskHandle_t *tasks, int &taskCount)
+{
+    for (int i = 0; i < taskCount; i++)
+    {
+        if (tasks[i] == task)
+            return i + 1;
+    }
+    if (taskCount == TRACE_MAX_THREADS)
+        return 0;
+
+    tasks[taskCount++] = task;
+    return taskCount;
+}
+
+// GET /trace: Chrome trace event JSON, loads in chrome://tracing or Perfetto
+void handleTrace()
+{
+    TRACE_SCOPE("http /trace");
+    registerNetworkActivity();
+
+    // Stream in chunks through a small buffer instead of building the whole
+    // document in RAM
+    static char chunk[TRACE_CHUNK_SIZE];
+    size_t used = 0;
+    TaskHandle_t tasks[TRACE_MAX_THREADS];
+    int taskCount = 0;
+
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "application/json", "");
+    server.sendContent("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    uint32_t head = traceHead.load(std::memory_order_acquire);
+    uint32_t first = head > TRACE_BUFFER_SIZE ? head - TRACE_BUFFER_SIZE : 0;
+    bool firstEvent = true;
+
+    for (uint32_t index = first; index < head; index++)
+    {
+        TraceEvent &event = traceBuffer[index % TRACE_BUFFER_SIZE];
+        if (event.sequence.load(std::memory_order_acquire) != index + 1)
+            continue;
+
+        uint32_t timestamp = event.timestamp;
+        const char *name = event.name;
+        TaskHandle_t task = event.task;
+        char phase = event.phase;
+
+        // Overwritten while copying
+        if (event.sequence.load(std::memory_order_acquire) != index + 1)
+            continue;
+
+        if (used > TRACE_CHUNK_SIZE - TRACE_MAX_EVENT_JSON)
+        {
+            server.sendContent(chunk, used);
+            used = 0;
+        }
+
+        used += snprintf(chunk + used, TRACE_CHUNK_SIZE - used,
+                         "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":1,\"tid\":%d%s}",
+                         firstEvent ? "" : ",", name, phase, timestamp,
+                         traceThreadId(task, tasks, taskCount), phase == 'i' ? ",\"s\":\"g\"" : "");
+        firstEvent = false;
+    }
+
+    // Name the threads after their FreeRTOS tasks
+    for (int i = 0; i < taskCount; i++)
+    {
+        if (used > TRACE_CHUNK_SIZE - TRACE_MAX_EVENT_JSON)
+        {
+            server.sendContent(chunk, used);
+            used = 0;
+        }
+
+        used += snprintf(chunk + used, TRACE_CHUNK_SIZE - used,
+                         "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                         firstEvent ? "" : ",", i + 1, pcTaskGetName(tasks[i]));
+        firstEvent = false;
+    }
+
+    if (used > 0)
+        server.sendContent(chunk, used);
+    server.sendContent("]}");
+    server.sendContent("");
+}
+
+#else
+
+void initializeTrace()
+{
+}
+
+void handleTrace()
+{
+    server.send(404, "application/json", "{\"status\":\"error\",\"message\":\"Tracing disabled\"}");
+}
+
+#endif
@@ -0,0 +1,309 @@
+#include "SmartMenuSystem.h"
+#include <PubSubClient.h>
+#include <atomic>
+
+// Device commands go either to main_url over HTTP (the default, see
+// HttpRequests.cpp) or to an MQTT broker. With MQTT the knob keeps one
+// connection open, publishes commands to <prefix>/<device_id>/set and
+// receives state changes pushed on <prefix>/<device_id>/state.
+//
+// The MQTT client belongs to a task of its own: connecting to a broker that
+// is down blocks for seconds, which must not stall input and rendering. The
+// main loop hands it commands through a queue and gets state messages back
+// through another one.
+
+// Settings the task works with, copied from the globals on (re)configuration
+struct MqttSettings
+{
+    bool enabled;
+    char host[64]; // PubSubClient keeps the pointer, so it needs its own copy
+    int port;
+    char prefix[OUTBOUND_DEVICE_ID_SIZE];
+    char user[64];
+    char password[64];
+    char clientId[32];
+};
+
+struct MqttCommand
+{
+    uint32_t sequence;
+    char deviceId[OUTBOUND_DEVICE_ID_SIZE];
+    char type[OUTBOUND_TYPE_SIZE];
+    char value[OUTBOUND_VALUE_SIZE];
+    char body[OUTBOUND_BODY_SIZE];
+    size_t bodyLength;
+};
+
+// A state message, type is empty if the payload did not name one
+struct MqttState
+{
+    char deviceId[OUTBOUND_DEVICE_ID_SIZE];
+    char type[OUTBOUND_TYPE_SIZE];
+    char value[OUTBOUND_VALUE_SIZE];
+};
+
+static WiFiClient mqttNetwork;
+static PubSubClient mqttClient(mqttNetwork);
+static MqttSettings pendingSettings;
+static MqttSettings settings;
+static bool settingsChanged = false;
+static SemaphoreHandle_t settingsMutex = nullptr;
+static QueueHandle_t commandQueue = nullptr;
+static QueueHandle_t stateQueue = nullptr;
+static TaskHandle_t mqttTask = nullptr;
+static std::atomic<bool> sessionUp(false);
+
+bool usingMqtt()
+{
+    return transport == "mqtt" && mqtt_host.length() > 0;
+}
+
+bool mqttConnected()
+{
+    return usingMqtt() && sessionUp.load();
+}
+
+// Runs on the MQTT task, from mqttClient.loop(). Payload is either
+// {"type": "...", "value": ...} or just the value. JSON values may be
+// strings, numbers or bools (true is "1", like the onoff commands send).
+static void handleMqttMessage(char *topic, byte *payload, unsigned int length)
+{
+    size_t prefixLength = strlen(settings.prefix);
+    size_t topicLength = strlen(topic);
+    size_t suffixLength = strlen("/state");
+    if (topicLength <= prefixLength + 1 + suffixLength ||
+        strncmp(topic, settings.prefix, prefixLength) != 0 || topic[prefixLength] != '/' ||
+        strcmp(topic + topicLength - suffixLength, "/state") != 0)
+        return;
+
+    MqttState state;
+    size_t idLength = topicLength - prefixLength - 1 - suffixLength;
+    if (idLength >= sizeof(state.deviceId))
+        return;
+    memcpy(state.deviceId, topic + prefixLength + 1, idLength);
+    state.deviceId[idLength] = '\0';
+    state.type[0] = '\0';
+
+    // Runs off the main loop, so it cannot use the shared JSON arena
+    StaticJsonDocument<OUTBOUND_REPLY_SIZE> doc;
+    if (!deserializeJson(doc, payload, length) && doc.is<JsonObject>())
+    {
+        strlcpy(state.type, doc["type"] | "", sizeof(state.type));
+        JsonVariant value = doc["value"];
+        if (value.is<bool>())
+        {
+            strlcpy(state.value, value.as<bool>() ? "1" : "0", sizeof(state.value));
+        }
+        else if (value.isNull())
+        {
+            state.value[0] = '\0';
+        }
+        else
+        {
+            strlcpy(state.value, value.as<String>().c_str(), sizeof(state.value));
+        }
+    }
+    else
+    {
+        // The payload is not null terminated
+        size_t copy = length < sizeof(state.value) - 1 ? length : sizeof(state.value) - 1;
+        memcpy(state.value, payload, copy);
+        state.value[copy] = '\0';
+    }
+
+    if (xQueueSend(stateQueue, &state, 0) != pdTRUE)
+    {
+        Serial.println("MQTT state queue full, dropping message");
+    }
+}
+
+static bool connectMqtt()
+{
+    bool connected = settings.user[0] != '\0'
+                         ? mqttClient.connect(settings.clientId, settings.user, settings.password)
+                         : mqttClient.connect(settings.clientId);
+    if (!connected)
+    {
+        Serial.printf("MQTT connect failed: %d\n", mqttClient.state());
+        return false;
+    }
+
+    char topic[OUTBOUND_DEVICE_ID_SIZE + 16];
+    snprintf(topic, sizeof(topic), "%s/+/state", settings.prefix);
+    mqttClient.subscribe(topic);
+    Serial.printf("MQTT connected to %s\n", settings.host);
+    return true;
+}
+
+// Takes over settings posted by initializeTransport(), dropping the session.
+// Returns true if there were any.
+static bool applySettings()
+{
+    xSemaphoreTake(settingsMutex, portMAX_DELAY);
+    bool changed = settingsChanged;
+    if (changed)
+    {
+        settings = pendingSettings;
+        settingsChanged = false;
+    }
+    xSemaphoreGive(settingsMutex);
+
+    if (!changed)
+        return false;
+
+    if (mqttClient.connected())
+    {
+        mqttClient.disconnect();
+    }
+    sessionUp.store(false);
+
+    mqttClient.setServer(settings.host, settings.port);
+    mqttClient.setCallback(handleMqttMessage);
+    mqttClient.setBufferSize(MQTT_BUFFER_SIZE);
+    mqttClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+    mqttClient.setKeepAlive(MQTT_KEEPALIVE_S);
+    return true;
+}
+
+static void publishCommands()
+{
+    MqttCommand command;
+    while (xQueueReceive(commandQueue, &command, 0) == pdTRUE)
+    {
+        bool sent = false;
+        if (mqttClient.connected())
+        {
+            char topic[OUTBOUND_DEVICE_ID_SIZE * 2 + 8];
+            snprintf(topic, sizeof(topic), "%s/%s/set", settings.prefix, command.deviceId);
+            TRACE_SCOPE("mqtt publish");
+            sent = mqttClient.publish(topic, (const uint8_t *)command.body, command.bodyLength);
+            Serial.printf("Device request %s on %s\n", sent ? "published" : "failed", topic);
+        }
+        else
+        {
+            Serial.println("MQTT not connected, dropping device request");
+        }
+
+        // Publishing is the only acknowledgement MQTT gives us
+        postCommandResult(command.sequence, command.deviceId, command.type, command.value, sent ? 200 : -1);
+    }
+}
+
+// Keeps the session alive, reconnects with backoff and publishes commands
+static void mqttWorker(void *)
+{
+    unsigned long lastAttempt = 0;
+    unsigned long retryDelay = MQTT_RETRY_MIN_MS;
+
+    for (;;)
+    {
+        // Woken early by new commands or settings
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MQTT_POLL_MS));
+
+        if (applySettings())
+        {
+            lastAttempt = 0;
+            retryDelay = MQTT_RETRY_MIN_MS;
+        }
+
+        if (settings.enabled && WiFi.status() == WL_CONNECTED)
+        {
+            if (mqttClient.connected())
+            {
+                mqttClient.loop();
+            }
+            else if (lastAttempt == 0 || millis() - lastAttempt >= retryDelay)
+            {
+                lastAttempt = millis();
+                if (connectMqtt())
+                {
+                    retryDelay = MQTT_RETRY_MIN_MS;
+                }
+                else
+                {
+                    retryDelay = min(retryDelay * 2, (unsigned long)MQTT_RETRY_MAX_MS);
+                }
+            }
+        }
+        sessionUp.store(mqttClient.connected());
+
+        publishCommands();
+    }
+}
+
+// Also called after a menu reload, which may change the settings
+void initializeTransport()
+{
+    if (mqttTask == nullptr)
+    {
+        settingsMutex = xSemaphoreCreateMutex();
+        commandQueue = xQueueCreate(MQTT_QUEUE_LENGTH, sizeof(MqttCommand));
+        stateQueue = xQueueCreate(MQTT_QUEUE_LENGTH, sizeof(MqttState));
+        xTaskCreate(mqttWorker, "mqtt", MQTT_TASK_STACK, nullptr, OUTBOUND_TASK_PRIORITY, &mqttTask);
+    }
+
+    String clientId = "knobble-" + WiFi.macAddress();
+    clientId.replace(":", "");
+
+    xSemaphoreTake(settingsMutex, portMAX_DELAY);
+    pendingSettings.enabled = usingMqtt();
+    strlcpy(pendingSettings.host, mqtt_host.c_str(), sizeof(pendingSettings.host));
+    pendingSettings.port = mqtt_port;
+    strlcpy(pendingSettings.prefix, mqtt_prefix.c_str(), sizeof(pendingSettings.prefix));
+    strlcpy(pendingSettings.user, mqtt_user.c_str(), sizeof(pendingSettings.user));
+    strlcpy(pendingSettings.password, mqtt_password.c_str(), sizeof(pendingSettings.password));
+    strlcpy(pendingSettings.clientId, clientId.c_str(), sizeof(pendingSettings.clientId));
+    settingsChanged = true;
+    xSemaphoreGive(settingsMutex);
+
+    xTaskNotifyGive(mqttTask);
+}
+
+// Network task: applies state messages received by the MQTT task
+void handleTransport()
+{
+    if (stateQueue == nullptr)
+        return;
+
+    MqttState state;
+    while (xQueueReceive(stateQueue, &state, 0) == pdTRUE)
+    {
+        registerNetworkActivity();
+
+        String deviceId = state.deviceId;
+        const Device *device = findDeviceById(deviceId);
+        if (device == nullptr)
+            continue;
+
+        TRACE_SCOPE("mqtt message");
+        String type = state.type[0] != '\0' ? String(state.type) : device->type;
+        confirmDeviceState(deviceId, type, state.value);
+        refreshDevice(*device);
+    }
+}
+
+// Hands a command to the MQTT task, which reports the outcome through
+// postCommandResult(). Returns false if it could not be queued.
+bool publishDeviceCommand(uint32_t sequence, const String &deviceId, const String &type, const String &value,
+                          const char *body, size_t length)
+{
+    if (commandQueue == nullptr || length > OUTBOUND_BODY_SIZE)
+        return false;
+
+    MqttCommand command;
+    command.sequence = sequence;
+    strlcpy(command.deviceId, deviceId.c_str(), sizeof(command.deviceId));
+    strlcpy(command.type, type.c_str(), sizeof(command.type));
+    strlcpy(command.value, value.c_str(), sizeof(command.value));
+    memcpy(command.body, body, length);
+    command.bodyLength = length;
+
+    if (xQueueSend(commandQueue, &command, 0) != pdTRUE)
+    {
+        Serial.println("MQTT queue full, dropping device request");
+        return false;
+    }
+
+    xTaskNotifyGive(mqttTask);
+    return true;
+}
@@ -0,0 +1,278 @@
+#include "SmartMenuSystem.h"
+#include <Update.h>
+#include <LittleFS.h>
+#include <MD5Builder.h>
+#include <esp_ota_ops.h>
+
+// Streaming updates over HTTP. Both firmware images and menu configs are
+// written to flash one upload chunk at a time, so RAM use does not depend on
+// the payload size. Firmware goes to the inactive OTA slot and is only marked
+// valid once the new image has booted (see markFirmwareValid()); configs are
+// written next to the active one and swapped in after they parse, keeping the
+// previous config as a fallback.
+
+enum UpdateTarget
+{
+    UPDATE_FIRMWARE,
+    UPDATE_CONFIG
+};
+
+static UpdateTarget updateTarget = UPDATE_FIRMWARE;
+static String updateError = "";
+static String expectedMd5 = "";
+static size_t updateBytes = 0;
+static unsigned long updateStarted = 0;
+static bool uploadReceived = false;
+static MD5Builder configMd5;
+static File configFile;
+
+// Tells the Arduino core not to confirm a freshly flashed image on its own.
+extern "C" bool verifyRollbackLater()
+{
+    return true;
+}
+
+// Confirms the running image. Until this is called, a reset boots the
+// previous firmware again.
+void markFirmwareValid()
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY)
+    {
+        esp_ota_mark_app_valid_cancel_rollback();
+        Serial.println("New firmware marked valid");
+    }
+}
+
+void initializeStorage()
+{
+    if (!LittleFS.begin(true))
+    {
+        Serial.println("ERROR: Failed to mount LittleFS");
+    }
+}
+
+// Checks that the staged config parses, then makes it the active one. It is
+// parsed with the same budget loadMenuStructure() gets, so a config that is
+// accepted here also loads.
+static bool commitConfig(const char *stagedPath)
+{
+    File staged = LittleFS.open(stagedPath, "r");
+    if (!staged)
+        return false;
+
+    DynamicJsonDocument doc(menuJsonCapacity(staged.size()));
+    TRACE_BEGIN("json parse config");
+    DeserializationError error = deserializeJson(doc, staged);
+    TRACE_END("json parse config");
+    staged.close();
+
+    if (error || !doc["menu"].is<JsonArray>())
+    {
+        updateError = String("Invalid menu config: ") + error.c_str();
+        LittleFS.remove(stagedPath);
+        return false;
+    }
+
+    LittleFS.remove(MENU_CONFIG_BACKUP_PATH);
+    if (LittleFS.exists(MENU_CONFIG_PATH))
+    {
+        LittleFS.rename(MENU_CONFIG_PATH, MENU_CONFIG_BACKUP_PATH);
+    }
+    return LittleFS.rename(stagedPath, MENU_CONFIG_PATH);
+}
+
+// Stores a menu config that already sits in RAM (the /menu form post)
+bool saveMenuConfig(const String &menuJson)
+{
+    File staged = LittleFS.open(MENU_CONFIG_STAGED_PATH, "w");
+    if (!staged)
+        return false;
+
+    size_t written = staged.print(menuJson);
+    staged.close();
+    if (written != menuJson.length())
+    {
+        LittleFS.remove(MENU_CONFIG_STAGED_PATH);
+        return false;
+    }
+
+    return commitConfig(MENU_CONFIG_STAGED_PATH);
+}
+
+static void abortUpload()
+{
+    if (updateTarget == UPDATE_FIRMWARE)
+    {
+        Update.abort();
+    }
+    else
+    {
+        if (configFile)
+            configFile.close();
+        LittleFS.remove(MENU_CONFIG_STAGED_PATH);
+    }
+}
+
+// Called by the web server for every chunk of the multipart upload
+void handleUpdateUpload()
+{
+    TRACE_SCOPE("http /update chunk");
+    HTTPUpload &upload = server.upload();
+    registerNetworkActivity();
+
+    switch (upload.status)
+    {
+    case UPLOAD_FILE_START:
+        uploadReceived = true;
+        updateTarget = server.arg("target") == "config" ? UPDATE_CONFIG : UPDATE_FIRMWARE;
+        updateError = "";
+        expectedMd5 = server.arg("md5");
+        expectedMd5.toLowerCase();
+        updateBytes = 0;
+        updateStarted = millis();
+
+        // Nothing is written without the admin password, handleUpdateDone()
+        // sends the refusal
+        if (!adminAuthorized())
+        {
+            updateError = "Unauthorized";
+            break;
+        }
+        Serial.printf("Update started: %s\n", upload.filename.c_str());
+
+        if (updateTarget == UPDATE_FIRMWARE)
+        {
+            if (!Update.begin(UPDATE_SIZE_UNKNOWN, U_FLASH))
+            {
+                updateError = Update.errorString();
+            }
+            else if (expectedMd5.length() > 0 && !Update.setMD5(expectedMd5.c_str()))
+            {
+                updateError = "Invalid MD5";
+                Update.abort();
+            }
+        }
+        else
+        {
+            configMd5.begin();
+            configFile = LittleFS.open(MENU_CONFIG_STAGED_PATH, "w");
+            if (!configFile)
+            {
+                updateError = "Failed to open config file";
+            }
+        }
+        break;
+
+    case UPLOAD_FILE_WRITE:
+        if (updateError.length() > 0)
+            break;
+
+        if (updateTarget == UPDATE_FIRMWARE)
+        {
+            if (Update.write(upload.buf, upload.currentSize) != upload.currentSize)
+            {
+                updateError = Update.errorString();
+                Update.abort();
+            }
+        }
+        else
+        {
+            configMd5.add(upload.buf, upload.currentSize);
+            if (configFile.write(upload.buf, upload.currentSize) != upload.currentSize)
+            {
+                updateError = "Failed to write config";
+                abortUpload();
+            }
+        }
+        updateBytes += upload.currentSize;
+        break;
+
+    case UPLOAD_FILE_END:
+        if (updateError.length() > 0)
+            break;
+
+        if (updateTarget == UPDATE_FIRMWARE)
+        {
+            // Checks the MD5 and switches the boot slot
+            if (!Update.end(true))
+            {
+                updateError = Update.errorString();
+            }
+        }
+        else
+        {
+            configFile.close();
+            configMd5.calculate();
+            if (expectedMd5.length() > 0 && configMd5.toString() != expectedMd5)
+            {
+                updateError = "MD5 mismatch";
+                LittleFS.remove(MENU_CONFIG_STAGED_PATH);
+            }
+            else if (!commitConfig(MENU_CONFIG_STAGED_PATH) && updateError.length() == 0)
+            {
+                updateError = "Failed to store config";
+            }
+        }
+        break;
+
+    case UPLOAD_FILE_ABORTED:
+        if (updateError.length() == 0)
+        {
+            updateError = "Upload aborted";
+            abortUpload();
+        }
+        break;
+    }
+}
+
+// Called once the whole request has been received
+void handleUpdateDone()
+{
+    TRACE_SCOPE("http /update");
+    registerNetworkActivity();
+    if (!requireAdmin())
+    {
+        uploadReceived = false;
+        return;
+    }
+    if (!uploadReceived)
+    {
+        updateError = "No file uploaded";
+        updateBytes = 0;
+        updateStarted = millis();
+    }
+    uploadReceived = false;
+    unsigned long elapsed = millis() - updateStarted;
+
+    JsonDocument &doc = beginJson();
+    doc["status"] = updateError.length() > 0 ? "error" : "success";
+    if (updateError.length() > 0)
+    {
+        doc["message"] = updateError;
+    }
+    doc["bytes"] = updateBytes;
+    doc["ms"] = elapsed;
+    serializeJsonArena();
+    sendJsonResponse(updateError.length() > 0 ? 500 : 200);
+
+    if (updateError.length() > 0)
+    {
+        Serial.println("Update failed: " + updateError);
+        return;
+    }
+
+    Serial.printf("Update complete: %u bytes in %lu ms\n", updateBytes, elapsed);
+
+    if (updateTarget == UPDATE_FIRMWARE)
+    {
+        flushSnapshot();
+        delay(1000);
+        ESP.restart();
+    }
+    else
+    {
+        reloadMenuConfig();
+    }
+}
@@ -0,0 +1,250 @@
+#include "SmartMenuSystem.h"
+
+// Per-host health for every outbound call. Each host has its own connect and
+// read timeouts and a circuit breaker: after UPSTREAM_FAILURE_THRESHOLD
+// failures in a row the circuit opens and requests to that host fail at once
+// instead of waiting for a timeout. While open, a probe request is sent in the
+// background every UPSTREAM_OPEN_MS; the first answer closes the circuit.
+// The table is shared by the loop and the outbound workers.
+
+static UpstreamHost upstreamHosts[UPSTREAM_MAX_HOSTS];
+static int upstreamHostCount = 0;
+static SemaphoreHandle_t upstreamMutex = nullptr;
+
+// Defaults for hosts without their own settings
+static uint32_t defaultConnectTimeoutMs = UPSTREAM_CONNECT_TIMEOUT_MS;
+static uint32_t defaultReadTimeoutMs = UPSTREAM_READ_TIMEOUT_MS;
+static uint32_t lastUpstreamRttMs = 0;
+uint32_t hedge_delay_ms = 0;
+
+// "http://host:port/path" -> "host:port"
+static void hostFromUrl(const char *url, char *host, size_t size)
+{
+    const char *start = strstr(url, "://");
+    start = start != nullptr ? start + 3 : url;
+    size_t length = strcspn(start, "/?#");
+    if (length >= size)
+        length = size - 1;
+    memcpy(host, start, length);
+    host[length] = '\0';
+}
+
+// Called with the mutex held. Adds the host if it is not known yet; url is
+// used to remember where to send probes and may be nullptr.
+static UpstreamHost *findHost(const char *host, const char *url)
+{
+    UpstreamHost *entry = nullptr;
+    for (int i = 0; i < upstreamHostCount; i++)
+    {
+        if (strcmp(upstreamHosts[i].host, host) == 0)
+        {
+            entry = &upstreamHosts[i];
+            break;
+        }
+    }
+
+    if (entry == nullptr)
+    {
+        if (upstreamHostCount == UPSTREAM_MAX_HOSTS)
+            return nullptr;
+
+        entry = &upstreamHosts[upstreamHostCount++];
+        *entry = UpstreamHost();
+        strlcpy(entry->host, host, sizeof(entry->host));
+        entry->connectTimeoutMs = defaultConnectTimeoutMs;
+        entry->readTimeoutMs = defaultReadTimeoutMs;
+    }
+
+    // Probes go to the root of the host, with the scheme it was used with
+    if (entry->probeUrl[0] == '\0' && url != nullptr)
+    {
+        const char *scheme = strstr(url, "://");
+        size_t schemeLength = scheme != nullptr ? scheme - url + 3 : 0;
+        snprintf(entry->probeUrl, sizeof(entry->probeUrl), "%.*s%s/", (int)schemeLength, url, host);
+    }
+    return entry;
+}
+
+void initializeUpstream()
+{
+    upstreamMutex = xSemaphoreCreateMutex();
+}
+
+// Reads the "upstream" block of the menu settings:
+// {"connect_timeout_ms": 2000, "read_timeout_ms": 3000, "hedge_delay_ms": 500,
+//  "hosts": {"192.168.1.10:5000": {"connect_timeout_ms": 500, "read_timeout_ms": 1000}}}
+void configureUpstream(JsonObject settings)
+{
+    xSemaphoreTake(upstreamMutex, portMAX_DELAY);
+
+    defaultConnectTimeoutMs = settings["connect_timeout_ms"] | (uint32_t)UPSTREAM_CONNECT_TIMEOUT_MS;
+    defaultReadTimeoutMs = settings["read_timeout_ms"] | (uint32_t)UPSTREAM_READ_TIMEOUT_MS;
+    hedge_delay_ms = settings["hedge_delay_ms"] | 0;
+
+    for (int i = 0; i < upstreamHostCount; i++)
+    {
+        upstreamHosts[i].connectTimeoutMs = defaultConnectTimeoutMs;
+        upstreamHosts[i].readTimeoutMs = defaultReadTimeoutMs;
+    }
+
+    JsonObject hosts = settings["hosts"];
+    for (JsonPair pair : hosts)
+    {
+        UpstreamHost *entry = findHost(pair.key().c_str(), nullptr);
+        if (entry == nullptr)
+            break;
+
+        JsonObject host = pair.value();
+        entry->connectTimeoutMs = host["connect_timeout_ms"] | defaultConnectTimeoutMs;
+        entry->readTimeoutMs = host["read_timeout_ms"] | defaultReadTimeoutMs;
+    }
+
+    xSemaphoreGive(upstreamMutex);
+}
+
+// Returns false if the circuit for this URL's host is open, unless this is
+// the probe. Fills in the timeouts to use otherwise.
+bool upstreamAllow(const char *url, bool probe, uint32_t &connectTimeoutMs, uint32_t &readTimeoutMs)
+{
+    char host[UPSTREAM_HOST_SIZE];
+    hostFromUrl(url, host, sizeof(host));
+
+    xSemaphoreTake(upstreamMutex, portMAX_DELAY);
+    UpstreamHost *entry = findHost(host, url);
+    bool allowed = true;
+    connectTimeoutMs = defaultConnectTimeoutMs;
+    readTimeoutMs = defaultReadTimeoutMs;
+
+    if (entry != nullptr)
+    {
+        connectTimeoutMs = entry->connectTimeoutMs;
+        readTimeoutMs = entry->readTimeoutMs;
+        if (entry->state != CIRCUIT_CLOSED && !probe)
+        {
+            entry->rejected++;
+            allowed = false;
+        }
+    }
+
+    xSemaphoreGive(upstreamMutex);
+    return allowed;
+}
+
+// Records the outcome of a request. Connection errors and 5xx count as failures.
+void upstreamRecord(const char *url, int httpCode, uint32_t rttMs)
+{
+    char host[UPSTREAM_HOST_SIZE];
+    hostFromUrl(url, host, sizeof(host));
+    bool success = httpCode > 0 && httpCode < 500;
+
+    xSemaphoreTake(upstreamMutex, portMAX_DELAY);
+    UpstreamHost *entry = findHost(host, url);
+    if (entry != nullptr)
+    {
+        entry->lastRttMs = rttMs;
+        lastUpstreamRttMs = rttMs;
+        entry->lastCode = httpCode;
+        if (success)
+        {
+            entry->successes++;
+            entry->consecutiveFailures = 0;
+            if (entry->state != CIRCUIT_CLOSED)
+            {
+                Serial.printf("Upstream %s is back, closing circuit\n", host);
+                entry->state = CIRCUIT_CLOSED;
+            }
+        }
+        else
+        {
+            entry->failures++;
+            entry->consecutiveFailures++;
+            if (entry->state == CIRCUIT_PROBING ||
+                (entry->state == CIRCUIT_CLOSED && entry->consecutiveFailures >= UPSTREAM_FAILURE_THRESHOLD))
+            {
+                if (entry->state == CIRCUIT_CLOSED)
+                    Serial.printf("Upstream %s is failing, opening circuit\n", host);
+                entry->state = CIRCUIT_OPEN;
+                entry->openedAt = millis();
+            }
+        }
+    }
+    xSemaphoreGive(upstreamMutex);
+}
+
+// Housekeeping: sends one probe to every host whose circuit has been open
+// for UPSTREAM_OPEN_MS
+void probeUpstreams()
+{
+    char probeUrls[UPSTREAM_MAX_HOSTS][UPSTREAM_PROBE_URL_SIZE];
+    int probeCount = 0;
+
+    xSemaphoreTake(upstreamMutex, portMAX_DELAY);
+    for (int i = 0; i < upstreamHostCount; i++)
+    {
+        UpstreamHost &entry = upstreamHosts[i];
+        if (entry.state != CIRCUIT_OPEN || millis() - entry.openedAt < UPSTREAM_OPEN_MS || entry.probeUrl[0] == '\0')
+            continue;
+
+        entry.state = CIRCUIT_PROBING;
+        strlcpy(probeUrls[probeCount++], entry.probeUrl, sizeof(probeUrls[0]));
+    }
+    xSemaphoreGive(upstreamMutex);
+
+    for (int i = 0; i < probeCount; i++)
+    {
+        if (!enqueueProbe(probeUrls[i]))
+        {
+            // Queue is full, try again on the next round
+            upstreamRecord(probeUrls[i], -1, 0);
+        }
+    }
+}
+
+// Last round trip and total failed or rejected calls over all hosts, for the
+// diagnostics screen
+void getUpstreamSummary(uint32_t &lastRttMs, uint32_t &errors)
+{
+    errors = 0;
+
+    xSemaphoreTake(upstreamMutex, portMAX_DELAY);
+    lastRttMs = lastUpstreamRttMs;
+    for (int i = 0; i < upstreamHostCount; i++)
+    {
+        errors += upstreamHosts[i].failures + upstreamHosts[i].rejected;
+    }
+    xSemaphoreGive(upstreamMutex);
+}
+
+static const char *circuitStateName(CircuitState state)
+{
+    switch (state)
+    {
+    case CIRCUIT_CLOSED:
+        return "closed";
+    case CIRCUIT_OPEN:
+        return "open";
+    default:
+        return "probing";
+    }
+}
+
+void writeUpstreamStatus(JsonArray out)
+{
+    xSemaphoreTake(upstreamMutex, portMAX_DELAY);
+    for (int i = 0; i < upstreamHostCount; i++)
+    {
+        UpstreamHost &entry = upstreamHosts[i];
+        JsonObject host = out.createNestedObject();
+        host["host"] = (const char *)entry.host;
+        host["circuit"] = circuitStateName(entry.state);
+        host["successes"] = entry.successes;
+        host["failures"] = entry.failures;
+        host["consecutive_failures"] = entry.consecutiveFailures;
+        host["rejected"] = entry.rejected;
+        host["last_code"] = entry.lastCode;
+        host["last_rtt_ms"] = entry.lastRttMs;
+        host["connect_timeout_ms"] = entry.connectTimeoutMs;
+        host["read_timeout_ms"] = entry.readTimeoutMs;
+    }
+    xSemaphoreGive(upstreamMutex);
+}
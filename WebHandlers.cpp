@@ -1,15 +1,56 @@
 #include "SmartMenuSystem.h"
 #include "WebInterface.h"
 
+static const char SUCCESS_JSON[] = "{\"status\":\"success\"}";
+
 // Web Server Handlers
 void handleRoot()
 {
-    String html = getWebInterfaceHTML();
-    server.send(200, "text/html", html);
+    TRACE_SCOPE("http /");
+    registerNetworkActivity();
+    server.send_P(200, "text/html", getWebInterfaceHTML());
+}
+
+// True if the request carries the admin password. Always false while none
+// is set.
+bool adminAuthorized()
+{
+    return admin_password.length() > 0 && server.authenticate(ADMIN_USER, admin_password.c_str());
+}
+
+// For admin endpoints: sends the refusal and returns false unless the
+// request is authorized
+bool requireAdmin()
+{
+    if (admin_password.length() == 0)
+    {
+        server.send(403, "application/json", "{\"status\":\"error\",\"message\":\"Set an admin password first\"}");
+        return false;
+    }
+    if (!adminAuthorized())
+    {
+        server.requestAuthentication();
+        return false;
+    }
+    return true;
 }
 
 void handleConfig()
 {
+    TRACE_SCOPE("http /config");
+    registerNetworkActivity();
+
+    // Setting the first admin password is open, changing it needs the old one
+    bool changesAdminPassword = server.hasArg("admin_password") && server.arg("admin_password").length() > 0;
+    if (changesAdminPassword && admin_password.length() > 0 && !requireAdmin())
+    {
+        return;
+    }
+
+    if (changesAdminPassword)
+    {
+        admin_password = server.arg("admin_password");
+    }
     if (server.hasArg("wifi_ssid"))
     {
         wifi_ssid = server.arg("wifi_ssid");
@@ -22,49 +63,145 @@ void handleConfig()
     {
         main_url = server.arg("main_url");
     }
+    if (server.hasArg("transport"))
+    {
+        transport = server.arg("transport");
+    }
+    if (server.hasArg("mqtt_host"))
+    {
+        mqtt_host = server.arg("mqtt_host");
+    }
+    if (server.hasArg("mqtt_port"))
+    {
+        mqtt_port = server.arg("mqtt_port").toInt();
+    }
+    if (server.hasArg("mqtt_prefix"))
+    {
+        mqtt_prefix = server.arg("mqtt_prefix");
+    }
 
     saveConfiguration();
-    server.send(200, "application/json", "{\"status\":\"success\"}");
+    server.send_P(200, "application/json", SUCCESS_JSON, sizeof(SUCCESS_JSON) - 1);
 
     // Restart WiFi with new credentials
+    flushSnapshot();
     delay(1000);
     ESP.restart();
 }
 
 void handleMenuConfig()
 {
-    String menuJson = server.arg("menu_structure");
-    preferences.putString("menu_json", menuJson);
-    loadMenuStructure();
-    server.send(200, "application/json", "{\"status\":\"success\"}");
+    TRACE_SCOPE("http /menu");
+    registerNetworkActivity();
+    if (!saveMenuConfig(server.arg("menu_structure")))
+    {
+        server.send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid menu config\"}");
+        return;
+    }
+    reloadMenuConfig();
+    server.send_P(200, "application/json", SUCCESS_JSON, sizeof(SUCCESS_JSON) - 1);
 }
 
 void handleDeviceControl()
 {
+    TRACE_SCOPE("http /control");
+    registerNetworkActivity();
     String deviceId = server.arg("device_id");
     String type = server.arg("type");
     String value = server.arg("value");
 
     // Update local device state
     updateDeviceState(deviceId, type, value);
+    requestRedraw();
 
     // Send HTTP request to main server
     sendDeviceRequest(deviceId, type, value);
 
-    server.send(200, "application/json", "{\"status\":\"success\"}");
+    server.send_P(200, "application/json", SUCCESS_JSON, sizeof(SUCCESS_JSON) - 1);
 }
 
 void handleStatus()
 {
-    DynamicJsonDocument doc(1024);
+    TRACE_SCOPE("http /status");
+    registerNetworkActivity();
+    JsonDocument &doc = beginJson();
     doc["wifi_ssid"] = ap_mode ? "AP Mode" : wifi_ssid;
     doc["ip_address"] = ap_mode ? WiFi.softAPIP().toString() : WiFi.localIP().toString();
     doc["ap_mode"] = ap_mode;
     doc["main_url"] = main_url;
+    doc["transport"] = transport;
+    doc["mqtt_connected"] = mqttConnected();
+    writeUpstreamStatus(doc.createNestedArray("upstream"));
+    writeDiagnostics(doc.createNestedObject("diagnostics"));
+    writeSnapshotStatus(doc.createNestedObject("snapshot"));
+
+    // With every upstream host in use this is larger than jsonOutBuffer
+    sendJsonStreamed(200);
+}
+
+// Sends the contents of jsonOutBuffer without copying it into a String.
+void sendJsonResponse(int code)
+{
+    if (jsonOutLength == 0)
+    {
+        server.send(500, "application/json", "{\"status\":\"error\"}");
+        return;
+    }
+
+    server.send_P(code, "application/json", jsonOutBuffer, jsonOutLength);
+}
+
+// Feeds serializeJson() output to the client through jsonOutBuffer
+class JsonChunkWriter : public Print
+{
+public:
+    size_t write(uint8_t c) override
+    {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t *data, size_t size) override
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            if (used == JSON_OUT_BUFFER_SIZE)
+                sendChunk();
+            jsonOutBuffer[used++] = data[i];
+        }
+        return size;
+    }
+
+    void sendChunk()
+    {
+        if (used > 0)
+            server.sendContent(jsonOutBuffer, used);
+        used = 0;
+    }
+
+private:
+    size_t used = 0;
+};
+
+// Sends the shared document in jsonOutBuffer-sized pieces, for responses
+// that can outgrow the buffer. The length is known up front, so the response
+// is not chunk encoded.
+void sendJsonStreamed(int code)
+{
+    TRACE_SCOPE("json serialize");
+    jsonOutLength = 0;
+    if (jsonArena.overflowed())
+    {
+        Serial.println("JSON payload too large for the arena");
+        server.send(500, "application/json", "{\"status\":\"error\"}");
+        return;
+    }
+
+    server.setContentLength(measureJson(jsonArena));
+    server.send(code, "application/json", "");
 
-    String response;
-    serializeJson(doc, response);
-    server.send(200, "application/json", response);
+    JsonChunkWriter writer;
+    serializeJson(jsonArena, writer);
+    writer.sendChunk();
 }
 
 String getWebInterface()
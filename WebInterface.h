@@ -99,6 +99,14 @@ inline const char *getWebInterfaceHTML()
             <input type="text" id="wifi_ssid" placeholder="WiFi SSID">
             <input type="password" id="wifi_password" placeholder="WiFi Password">
             <input type="text" id="main_url" placeholder="Main Server URL (e.g., http://yourserver.com/api)">
+            <select id="transport">
+                <option value="http">Send commands over HTTP</option>
+                <option value="mqtt">Send commands over MQTT</option>
+            </select>
+            <input type="text" id="mqtt_host" placeholder="MQTT Broker Host (e.g., 192.168.1.10)">
+            <input type="text" id="mqtt_port" placeholder="MQTT Broker Port (default 1883)">
+            <input type="text" id="mqtt_prefix" placeholder="MQTT Topic Prefix (default knobble)">
+            <input type="password" id="admin_password" placeholder="Admin Password (needed for updates, user admin)">
             <button onclick="saveConfig()">Save WiFi Config</button>
         </div>
         
@@ -129,6 +137,20 @@ inline const char *getWebInterfaceHTML()
             </div>
             <button onclick="controlDevice()">Send Control Command</button>
         </div>
+
+        <div class="section">
+            <h2>Firmware &amp; Config Update</h2>
+            <div class="device-control">
+                <label>Target:</label>
+                <select id="update_target">
+                    <option value="firmware">Firmware (.bin)</option>
+                    <option value="config">Menu Config (.json)</option>
+                </select>
+            </div>
+            <input type="file" id="update_file">
+            <input type="text" id="update_md5" placeholder="MD5 checksum (optional)">
+            <button onclick="uploadUpdate()">Upload</button>
+        </div>
     </div>
 
     <script>
@@ -141,18 +163,25 @@ inline const char *getWebInterfaceHTML()
             document.getElementById('loading').style.display = 'none';
         }
 
+        // Transport the knob reported, so saving the WiFi form keeps it
+        let loadedTransport = null;
+
         function loadStatus() {
             showLoading();
             fetch('/status')
                 .then(response => response.json())
                 .then(data => {
                     hideLoading();
+                    loadedTransport = data.transport;
+                    document.getElementById('transport').value = data.transport;
                     document.getElementById('status').innerHTML = `
                         <div class="success">
                             <strong>WiFi SSID:</strong> ${data.wifi_ssid}<br>
                             <strong>IP Address:</strong> ${data.ip_address}<br>
                             <strong>AP Mode:</strong> ${data.ap_mode ? 'Yes' : 'No'}<br>
-                            <strong>Main URL:</strong> ${data.main_url}
+                            <strong>Main URL:</strong> ${data.main_url}<br>
+                            <strong>Transport:</strong> ${data.transport}${data.transport === 'mqtt' ? (data.mqtt_connected ? ' (connected)' : ' (disconnected)') : ''}
+                            ${(data.upstream || []).map(host => `<br><strong>${host.host}:</strong> ${host.circuit}, ${host.last_rtt_ms} ms, ${host.failures} failed / ${host.successes} ok`).join('')}
                         </div>
                     `;
                 })
@@ -169,6 +198,12 @@ inline const char *getWebInterfaceHTML()
             data.append('wifi_ssid', document.getElementById('wifi_ssid').value);
             data.append('wifi_password', document.getElementById('wifi_password').value);
             data.append('main_url', document.getElementById('main_url').value);
+            const transport = document.getElementById('transport').value;
+            if (loadedTransport !== null && transport !== loadedTransport) data.append('transport', transport);
+            ['mqtt_host', 'mqtt_port', 'mqtt_prefix', 'admin_password'].forEach(id => {
+                const value = document.getElementById(id).value;
+                if (value) data.append(id, value);
+            });
 
             fetch('/config', {
                 method: 'POST',
@@ -219,6 +254,38 @@ inline const char *getWebInterfaceHTML()
             });
         }
 
+        function uploadUpdate() {
+            const file = document.getElementById('update_file').files[0];
+            if (!file) {
+                alert('Select a file first');
+                return;
+            }
+
+            const target = document.getElementById('update_target').value;
+            const md5 = document.getElementById('update_md5').value.trim();
+            const data = new FormData();
+            data.append('file', file);
+
+            showLoading();
+            fetch(`/update?target=${target}&md5=${encodeURIComponent(md5)}`, {
+                method: 'POST',
+                body: data
+            })
+            .then(response => response.json())
+            .then(data => {
+                hideLoading();
+                if (data.status === 'success') {
+                    alert(target === 'firmware' ? 'Firmware updated! Device will restart.' : 'Menu config updated!');
+                } else {
+                    alert('Update failed: ' + data.message);
+                }
+            })
+            .catch(error => {
+                hideLoading();
+                alert('Error uploading update: ' + error);
+            });
+        }
+
         function loadDefaultMenu() {
             const defaultMenu = {
                 "menu": [
@@ -0,0 +1,112 @@
+"""
+Latency Benchmark for the Smart Menu System
+Replays a scripted input trace on the knob and reports input-to-frame and
+input-to-backend latency percentiles. Results are written as JSON and can be
+compared against a saved baseline to catch regressions.
+
+Starting a trace needs the knob's admin password.
+
+Usage:
+    python bench_latency.py 192.168.1.50 --password secret --trace spin --output spin.json
+    python bench_latency.py 192.168.1.50 --password secret --trace spin --baseline spin.json
+"""
+
+import argparse
+import base64
+import json
+import sys
+import time
+import urllib.error
+import urllib.request
+
+TRACES = ['spin', 'sweep', 'toggle']
+METRICS = ['input_to_frame', 'input_to_backend']
+PERCENTILES = ['p50_us', 'p95_us', 'p99_us']
+
+
+def request(host, path, method='GET', password=None):
+    req = urllib.request.Request(f"http://{host}{path}", method=method)
+    if password is not None:
+        token = base64.b64encode(f"admin:{password}".encode()).decode()
+        req.add_header('Authorization', f"Basic {token}")
+    with urllib.request.urlopen(req, timeout=10) as response:
+        return json.loads(response.read())
+
+
+def run_trace(host, trace, interval_ms, repeat, password):
+    """Start a trace on the knob and wait until it has finished"""
+    try:
+        request(host, f"/bench?trace={trace}&interval_ms={interval_ms}&repeat={repeat}", method='POST',
+                password=password)
+    except urllib.error.HTTPError as error:
+        # The knob refuses traces that would press the wrong item, and
+        # anyone without the admin password
+        try:
+            message = json.loads(error.read()).get('message', error.reason)
+        except ValueError:
+            message = error.reason
+        sys.exit(f"Cannot start {trace}: {message}")
+
+    while True:
+        time.sleep(0.5)
+        result = request(host, '/latency')
+        if not result['running']:
+            break
+
+    # Give outstanding device requests time to come back
+    time.sleep(2)
+    return request(host, '/latency')
+
+
+def find_regressions(result, baseline, tolerance):
+    """Percentiles that got worse than the baseline by more than tolerance"""
+    regressions = []
+    for metric in METRICS:
+        for percentile in PERCENTILES:
+            before = baseline.get(metric, {}).get(percentile)
+            after = result.get(metric, {}).get(percentile)
+            if before is None or after is None:
+                continue
+            if after > before * (1 + tolerance):
+                regressions.append(f"{metric} {percentile}: {before}us -> {after}us")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Knob latency benchmark')
+    parser.add_argument('host', help='IP address or hostname of the knob')
+    parser.add_argument('--password', required=True, help="The knob's admin password")
+    parser.add_argument('--trace', choices=TRACES, default='spin')
+    parser.add_argument('--interval', type=int, default=16, help='Milliseconds between input steps')
+    parser.add_argument('--repeat', type=int, default=5, help='How many times to replay the trace')
+    parser.add_argument('--output', help='Write the results to this JSON file')
+    parser.add_argument('--baseline', help='Compare against results from an earlier run')
+    parser.add_argument('--tolerance', type=float, default=0.2, help='Allowed slowdown, 0.2 = 20%%')
+    args = parser.parse_args()
+
+    result = run_trace(args.host, args.trace, args.interval, args.repeat, args.password)
+
+    for metric in METRICS:
+        stats = result[metric]
+        if stats['count'] == 0:
+            print(f"{metric}: no samples")
+            continue
+        values = ', '.join(f"{p[:-3]}={stats[p] / 1000:.1f}ms" for p in PERCENTILES)
+        print(f"{metric}: {values} ({stats['count']} samples)")
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(result, f, indent=2)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        regressions = find_regressions(result, baseline, args.tolerance)
+        for regression in regressions:
+            print(f"REGRESSION {regression}")
+        if regressions:
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -5,7 +5,10 @@ This server receives device control requests from the Arduino menu system.
 
 from flask import Flask, request, jsonify
 from flask_cors import CORS
+import argparse
 import json
+import random
+import time
 from datetime import datetime
 
 app = Flask(__name__)
@@ -14,6 +17,41 @@ CORS(app)  # Enable CORS for web interface
 # Store device states
 device_states = {}
 
+# Fault injection for testing the knob against a slow or flaky backend.
+# Applies to the device control endpoint and the predefined requests.
+faults = {
+    'delay_ms': 0,     # Added to every response
+    'fail_rate': 0.0,  # Share of requests answered with fail_status
+    'fail_status': 503,
+}
+
+FAULT_ENDPOINTS = {'handle_device_control', 'handle_request1', 'handle_request2'}
+
+@app.before_request
+def inject_faults():
+    """Delay or fail requests according to the current fault settings"""
+    if request.endpoint not in FAULT_ENDPOINTS:
+        return None
+
+    if faults['delay_ms'] > 0:
+        time.sleep(faults['delay_ms'] / 1000)
+
+    if random.random() < faults['fail_rate']:
+        print(f"Injected failure: {request.path} -> {faults['fail_status']}")
+        return jsonify({"error": "Injected failure"}), faults['fail_status']
+
+    return None
+
+@app.route('/faults', methods=['GET', 'POST'])
+def configure_faults():
+    """Show or change fault injection, e.g. POST /faults?delay_ms=2000&fail_rate=0.5"""
+    if request.method == 'POST':
+        for key, cast in (('delay_ms', int), ('fail_rate', float), ('fail_status', int)):
+            if key in request.args:
+                faults[key] = cast(request.args[key])
+        print(f"Faults: {faults}")
+    return jsonify(faults)
+
 @app.route('/api', methods=['POST'])
 def handle_device_control():
     """Handle device control requests from Arduino"""
@@ -164,11 +202,19 @@ def home():
     return html
 
 if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Smart Menu test server')
+    parser.add_argument('--delay-ms', type=int, default=0, help='Delay every device request by this many milliseconds')
+    parser.add_argument('--fail-rate', type=float, default=0.0, help='Share of device requests to fail, 0.0 to 1.0')
+    parser.add_argument('--fail-status', type=int, default=503, help='HTTP status used for injected failures')
+    args = parser.parse_args()
+    faults.update(delay_ms=args.delay_ms, fail_rate=args.fail_rate, fail_status=args.fail_status)
+
     print("Starting Smart Menu Server...")
     print("Device control endpoint: POST /api")
     print("Device states endpoint: GET /devices")
     print("Health check endpoint: GET /health")
+    print("Fault injection: GET/POST /faults")
     print("Web interface: GET /")
     
     # Run the server
-    app.run(host='0.0.0.0', port=5000, debug=True)
+    app.run(host='0.0.0.0', port=5000, debug=True, threaded=True)
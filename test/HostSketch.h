@@ -0,0 +1,54 @@
+#pragma once
+
+// Helpers for tests that run the whole sketch (knobble_sketch in
+// CMakeLists.txt): boot it like the board would and measure on the host.
+#include "SmartMenuSystem.h"
+#include "HostTest.h"
+#include <LittleFS.h>
+#include <esp_heap_caps.h>
+#include <chrono>
+
+void setup();
+void loop();
+
+// Boots the sketch with menuJson stored as the menu config, like the board
+// after a config upload. Wi-Fi connects unless the test set WiFi.hostStatus.
+inline void bootSketchWithMenu(const String &menuJson)
+{
+    File file = LittleFS.open(MENU_CONFIG_PATH, "w");
+    file.print(menuJson);
+    file.close();
+    setup();
+}
+
+// The default menu's devices and requests, with a backend at mainUrl
+inline String hostMenuJson(const char *mainUrl, const char *extraSettings = "")
+{
+    return String(R"({"menu": [
+        {"name": "Home", "submenus": [
+            {"name": "Living Room", "devices": [
+                {"name": "TV", "type": "onoff", "device_id": "tv1"},
+                {"name": "Light", "type": "onoff", "device_id": "light1"},
+                {"name": "Light Brightness", "type": "brightness", "device_id": "light_brightness1"},
+                {"name": "Light Color", "type": "color", "device_id": "light_color1"}]},
+            {"name": "Master Bedroom", "devices": [
+                {"name": "Light Toggle", "type": "onoff", "device_id": "bedroom_light1"}]}]},
+        {"name": "Requests", "actions": [
+            {"name": "Run Request 1", "url": "http://example.com/request1"},
+            {"name": "Run Request 2", "url": "http://example.com/request2"}]}],
+    "settings": {"wifi_ssid": "home", "wifi_password": "secret", "main_url": ")") +
+           mainUrl + "\"" + extraSettings + "}}";
+}
+
+inline void bootSketch(const char *mainUrl)
+{
+    bootSketchWithMenu(hostMenuJson(mainUrl));
+}
+
+// Host time, unaffected by the test clock
+inline uint64_t hostNowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+// Minimal checks for the host tests: a failed check is printed and counted,
+// and the test binary exits non-zero if any failed.
+#include <cstdio>
+#include <cstdlib>
+
+extern int hostTestFailures;
+
+#define CHECK(condition)                                                          \
+    do                                                                            \
+    {                                                                             \
+        if (!(condition))                                                         \
+        {                                                                         \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            hostTestFailures++;                                                   \
+        }                                                                         \
+    } while (0)
+
+#define CHECK_EQUAL(expected, actual)                                                    \
+    do                                                                                   \
+    {                                                                                    \
+        long long expectedValue = (long long)(expected);                                 \
+        long long actualValue = (long long)(actual);                                     \
+        if (expectedValue != actualValue)                                                \
+        {                                                                                \
+            printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual,    \
+                   actualValue, expectedValue);                                          \
+            hostTestFailures++;                                                          \
+        }                                                                                \
+    } while (0)
+
+#define RUN_TEST(test)        \
+    do                        \
+    {                         \
+        printf("%s\n", #test); \
+        test();               \
+    } while (0)
+
+// Benchmark results, one JSON object per line for scripts to pick up
+#define BENCH_RESULT(format, ...) printf("{\"bench\":" format "}\n", __VA_ARGS__)
+
+// Exits without running static destructors, the sketch's tasks are still
+// running and using them
+#define HOST_TEST_MAIN(tests)                                        \
+    int hostTestFailures = 0;                                        \
+    int main()                                                       \
+    {                                                                \
+        tests;                                                       \
+        printf("%d failed checks\n", hostTestFailures);              \
+        fflush(stdout);                                              \
+        _Exit(hostTestFailures == 0 ? 0 : 1);                        \
+    }
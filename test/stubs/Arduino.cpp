@@ -0,0 +1,49 @@
+#include "Arduino.h"
+#include <chrono>
+#include <thread>
+
+std::atomic<unsigned long> hostMillis(0);
+bool hostRealClock = false;
+uint32_t String::copies = 0;
+HostSerial Serial;
+HostBoard hostBoard;
+EspClass ESP;
+
+static const auto clockStart = std::chrono::steady_clock::now();
+static unsigned long realClockOffset = 0;
+static const bool serialEcho = getenv("KNOBBLE_SERIAL") != nullptr;
+
+static unsigned long elapsedMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - clockStart).count();
+}
+
+unsigned long hostRealMicros()
+{
+    return elapsedMicros() + realClockOffset;
+}
+
+void delay(unsigned long ms)
+{
+    if (hostRealClock)
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    else
+        hostMillis += ms;
+}
+
+// Switches millis() and micros() to the real clock, continuing from the test
+// clock so that timestamps taken before keep their order
+void hostUseRealClock()
+{
+    unsigned long testMicros = hostMillis.load() * 1000;
+    unsigned long elapsed = elapsedMicros();
+    realClockOffset = testMicros > elapsed ? testMicros - elapsed : 0;
+    hostRealClock = true;
+}
+
+size_t HostSerial::write(uint8_t c)
+{
+    if (serialEcho)
+        fputc(c, stdout);
+    return 1;
+}
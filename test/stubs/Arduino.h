@@ -0,0 +1,321 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino core, the ESP32 SDK and FreeRTOS
+// that the sketch uses. Single sketch files are tested against it, and the
+// host simulator (see CMakeLists.txt) builds the whole sketch on top of it.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+#define PROGMEM
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+
+class String
+{
+public:
+    // Counts String copies, so tests can check that code moves instead
+    static uint32_t copies;
+
+    String() {}
+    String(const char *text) : value(text != nullptr ? text : "") {}
+    String(const String &other) : value(other.value) { copies++; }
+    // Like the Arduino core, the move constructor is not noexcept
+    String(String &&other) : value(std::move(other.value)) {}
+    explicit String(char c) : value(1, c) {}
+    explicit String(int number) : value(std::to_string(number)) {}
+    explicit String(unsigned int number) : value(std::to_string(number)) {}
+    explicit String(long number) : value(std::to_string(number)) {}
+    explicit String(unsigned long number) : value(std::to_string(number)) {}
+
+    String &operator=(const String &other)
+    {
+        value = other.value;
+        copies++;
+        return *this;
+    }
+    String &operator=(String &&other)
+    {
+        value = std::move(other.value);
+        return *this;
+    }
+    String &operator=(const char *text)
+    {
+        value = text != nullptr ? text : "";
+        return *this;
+    }
+
+    const char *c_str() const { return value.c_str(); }
+    unsigned int length() const { return value.length(); }
+    bool reserve(unsigned int size)
+    {
+        value.reserve(size);
+        return true;
+    }
+    char operator[](unsigned int index) const { return index < value.length() ? value[index] : 0; }
+    long toInt() const { return strtol(value.c_str(), nullptr, 10); }
+    int indexOf(const char *text) const
+    {
+        size_t at = value.find(text);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+    bool startsWith(const char *text) const { return value.compare(0, strlen(text), text) == 0; }
+    String substring(unsigned int from) const { return from < value.length() ? value.substr(from).c_str() : ""; }
+    String substring(unsigned int from, unsigned int to) const
+    {
+        return from < to && from < value.length() ? value.substr(from, to - from).c_str() : "";
+    }
+
+    void toLowerCase()
+    {
+        for (auto &c : value)
+            c = tolower((unsigned char)c);
+    }
+    void toUpperCase()
+    {
+        for (auto &c : value)
+            c = toupper((unsigned char)c);
+    }
+    void replace(const char *find, const char *replacement)
+    {
+        size_t findLength = strlen(find);
+        size_t replacementLength = strlen(replacement);
+        if (findLength == 0)
+            return;
+        for (size_t at = value.find(find); at != std::string::npos; at = value.find(find, at + replacementLength))
+            value.replace(at, findLength, replacement);
+    }
+
+    bool operator==(const String &other) const { return value == other.value; }
+    bool operator==(const char *text) const { return value == text; }
+    bool operator!=(const String &other) const { return value != other.value; }
+    bool operator!=(const char *text) const { return value != text; }
+    bool operator<(const String &other) const { return value < other.value; }
+
+    String &operator+=(const String &other)
+    {
+        value += other.value;
+        return *this;
+    }
+    String &operator+=(const char *text)
+    {
+        value += text;
+        return *this;
+    }
+    bool concat(const char *text, unsigned int length)
+    {
+        value.append(text, length);
+        return true;
+    }
+    String &operator+=(char c)
+    {
+        value += c;
+        return *this;
+    }
+
+    friend String operator+(String left, const String &right) { return left += right; }
+    friend String operator+(String left, const char *right) { return left += right; }
+    friend String operator+(const char *left, const String &right) { return String(left) += right; }
+
+private:
+    std::string value;
+};
+
+// Test clock, advanced by the tests. Tests with worker threads switch to the
+// real clock instead; delay() then sleeps.
+extern std::atomic<unsigned long> hostMillis;
+extern bool hostRealClock;
+unsigned long hostRealMicros();
+inline unsigned long millis() { return hostRealClock ? hostRealMicros() / 1000 : hostMillis.load(); }
+inline unsigned long micros() { return hostRealClock ? hostRealMicros() : hostMillis.load() * 1000; }
+void delay(unsigned long ms);
+void hostUseRealClock();
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+inline size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t length = strlen(src);
+    if (size > 0)
+    {
+        size_t copy = length < size - 1 ? length : size - 1;
+        memcpy(dst, src, copy);
+        dst[copy] = '\0';
+    }
+    return length;
+}
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *data, size_t size)
+    {
+        size_t written = 0;
+        for (size_t i = 0; i < size; i++)
+            written += write(data[i]);
+        return written;
+    }
+
+    size_t write(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+    size_t print(const char *text) { return write(text); }
+    size_t print(const String &text) { return write((const uint8_t *)text.c_str(), text.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int number) { return printf("%d", number); }
+    size_t print(unsigned int number) { return printf("%u", number); }
+    size_t print(long number) { return printf("%ld", number); }
+    size_t print(unsigned long number) { return printf("%lu", number); }
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(const T &value)
+    {
+        size_t written = print(value);
+        return written + println();
+    }
+
+    size_t printf(const char *format, ...)
+    {
+        char buffer[256];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if (length < 0)
+            return 0;
+        return write((const uint8_t *)buffer, min((size_t)length, sizeof(buffer) - 1));
+    }
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    size_t write(uint8_t) override { return 0; }
+    using Print::write;
+
+    size_t readBytes(char *buffer, size_t length)
+    {
+        size_t count = 0;
+        while (count < length && available() > 0)
+            buffer[count++] = (char)read();
+        return count;
+    }
+};
+
+// Serial output is dropped unless KNOBBLE_SERIAL is set in the environment
+class HostSerial : public Print
+{
+public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override;
+    using Print::write;
+};
+extern HostSerial Serial;
+
+// Pins and clock speed the sketch set last, for the tests to look at
+struct HostBoard
+{
+    uint32_t cpuMhz = 160;
+    int digital[32] = {};
+    int analog[32] = {};
+    uint32_t restarts = 0;
+};
+extern HostBoard hostBoard;
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t pin, uint8_t level) { hostBoard.digital[pin & 31] = level; }
+inline int digitalRead(uint8_t pin) { return hostBoard.digital[pin & 31]; }
+inline void analogWrite(uint8_t pin, int value) { hostBoard.analog[pin & 31] = value; }
+inline bool setCpuFrequencyMhz(uint32_t mhz)
+{
+    hostBoard.cpuMhz = mhz;
+    return true;
+}
+
+typedef enum
+{
+    GPIO_NUM_0 = 0,
+    GPIO_NUM_6 = 6,
+    GPIO_NUM_7 = 7,
+    GPIO_NUM_9 = 9
+} gpio_num_t;
+
+class EspClass
+{
+public:
+    void restart() { hostBoard.restarts++; }
+    uint32_t getFreeHeap();
+};
+extern EspClass ESP;
+
+// FreeRTOS. Queues, mutexes and notifications work across threads (see
+// FreeRTOS.cpp); ticks are milliseconds.
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef struct HostTask *TaskHandle_t;
+typedef struct HostQueue *QueueHandle_t;
+typedef struct HostMutex *SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define portMAX_DELAY 0xFFFFFFFF
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portTICK_PERIOD_MS 1
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+const char *pcTaskGetName(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticksToWait);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticksToWait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex);
+
+struct portMUX_TYPE
+{
+    std::atomic_flag locked = ATOMIC_FLAG_INIT;
+};
+#define portMUX_INITIALIZER_UNLOCKED \
+    {                                \
+    }
+inline void portENTER_CRITICAL(portMUX_TYPE *mux)
+{
+    while (mux->locked.test_and_set(std::memory_order_acquire))
+    {
+    }
+}
+inline void portEXIT_CRITICAL(portMUX_TYPE *mux) { mux->locked.clear(std::memory_order_release); }
@@ -0,0 +1,1344 @@
+#pragma once
+
+// Host stand-in for ArduinoJson 6: the part of its API the sketch uses, with
+// the same memory model. A document gets one block of memory when it is
+// created and every value, member and copied string is carved out of it;
+// const char * keys and values are stored by pointer, String and parsed text
+// is copied, equal copies are stored once. Slots hold 64-bit pointers here,
+// so the block is larger than the capacity asked for, but it is counted
+// like on the 32-bit target (16 bytes a slot) and overflows where that
+// would.
+#include "Arduino.h"
+#include <limits>
+#include <new>
+#include <type_traits>
+
+class JsonDocument;
+class JsonObject;
+class JsonArray;
+class JsonVariant;
+
+namespace HostJson
+{
+static const size_t TARGET_SLOT_SIZE = 16;
+static const size_t HOST_SIZE_FACTOR = 3;
+static const int NESTING_LIMIT = 10;
+
+enum Type : uint8_t
+{
+    TYPE_NULL,
+    TYPE_BOOL,
+    TYPE_SIGNED,
+    TYPE_UNSIGNED,
+    TYPE_FLOAT,
+    TYPE_STRING,
+    TYPE_ARRAY,
+    TYPE_OBJECT
+};
+
+struct Slot;
+
+struct Value
+{
+    Type type = TYPE_NULL;
+    union
+    {
+        bool boolean;
+        int64_t integer;
+        uint64_t uinteger;
+        double real;
+        const char *text;
+        struct
+        {
+            Slot *head;
+            Slot *tail;
+        } list;
+    };
+
+    Value() : integer(0) {}
+};
+
+struct Slot
+{
+    Value value;
+    const char *key;
+    Slot *next;
+};
+
+// One block, slots and strings bump allocated from the front
+struct Pool
+{
+    uint8_t *block = nullptr;
+    size_t blockSize = 0;
+    size_t blockUsed = 0;
+    size_t capacity = 0;
+    size_t used = 0; // As counted on the target
+    bool overflowed = false;
+
+    void *allocate(size_t hostSize, size_t targetSize, size_t alignment)
+    {
+        size_t start = (blockUsed + alignment - 1) & ~(alignment - 1);
+        if (used + targetSize > capacity || start + hostSize > blockSize)
+        {
+            overflowed = true;
+            return nullptr;
+        }
+        blockUsed = start + hostSize;
+        used += targetSize;
+        return block + start;
+    }
+
+    Slot *newSlot()
+    {
+        Slot *slot = (Slot *)allocate(sizeof(Slot), TARGET_SLOT_SIZE, alignof(Slot));
+        if (slot != nullptr)
+            new (slot) Slot();
+        return slot;
+    }
+
+    // Copies a string into the pool, or finds an equal one already there
+    const char *saveString(const char *text, size_t length)
+    {
+        for (size_t at = 0; at < strings.size(); at++)
+        {
+            const char *saved = strings[at];
+            if (strncmp(saved, text, length) == 0 && saved[length] == '\0')
+                return saved;
+        }
+        char *copy = (char *)allocate(length + 1, length + 1, 1);
+        if (copy == nullptr)
+            return nullptr;
+        memcpy(copy, text, length);
+        copy[length] = '\0';
+        rememberString(copy);
+        return copy;
+    }
+
+    void clear()
+    {
+        blockUsed = 0;
+        used = 0;
+        overflowed = false;
+        stringCount = 0;
+    }
+
+    // Saved strings, kept in the block itself behind a small index that
+    // lives in the last part of the block
+    struct StringList
+    {
+        Pool *pool;
+        size_t size() const { return pool->stringCount; }
+        const char *operator[](size_t at) const { return pool->stringIndex()[at]; }
+    };
+    StringList strings{this};
+    size_t stringCount = 0;
+    size_t stringSlots = 0;
+
+    const char **stringIndex() { return (const char **)(block + blockSize); }
+    void rememberString(const char *text)
+    {
+        if (stringCount < stringSlots)
+            stringIndex()[stringCount++] = text;
+    }
+};
+
+inline void setNull(Value &value)
+{
+    value.type = TYPE_NULL;
+    value.integer = 0;
+}
+
+inline void setList(Value &value, Type type)
+{
+    value.type = type;
+    value.list.head = nullptr;
+    value.list.tail = nullptr;
+}
+
+inline Slot *append(Pool &pool, Value &list, const char *key)
+{
+    Slot *slot = pool.newSlot();
+    if (slot == nullptr)
+        return nullptr;
+    slot->key = key;
+    if (list.list.tail == nullptr)
+        list.list.head = slot;
+    else
+        list.list.tail->next = slot;
+    list.list.tail = slot;
+    return slot;
+}
+
+inline Slot *findMember(const Value *object, const char *key)
+{
+    if (object == nullptr || object->type != TYPE_OBJECT || key == nullptr)
+        return nullptr;
+    for (Slot *slot = object->list.head; slot != nullptr; slot = slot->next)
+    {
+        if (strcmp(slot->key, key) == 0)
+            return slot;
+    }
+    return nullptr;
+}
+
+inline size_t listSize(const Value *value)
+{
+    if (value == nullptr || (value->type != TYPE_ARRAY && value->type != TYPE_OBJECT))
+        return 0;
+    size_t count = 0;
+    for (Slot *slot = value->list.head; slot != nullptr; slot = slot->next)
+        count++;
+    return count;
+}
+
+// Writers for serializeJson()
+struct Writer
+{
+    virtual void write(const char *data, size_t length) = 0;
+    size_t written = 0;
+    void write(const char *text) { write(text, strlen(text)); }
+};
+
+struct BufferWriter : Writer
+{
+    char *buffer;
+    size_t size;
+    BufferWriter(char *buffer, size_t size) : buffer(buffer), size(size) {}
+    void write(const char *data, size_t length) override
+    {
+        size_t room = size > written + 1 ? size - written - 1 : 0;
+        size_t copy = length < room ? length : room;
+        memcpy(buffer + written, data, copy);
+        written += copy;
+    }
+};
+
+struct PrintWriter : Writer
+{
+    Print &out;
+    explicit PrintWriter(Print &out) : out(out) {}
+    void write(const char *data, size_t length) override { written += out.write((const uint8_t *)data, length); }
+};
+
+struct CountingWriter : Writer
+{
+    void write(const char *, size_t length) override { written += length; }
+};
+
+struct StringWriter : Writer
+{
+    String &out;
+    explicit StringWriter(String &out) : out(out) {}
+    void write(const char *data, size_t length) override
+    {
+        std::string text(data, length);
+        out += text.c_str();
+        written += length;
+    }
+};
+
+inline void writeString(Writer &out, const char *text)
+{
+    out.write("\"", 1);
+    for (const char *c = text; *c != '\0'; c++)
+    {
+        switch (*c)
+        {
+        case '"': out.write("\\\"", 2); break;
+        case '\\': out.write("\\\\", 2); break;
+        case '\b': out.write("\\b", 2); break;
+        case '\f': out.write("\\f", 2); break;
+        case '\n': out.write("\\n", 2); break;
+        case '\r': out.write("\\r", 2); break;
+        case '\t': out.write("\\t", 2); break;
+        default:
+            if ((unsigned char)*c < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)*c);
+                out.write(escaped, 6);
+            }
+            else
+            {
+                out.write(c, 1);
+            }
+        }
+    }
+    out.write("\"", 1);
+}
+
+inline void writeValue(Writer &out, const Value *value)
+{
+    char number[32];
+    switch (value == nullptr ? TYPE_NULL : value->type)
+    {
+    case TYPE_NULL:
+        out.write("null");
+        break;
+    case TYPE_BOOL:
+        out.write(value->boolean ? "true" : "false");
+        break;
+    case TYPE_SIGNED:
+        snprintf(number, sizeof(number), "%lld", (long long)value->integer);
+        out.write(number);
+        break;
+    case TYPE_UNSIGNED:
+        snprintf(number, sizeof(number), "%llu", (unsigned long long)value->uinteger);
+        out.write(number);
+        break;
+    case TYPE_FLOAT:
+        if (std::isfinite(value->real))
+            snprintf(number, sizeof(number), "%.9g", value->real);
+        else
+            strlcpy(number, "null", sizeof(number));
+        out.write(number);
+        break;
+    case TYPE_STRING:
+        writeString(out, value->text);
+        break;
+    case TYPE_ARRAY:
+    case TYPE_OBJECT:
+    {
+        bool object = value->type == TYPE_OBJECT;
+        out.write(object ? "{" : "[", 1);
+        for (Slot *slot = value->list.head; slot != nullptr; slot = slot->next)
+        {
+            if (slot != value->list.head)
+                out.write(",", 1);
+            if (object)
+            {
+                writeString(out, slot->key);
+                out.write(":", 1);
+            }
+            writeValue(out, &slot->value);
+        }
+        out.write(object ? "}" : "]", 1);
+        break;
+    }
+    }
+}
+
+// Readers for deserializeJson(), one character of look-ahead
+struct Reader
+{
+    virtual int read() = 0; // -1 at the end
+    int current = -2;
+    int peek()
+    {
+        if (current == -2)
+            current = read();
+        return current;
+    }
+    int next()
+    {
+        int c = peek();
+        current = -2;
+        return c;
+    }
+};
+
+struct MemoryReader : Reader
+{
+    const char *data;
+    size_t length;
+    size_t at = 0;
+    MemoryReader(const char *data, size_t length) : data(data), length(length) {}
+    int read() override { return at < length ? (unsigned char)data[at++] : -1; }
+};
+
+struct StreamReader : Reader
+{
+    Stream &in;
+    explicit StreamReader(Stream &in) : in(in) {}
+    int read() override { return in.available() > 0 ? in.read() : -1; }
+};
+} // namespace HostJson
+
+class DeserializationError
+{
+public:
+    enum Code
+    {
+        Ok,
+        EmptyInput,
+        IncompleteInput,
+        InvalidInput,
+        NoMemory,
+        TooDeep
+    };
+
+    DeserializationError() : value(Ok) {}
+    DeserializationError(Code code) : value(code) {}
+    explicit operator bool() const { return value != Ok; }
+    bool operator==(Code code) const { return value == code; }
+    bool operator!=(Code code) const { return value != code; }
+    Code code() const { return value; }
+
+    const char *c_str() const
+    {
+        static const char *const names[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory", "TooDeep"};
+        return names[value];
+    }
+
+private:
+    Code value;
+};
+
+class JsonString
+{
+public:
+    explicit JsonString(const char *text) : text(text) {}
+    const char *c_str() const { return text; }
+
+private:
+    const char *text;
+};
+
+// A value in a document. Members that do not exist yet are created when
+// written to, like ArduinoJson's member proxies.
+class JsonVariant
+{
+public:
+    JsonVariant() {}
+    JsonVariant(HostJson::Pool *pool, HostJson::Value *data) : pool(pool), data(data) {}
+    JsonVariant(HostJson::Pool *pool, HostJson::Value *object, const char *key)
+        : pool(pool), data(nullptr), owner(object), key(key)
+    {
+        HostJson::Slot *slot = HostJson::findMember(object, key);
+        if (slot != nullptr)
+            data = &slot->value;
+    }
+
+    bool isNull() const { return data == nullptr || data->type == HostJson::TYPE_NULL; }
+
+    JsonVariant &operator=(bool value)
+    {
+        if (HostJson::Value *target = resolve())
+        {
+            target->type = HostJson::TYPE_BOOL;
+            target->boolean = value;
+        }
+        return *this;
+    }
+    JsonVariant &operator=(int value) { return setSigned(value); }
+    JsonVariant &operator=(long value) { return setSigned(value); }
+    JsonVariant &operator=(long long value) { return setSigned(value); }
+    JsonVariant &operator=(unsigned int value) { return setUnsigned(value); }
+    JsonVariant &operator=(unsigned long value) { return setUnsigned(value); }
+    JsonVariant &operator=(unsigned long long value) { return setUnsigned(value); }
+    JsonVariant &operator=(float value) { return operator=((double)value); }
+    JsonVariant &operator=(double value)
+    {
+        if (HostJson::Value *target = resolve())
+        {
+            target->type = HostJson::TYPE_FLOAT;
+            target->real = value;
+        }
+        return *this;
+    }
+    // Linked, not copied
+    JsonVariant &operator=(const char *value)
+    {
+        if (value == nullptr)
+            return setNullValue();
+        if (HostJson::Value *target = resolve())
+        {
+            target->type = HostJson::TYPE_STRING;
+            target->text = value;
+        }
+        return *this;
+    }
+    JsonVariant &operator=(char *value) { return copyString(value, value != nullptr ? strlen(value) : 0, value == nullptr); }
+    JsonVariant &operator=(const String &value) { return copyString(value.c_str(), value.length(), false); }
+    JsonVariant &operator=(const JsonVariant &other)
+    {
+        if (other.data == nullptr)
+            return setNullValue();
+        if (HostJson::Value *target = resolve())
+            *target = *other.data;
+        return *this;
+    }
+
+    template <typename T>
+    bool is() const;
+    template <typename T>
+    T as() const;
+
+    template <typename T>
+    T operator|(const T &fallback) const
+    {
+        return is<T>() ? as<T>() : fallback;
+    }
+    const char *operator|(const char *fallback) const;
+
+    JsonVariant operator[](const char *member) const { return JsonVariant(pool, data, member); }
+    JsonVariant operator[](size_t index) const
+    {
+        if (data == nullptr || data->type != HostJson::TYPE_ARRAY)
+            return JsonVariant();
+        HostJson::Slot *slot = data->list.head;
+        for (size_t i = 0; slot != nullptr && i < index; i++)
+            slot = slot->next;
+        return slot != nullptr ? JsonVariant(pool, &slot->value) : JsonVariant();
+    }
+    JsonVariant operator[](int index) const { return operator[]((size_t)index); }
+
+    bool containsKey(const char *member) const { return HostJson::findMember(data, member) != nullptr; }
+    size_t size() const { return HostJson::listSize(data); }
+
+    operator JsonObject() const;
+    operator JsonArray() const;
+
+    HostJson::Pool *hostPool() const { return pool; }
+    HostJson::Value *hostData() const { return data; }
+
+protected:
+    HostJson::Pool *pool = nullptr;
+    HostJson::Value *data = nullptr;
+    HostJson::Value *owner = nullptr; // Object the member is added to on write
+    const char *key = nullptr;
+
+    // Creates the member on the first write, nullptr if there is no room
+    HostJson::Value *resolve()
+    {
+        if (data != nullptr || owner == nullptr || pool == nullptr)
+            return data;
+        if (owner->type == HostJson::TYPE_NULL)
+            HostJson::setList(*owner, HostJson::TYPE_OBJECT);
+        if (owner->type != HostJson::TYPE_OBJECT)
+            return nullptr;
+        HostJson::Slot *slot = HostJson::append(*pool, *owner, key);
+        if (slot != nullptr)
+            data = &slot->value;
+        return data;
+    }
+
+    JsonVariant &setSigned(long long value)
+    {
+        if (HostJson::Value *target = resolve())
+        {
+            target->type = HostJson::TYPE_SIGNED;
+            target->integer = value;
+        }
+        return *this;
+    }
+
+    JsonVariant &setUnsigned(unsigned long long value)
+    {
+        if (HostJson::Value *target = resolve())
+        {
+            target->type = HostJson::TYPE_UNSIGNED;
+            target->uinteger = value;
+        }
+        return *this;
+    }
+
+    JsonVariant &setNullValue()
+    {
+        if (HostJson::Value *target = resolve())
+            HostJson::setNull(*target);
+        return *this;
+    }
+
+    JsonVariant &copyString(const char *text, size_t length, bool null)
+    {
+        if (null)
+            return setNullValue();
+        HostJson::Value *target = resolve();
+        if (target == nullptr)
+            return *this;
+        const char *copy = pool->saveString(text, length);
+        if (copy == nullptr)
+        {
+            HostJson::setNull(*target);
+            return *this;
+        }
+        target->type = HostJson::TYPE_STRING;
+        target->text = copy;
+        return *this;
+    }
+};
+
+class JsonPair
+{
+public:
+    JsonPair(HostJson::Pool *pool, HostJson::Slot *slot) : pool(pool), slot(slot) {}
+    JsonString key() const { return JsonString(slot->key); }
+    JsonVariant value() const { return JsonVariant(pool, &slot->value); }
+
+private:
+    HostJson::Pool *pool;
+    HostJson::Slot *slot;
+};
+
+// Iterates the slots of an array (as variants) or an object (as pairs)
+template <typename Item>
+class JsonIterator
+{
+public:
+    JsonIterator(HostJson::Pool *pool, HostJson::Slot *slot) : pool(pool), slot(slot) {}
+    Item operator*() const { return make(); }
+    JsonIterator &operator++()
+    {
+        slot = slot->next;
+        return *this;
+    }
+    bool operator!=(const JsonIterator &other) const { return slot != other.slot; }
+
+private:
+    HostJson::Pool *pool;
+    HostJson::Slot *slot;
+
+    Item make() const;
+};
+
+template <>
+inline JsonVariant JsonIterator<JsonVariant>::make() const
+{
+    return JsonVariant(pool, &slot->value);
+}
+
+template <>
+inline JsonPair JsonIterator<JsonPair>::make() const
+{
+    return JsonPair(pool, slot);
+}
+
+class JsonObject
+{
+public:
+    JsonObject() {}
+    JsonObject(HostJson::Pool *pool, HostJson::Value *data)
+        : pool(pool), data(data != nullptr && data->type == HostJson::TYPE_OBJECT ? data : nullptr) {}
+
+    bool isNull() const { return data == nullptr; }
+    size_t size() const { return HostJson::listSize(data); }
+    JsonVariant operator[](const char *member) const { return JsonVariant(pool, data, member); }
+    bool containsKey(const char *member) const { return HostJson::findMember(data, member) != nullptr; }
+
+    JsonIterator<JsonPair> begin() const
+    {
+        return JsonIterator<JsonPair>(pool, data != nullptr ? data->list.head : nullptr);
+    }
+    JsonIterator<JsonPair> end() const { return JsonIterator<JsonPair>(pool, nullptr); }
+
+    JsonObject createNestedObject(const char *member) const;
+    JsonArray createNestedArray(const char *member) const;
+
+    HostJson::Pool *hostPool() const { return pool; }
+    HostJson::Value *hostData() const { return data; }
+
+private:
+    HostJson::Pool *pool = nullptr;
+    HostJson::Value *data = nullptr;
+};
+
+class JsonArray
+{
+public:
+    JsonArray() {}
+    JsonArray(HostJson::Pool *pool, HostJson::Value *data)
+        : pool(pool), data(data != nullptr && data->type == HostJson::TYPE_ARRAY ? data : nullptr) {}
+
+    bool isNull() const { return data == nullptr; }
+    size_t size() const { return HostJson::listSize(data); }
+    JsonVariant operator[](size_t index) const { return JsonVariant(pool, data)[index]; }
+
+    JsonIterator<JsonVariant> begin() const
+    {
+        return JsonIterator<JsonVariant>(pool, data != nullptr ? data->list.head : nullptr);
+    }
+    JsonIterator<JsonVariant> end() const { return JsonIterator<JsonVariant>(pool, nullptr); }
+
+    // Returns a null variant if the document is full
+    JsonVariant add() const
+    {
+        if (data == nullptr)
+            return JsonVariant();
+        HostJson::Slot *slot = HostJson::append(*pool, *data, nullptr);
+        return slot != nullptr ? JsonVariant(pool, &slot->value) : JsonVariant();
+    }
+    template <typename T>
+    bool add(const T &value) const
+    {
+        JsonVariant item = add();
+        if (item.hostData() == nullptr)
+            return false;
+        item = value;
+        return true;
+    }
+
+    JsonObject createNestedObject() const
+    {
+        JsonVariant item = add();
+        if (item.hostData() == nullptr)
+            return JsonObject();
+        HostJson::setList(*item.hostData(), HostJson::TYPE_OBJECT);
+        return JsonObject(pool, item.hostData());
+    }
+    JsonArray createNestedArray() const
+    {
+        JsonVariant item = add();
+        if (item.hostData() == nullptr)
+            return JsonArray();
+        HostJson::setList(*item.hostData(), HostJson::TYPE_ARRAY);
+        return JsonArray(pool, item.hostData());
+    }
+
+    HostJson::Pool *hostPool() const { return pool; }
+    HostJson::Value *hostData() const { return data; }
+
+private:
+    HostJson::Pool *pool = nullptr;
+    HostJson::Value *data = nullptr;
+};
+
+inline JsonVariant::operator JsonObject() const { return JsonObject(pool, data); }
+inline JsonVariant::operator JsonArray() const { return JsonArray(pool, data); }
+
+// Adds member to the object, or finds it, and makes it an empty list
+inline HostJson::Value *nestedList(HostJson::Pool *pool, HostJson::Value *object, const char *member, HostJson::Type type)
+{
+    if (object == nullptr)
+        return nullptr;
+    HostJson::Slot *slot = HostJson::findMember(object, member);
+    if (slot == nullptr)
+        slot = HostJson::append(*pool, *object, member);
+    if (slot == nullptr)
+        return nullptr;
+    HostJson::setList(slot->value, type);
+    return &slot->value;
+}
+
+inline JsonObject JsonObject::createNestedObject(const char *member) const
+{
+    return JsonObject(pool, nestedList(pool, data, member, HostJson::TYPE_OBJECT));
+}
+
+inline JsonArray JsonObject::createNestedArray(const char *member) const
+{
+    return JsonArray(pool, nestedList(pool, data, member, HostJson::TYPE_ARRAY));
+}
+
+template <typename T>
+struct HostJsonNumber
+{
+    static bool is(const HostJson::Value *value)
+    {
+        if (value == nullptr)
+            return false;
+        if (value->type == HostJson::TYPE_SIGNED)
+            return value->integer >= (int64_t)std::numeric_limits<T>::lowest() &&
+                   (value->integer < 0 || (uint64_t)value->integer <= (uint64_t)std::numeric_limits<T>::max());
+        if (value->type == HostJson::TYPE_UNSIGNED)
+            return value->uinteger <= (uint64_t)std::numeric_limits<T>::max();
+        return false;
+    }
+
+    static T as(const HostJson::Value *value)
+    {
+        if (value == nullptr)
+            return 0;
+        switch (value->type)
+        {
+        case HostJson::TYPE_BOOL: return value->boolean ? 1 : 0;
+        case HostJson::TYPE_SIGNED: return (T)value->integer;
+        case HostJson::TYPE_UNSIGNED: return (T)value->uinteger;
+        case HostJson::TYPE_FLOAT: return (T)value->real;
+        default: return 0;
+        }
+    }
+};
+
+
+template <typename T>
+inline bool JsonVariant::is() const
+{
+    return HostJsonNumber<T>::is(data);
+}
+
+template <>
+inline bool JsonVariant::is<bool>() const
+{
+    return data != nullptr && data->type == HostJson::TYPE_BOOL;
+}
+
+template <>
+inline bool JsonVariant::is<double>() const
+{
+    return data != nullptr && (data->type == HostJson::TYPE_FLOAT || data->type == HostJson::TYPE_SIGNED ||
+                               data->type == HostJson::TYPE_UNSIGNED);
+}
+
+template <>
+inline bool JsonVariant::is<float>() const
+{
+    return is<double>();
+}
+
+template <>
+inline bool JsonVariant::is<const char *>() const
+{
+    return data != nullptr && data->type == HostJson::TYPE_STRING;
+}
+
+template <>
+inline bool JsonVariant::is<String>() const
+{
+    return is<const char *>();
+}
+
+template <>
+inline bool JsonVariant::is<JsonObject>() const
+{
+    return data != nullptr && data->type == HostJson::TYPE_OBJECT;
+}
+
+template <>
+inline bool JsonVariant::is<JsonArray>() const
+{
+    return data != nullptr && data->type == HostJson::TYPE_ARRAY;
+}
+
+template <typename T>
+inline T JsonVariant::as() const
+{
+    return HostJsonNumber<T>::as(data);
+}
+
+template <>
+inline bool JsonVariant::as<bool>() const
+{
+    if (data == nullptr)
+        return false;
+    switch (data->type)
+    {
+    case HostJson::TYPE_BOOL: return data->boolean;
+    case HostJson::TYPE_SIGNED: return data->integer != 0;
+    case HostJson::TYPE_UNSIGNED: return data->uinteger != 0;
+    case HostJson::TYPE_FLOAT: return data->real != 0;
+    default: return false;
+    }
+}
+
+template <>
+inline double JsonVariant::as<double>() const
+{
+    return HostJsonNumber<double>::as(data);
+}
+
+template <>
+inline float JsonVariant::as<float>() const
+{
+    return (float)as<double>();
+}
+
+template <>
+inline const char *JsonVariant::as<const char *>() const
+{
+    return is<const char *>() ? data->text : nullptr;
+}
+
+inline const char *JsonVariant::operator|(const char *fallback) const
+{
+    return is<const char *>() ? as<const char *>() : fallback;
+}
+
+// Strings as they are, anything else serialized, like ArduinoJson 6
+template <>
+inline String JsonVariant::as<String>() const
+{
+    if (is<const char *>())
+        return String(data->text);
+    String text;
+    HostJson::StringWriter writer(text);
+    HostJson::writeValue(writer, data);
+    return text;
+}
+
+template <>
+inline JsonObject JsonVariant::as<JsonObject>() const
+{
+    return JsonObject(pool, data);
+}
+
+template <>
+inline JsonArray JsonVariant::as<JsonArray>() const
+{
+    return JsonArray(pool, data);
+}
+
+template <>
+inline JsonVariant JsonVariant::as<JsonVariant>() const
+{
+    return *this;
+}
+
+class JsonDocument
+{
+public:
+    JsonDocument(const JsonDocument &) = delete;
+    JsonDocument &operator=(const JsonDocument &) = delete;
+
+    JsonVariant operator[](const char *member) { return JsonVariant(&pool, &root, member); }
+    JsonVariant operator[](size_t index) { return JsonVariant(&pool, &root)[index]; }
+    bool containsKey(const char *member) const { return HostJson::findMember(&root, member) != nullptr; }
+    size_t size() const { return HostJson::listSize(&root); }
+    bool isNull() const { return root.type == HostJson::TYPE_NULL; }
+
+    template <typename T>
+    bool is() const
+    {
+        return JsonVariant(const_cast<HostJson::Pool *>(&pool), const_cast<HostJson::Value *>(&root)).is<T>();
+    }
+    template <typename T>
+    T as()
+    {
+        return JsonVariant(&pool, &root).as<T>();
+    }
+    template <typename T>
+    T to()
+    {
+        clear();
+        HostJson::setList(root, std::is_same<T, JsonArray>::value ? HostJson::TYPE_ARRAY : HostJson::TYPE_OBJECT);
+        return JsonVariant(&pool, &root).as<T>();
+    }
+
+    JsonObject createNestedObject(const char *member) { return asObject().createNestedObject(member); }
+    JsonArray createNestedArray(const char *member) { return asObject().createNestedArray(member); }
+
+    operator JsonVariant() { return JsonVariant(&pool, &root); }
+
+    void clear()
+    {
+        pool.clear();
+        HostJson::setNull(root);
+    }
+    bool overflowed() const { return pool.overflowed; }
+    size_t memoryUsage() const { return pool.used; }
+    size_t capacity() const { return pool.capacity; }
+
+    HostJson::Pool &hostPool() { return pool; }
+    HostJson::Value &hostRoot() { return root; }
+    const HostJson::Value &hostRoot() const { return root; }
+
+protected:
+    JsonDocument() {}
+
+    HostJson::Pool pool;
+    HostJson::Value root;
+
+    // Host bytes for a capacity counted on the target, plus the string index
+    static size_t blockSizeFor(size_t capacity) { return capacity * HostJson::HOST_SIZE_FACTOR; }
+    static size_t indexSizeFor(size_t capacity) { return (capacity / 2 + 1) * sizeof(const char *); }
+
+    void attach(uint8_t *block, size_t capacity)
+    {
+        pool.block = block;
+        pool.blockSize = blockSizeFor(capacity);
+        pool.capacity = capacity;
+        pool.stringSlots = capacity / 2 + 1;
+        clear();
+    }
+
+private:
+    JsonObject asObject()
+    {
+        if (root.type == HostJson::TYPE_NULL)
+            HostJson::setList(root, HostJson::TYPE_OBJECT);
+        return JsonObject(&pool, &root);
+    }
+};
+
+// Allocates its memory once, in the constructor
+class DynamicJsonDocument : public JsonDocument
+{
+public:
+    explicit DynamicJsonDocument(size_t capacity) { allocate(capacity); }
+    DynamicJsonDocument(DynamicJsonDocument &&other) { take(other); }
+    ~DynamicJsonDocument() { release(); }
+
+    DynamicJsonDocument &operator=(DynamicJsonDocument &&other)
+    {
+        if (this != &other)
+        {
+            release();
+            take(other);
+        }
+        return *this;
+    }
+
+private:
+    void allocate(size_t capacity)
+    {
+        uint8_t *block = capacity > 0 ? new uint8_t[blockSizeFor(capacity) + indexSizeFor(capacity)] : nullptr;
+        attach(block, block != nullptr ? capacity : 0);
+    }
+
+    void release()
+    {
+        delete[] pool.block;
+        pool.block = nullptr;
+    }
+
+    void take(DynamicJsonDocument &other)
+    {
+        pool = other.pool;
+        pool.strings.pool = &pool;
+        root = other.root;
+        other.pool = HostJson::Pool();
+        other.pool.strings.pool = &other.pool;
+        HostJson::setNull(other.root);
+    }
+};
+
+template <size_t CAPACITY>
+class StaticJsonDocument : public JsonDocument
+{
+public:
+    StaticJsonDocument() { attach(block, CAPACITY); }
+
+private:
+    alignas(8) uint8_t block[CAPACITY * HostJson::HOST_SIZE_FACTOR + (CAPACITY / 2 + 1) * sizeof(const char *)];
+};
+
+namespace HostJson
+{
+inline const Value *rootOf(const JsonDocument &doc) { return &doc.hostRoot(); }
+inline const Value *rootOf(const JsonObject &object) { return object.hostData(); }
+inline const Value *rootOf(const JsonArray &array) { return array.hostData(); }
+inline const Value *rootOf(const JsonVariant &variant) { return variant.hostData(); }
+
+class Parser
+{
+public:
+    Parser(Reader &in, Pool &pool) : in(in), pool(pool) {}
+
+    DeserializationError parse(Value &root)
+    {
+        skipSpace();
+        if (in.peek() == -1)
+            return DeserializationError::EmptyInput;
+        return parseValue(root, 0);
+    }
+
+private:
+    Reader &in;
+    Pool &pool;
+    std::string text; // Scratch space for the string being read
+
+    void skipSpace()
+    {
+        while (in.peek() == ' ' || in.peek() == '\n' || in.peek() == '\r' || in.peek() == '\t')
+            in.next();
+    }
+
+    DeserializationError parseValue(Value &value, int depth)
+    {
+        skipSpace();
+        int c = in.peek();
+        switch (c)
+        {
+        case -1:
+            return DeserializationError::IncompleteInput;
+        case '{':
+        case '[':
+            if (depth >= NESTING_LIMIT)
+                return DeserializationError::TooDeep;
+            return c == '{' ? parseObject(value, depth + 1) : parseArray(value, depth + 1);
+        case '"':
+        {
+            const char *saved;
+            DeserializationError error = parseString(saved);
+            if (error)
+                return error;
+            value.type = TYPE_STRING;
+            value.text = saved;
+            return DeserializationError::Ok;
+        }
+        case 't':
+            value.type = TYPE_BOOL;
+            value.boolean = true;
+            return expectWord("true");
+        case 'f':
+            value.type = TYPE_BOOL;
+            value.boolean = false;
+            return expectWord("false");
+        case 'n':
+            setNull(value);
+            return expectWord("null");
+        default:
+            return parseNumber(value);
+        }
+    }
+
+    DeserializationError expectWord(const char *word)
+    {
+        for (const char *c = word; *c != '\0'; c++)
+        {
+            int next = in.next();
+            if (next == -1)
+                return DeserializationError::IncompleteInput;
+            if (next != *c)
+                return DeserializationError::InvalidInput;
+        }
+        return DeserializationError::Ok;
+    }
+
+    DeserializationError parseNumber(Value &value)
+    {
+        char number[64];
+        size_t length = 0;
+        bool real = false;
+        for (int c = in.peek(); c != -1 && (isdigit(c) || strchr("+-.eE", c) != nullptr); c = in.peek())
+        {
+            if (length == sizeof(number) - 1)
+                return DeserializationError::InvalidInput;
+            real = real || !isdigit(c) && c != '-';
+            number[length++] = (char)in.next();
+        }
+        number[length] = '\0';
+        if (length == 0)
+            return DeserializationError::InvalidInput;
+
+        char *end;
+        if (real)
+        {
+            value.type = TYPE_FLOAT;
+            value.real = strtod(number, &end);
+        }
+        else if (number[0] == '-')
+        {
+            value.type = TYPE_SIGNED;
+            value.integer = strtoll(number, &end, 10);
+        }
+        else
+        {
+            uint64_t parsed = strtoull(number, &end, 10);
+            if (parsed <= (uint64_t)INT64_MAX)
+            {
+                value.type = TYPE_SIGNED;
+                value.integer = (int64_t)parsed;
+            }
+            else
+            {
+                value.type = TYPE_UNSIGNED;
+                value.uinteger = parsed;
+            }
+        }
+        return *end == '\0' ? DeserializationError::Ok : DeserializationError::InvalidInput;
+    }
+
+    static void appendUtf8(std::string &out, uint32_t code)
+    {
+        if (code < 0x80)
+        {
+            out += (char)code;
+        }
+        else if (code < 0x800)
+        {
+            out += (char)(0xC0 | (code >> 6));
+            out += (char)(0x80 | (code & 0x3F));
+        }
+        else
+        {
+            out += (char)(0xE0 | (code >> 12));
+            out += (char)(0x80 | ((code >> 6) & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
+        }
+    }
+
+    DeserializationError parseString(const char *&saved)
+    {
+        in.next(); // Opening quote
+        text.clear();
+        for (;;)
+        {
+            int c = in.next();
+            if (c == -1)
+                return DeserializationError::IncompleteInput;
+            if (c == '"')
+                break;
+            if (c != '\\')
+            {
+                text += (char)c;
+                continue;
+            }
+
+            c = in.next();
+            switch (c)
+            {
+            case -1: return DeserializationError::IncompleteInput;
+            case 'b': text += '\b'; break;
+            case 'f': text += '\f'; break;
+            case 'n': text += '\n'; break;
+            case 'r': text += '\r'; break;
+            case 't': text += '\t'; break;
+            case 'u':
+            {
+                char hex[5] = {};
+                for (int i = 0; i < 4; i++)
+                {
+                    int digit = in.next();
+                    if (digit == -1)
+                        return DeserializationError::IncompleteInput;
+                    hex[i] = (char)digit;
+                }
+                appendUtf8(text, strtoul(hex, nullptr, 16));
+                break;
+            }
+            default: text += (char)c; break;
+            }
+        }
+
+        saved = pool.saveString(text.data(), text.size());
+        return saved != nullptr ? DeserializationError::Ok : DeserializationError::NoMemory;
+    }
+
+    DeserializationError parseArray(Value &array, int depth)
+    {
+        in.next();
+        setList(array, TYPE_ARRAY);
+        skipSpace();
+        if (in.peek() == ']')
+        {
+            in.next();
+            return DeserializationError::Ok;
+        }
+        for (;;)
+        {
+            Slot *slot = append(pool, array, nullptr);
+            if (slot == nullptr)
+                return DeserializationError::NoMemory;
+            DeserializationError error = parseValue(slot->value, depth);
+            if (error)
+                return error;
+
+            skipSpace();
+            int c = in.next();
+            if (c == ']')
+                return DeserializationError::Ok;
+            if (c == -1)
+                return DeserializationError::IncompleteInput;
+            if (c != ',')
+                return DeserializationError::InvalidInput;
+        }
+    }
+
+    DeserializationError parseObject(Value &object, int depth)
+    {
+        in.next();
+        setList(object, TYPE_OBJECT);
+        skipSpace();
+        if (in.peek() == '}')
+        {
+            in.next();
+            return DeserializationError::Ok;
+        }
+        for (;;)
+        {
+            skipSpace();
+            if (in.peek() == -1)
+                return DeserializationError::IncompleteInput;
+            if (in.peek() != '"')
+                return DeserializationError::InvalidInput;
+            const char *key;
+            DeserializationError error = parseString(key);
+            if (error)
+                return error;
+
+            skipSpace();
+            int c = in.next();
+            if (c == -1)
+                return DeserializationError::IncompleteInput;
+            if (c != ':')
+                return DeserializationError::InvalidInput;
+
+            Slot *slot = append(pool, object, key);
+            if (slot == nullptr)
+                return DeserializationError::NoMemory;
+            error = parseValue(slot->value, depth);
+            if (error)
+                return error;
+
+            skipSpace();
+            c = in.next();
+            if (c == '}')
+                return DeserializationError::Ok;
+            if (c == -1)
+                return DeserializationError::IncompleteInput;
+            if (c != ',')
+                return DeserializationError::InvalidInput;
+        }
+    }
+};
+
+inline DeserializationError deserialize(JsonDocument &doc, Reader &in)
+{
+    doc.clear();
+    Parser parser(in, doc.hostPool());
+    return parser.parse(doc.hostRoot());
+}
+} // namespace HostJson
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *input, size_t length)
+{
+    HostJson::MemoryReader in(input, length);
+    return HostJson::deserialize(doc, in);
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const uint8_t *input, size_t length)
+{
+    return deserializeJson(doc, (const char *)input, length);
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *input)
+{
+    return deserializeJson(doc, input, strlen(input));
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const String &input)
+{
+    return deserializeJson(doc, input.c_str(), input.length());
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, Stream &input)
+{
+    HostJson::StreamReader in(input);
+    return HostJson::deserialize(doc, in);
+}
+
+template <typename Source>
+inline size_t serializeJson(const Source &source, char *buffer, size_t size)
+{
+    HostJson::BufferWriter out(buffer, size);
+    HostJson::writeValue(out, HostJson::rootOf(source));
+    if (size > 0)
+        buffer[out.written] = '\0';
+    return out.written;
+}
+
+template <typename Source>
+inline size_t serializeJson(const Source &source, Print &output)
+{
+    HostJson::PrintWriter out(output);
+    HostJson::writeValue(out, HostJson::rootOf(source));
+    return out.written;
+}
+
+template <typename Source>
+inline size_t serializeJson(const Source &source, String &output)
+{
+    output = "";
+    HostJson::StringWriter out(output);
+    HostJson::writeValue(out, HostJson::rootOf(source));
+    return out.written;
+}
+
+template <typename Source>
+inline size_t measureJson(const Source &source)
+{
+    HostJson::CountingWriter out;
+    HostJson::writeValue(out, HostJson::rootOf(source));
+    return out.written;
+}
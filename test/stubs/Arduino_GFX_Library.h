@@ -0,0 +1,148 @@
+#pragma once
+
+// Host stand-in for Arduino_GFX: a 240x240 panel that draws nothing, but
+// counts the pixels each call would push to the panel (hostPixels), clipped
+// to the screen like the library does, and keeps the text printed at each
+// cursor position (hostText)
+#include "Arduino.h"
+#include <map>
+#include <utility>
+
+#define GFX_NOT_DEFINED -1
+
+#define RGB565_BLACK 0x0000
+#define RGB565_BLUE 0x001F
+#define RGB565_RED 0xF800
+#define RGB565_GREEN 0x07E0
+#define RGB565_CYAN 0x07FF
+#define RGB565_YELLOW 0xFFE0
+#define RGB565_WHITE 0xFFFF
+#define RGB565_ORANGE 0xFD20
+#define RGB565_DARKGREY 0x7BEF
+#define RGB565_LIGHTGREY 0xC618
+
+class Arduino_DataBus
+{
+public:
+    virtual ~Arduino_DataBus() {}
+};
+
+class Arduino_ESP32SPI : public Arduino_DataBus
+{
+public:
+    Arduino_ESP32SPI(int8_t, int8_t, int8_t, int8_t, int8_t) {}
+};
+
+class Arduino_GFX : public Print
+{
+public:
+    Arduino_GFX(int16_t width, int16_t height) : panelWidth(width), panelHeight(height) {}
+
+    bool begin() { return true; }
+    int16_t width() const { return panelWidth; }
+    int16_t height() const { return panelHeight; }
+
+    void fillScreen(uint16_t) { hostPixels += (uint64_t)panelWidth * panelHeight; }
+    void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t)
+    {
+        for (int16_t row = y; row < y + h; row++)
+            hostSpan(row, x, x + w - 1);
+    }
+    void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t)
+    {
+        hostSpan(y, x, x + w - 1);
+        hostSpan(y + h - 1, x, x + w - 1);
+        for (int16_t row = y + 1; row < y + h - 1; row++)
+        {
+            hostSpan(row, x, x);
+            hostSpan(row, x + w - 1, x + w - 1);
+        }
+    }
+    // One horizontal span per row, between the edges of the triangle
+    void fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint16_t)
+    {
+        const int16_t xs[3] = {x0, x1, x2};
+        const int16_t ys[3] = {y0, y1, y2};
+        int16_t top = min(y0, min(y1, y2));
+        int16_t bottom = max(y0, max(y1, y2));
+        for (int16_t row = top; row <= bottom; row++)
+        {
+            float left = 1e9f, right = -1e9f;
+            for (int e = 0; e < 3; e++)
+            {
+                int a = e, b = (e + 1) % 3;
+                if ((row < ys[a] && row < ys[b]) || (row > ys[a] && row > ys[b]))
+                    continue;
+                float x = ys[a] == ys[b] ? xs[a] : xs[a] + (float)(xs[b] - xs[a]) * (row - ys[a]) / (ys[b] - ys[a]);
+                float other = ys[a] == ys[b] ? xs[b] : x;
+                left = min(left, min(x, other));
+                right = max(right, max(x, other));
+            }
+            if (left <= right)
+                hostSpan(row, lroundf(left), lroundf(right));
+        }
+    }
+    void fillCircle(int16_t x, int16_t y, int16_t r, uint16_t)
+    {
+        for (int16_t dy = -r; dy <= r; dy++)
+        {
+            int16_t dx = sqrtf((float)(r * r - dy * dy));
+            hostSpan(y + dy, x - dx, x + dx);
+        }
+    }
+    void setCursor(int16_t x, int16_t y)
+    {
+        cursorX = x;
+        cursorY = y;
+        textAt = {x, y};
+        hostText[textAt] = "";
+    }
+    void setTextSize(uint8_t size) { textSize = size; }
+    void setTextColor(uint16_t color) { textColor = color; }
+    void setFont(const uint8_t *) {}
+
+    // Characters are 6x8 cells of the built-in font, scaled by the text size
+    size_t write(uint8_t c) override
+    {
+        hostText[textAt] += (char)c;
+        if (c == '\n')
+        {
+            cursorX = 0;
+            cursorY += 8 * textSize;
+            return 1;
+        }
+        for (int16_t row = cursorY; row < cursorY + 8 * textSize; row++)
+            hostSpan(row, cursorX, cursorX + 6 * textSize - 1);
+        cursorX += 6 * textSize;
+        return 1;
+    }
+    using Print::write;
+
+    uint64_t hostPixels = 0;
+    std::map<std::pair<int16_t, int16_t>, String> hostText;
+
+protected:
+    void hostSpan(int row, int left, int right)
+    {
+        if (row < 0 || row >= panelHeight)
+            return;
+        left = max(left, 0);
+        right = min(right, panelWidth - 1);
+        if (left <= right)
+            hostPixels += right - left + 1;
+    }
+
+    int16_t panelWidth;
+    int16_t panelHeight;
+    int16_t cursorX = 0;
+    int16_t cursorY = 0;
+    uint8_t textSize = 1;
+    uint16_t textColor = RGB565_WHITE;
+    std::pair<int16_t, int16_t> textAt = {0, 0};
+};
+
+class Arduino_GC9A01 : public Arduino_GFX
+{
+public:
+    Arduino_GC9A01(Arduino_DataBus *, int8_t, uint8_t, bool) : Arduino_GFX(240, 240) {}
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+// Host stand-in for the debounced button: hostPress() makes the next
+// update() report one press
+#include "Arduino.h"
+
+namespace Bounce2
+{
+class Button
+{
+public:
+    void attach(int, int) {}
+    void interval(uint16_t) {}
+    void setPressedState(bool) {}
+    bool update()
+    {
+        justPressed = queuedPresses > 0;
+        if (justPressed)
+            queuedPresses--;
+        return justPressed;
+    }
+    bool pressed() const { return justPressed; }
+
+    void hostPress() { queuedPresses++; }
+
+private:
+    int queuedPresses = 0;
+    bool justPressed = false;
+};
+}
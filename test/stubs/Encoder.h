@@ -0,0 +1,18 @@
+#pragma once
+
+// Host stand-in for the quadrature encoder: tests turn it with hostTurn(),
+// two counts per detent like the real knob
+#include "Arduino.h"
+
+class Encoder
+{
+public:
+    Encoder(uint8_t, uint8_t) {}
+    int32_t read() { return position; }
+    void write(int32_t value) { position = value; }
+
+    void hostTurn(int detents) { position += detents * 2; }
+
+private:
+    int32_t position = 0;
+};
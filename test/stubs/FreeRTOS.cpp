@@ -0,0 +1,195 @@
+#include "Arduino.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// FreeRTOS on the host. Every task runs on a thread of its own, queues,
+// mutexes and task notifications are built on std::mutex and
+// std::condition_variable. The tests drive the loop side on the main thread.
+// Timed waits are real time; vTaskDelay() goes through delay() and so moves
+// the test clock unless the test switched to the real one.
+
+struct HostTask
+{
+    const char *name = "";
+    std::mutex mutex;
+    std::condition_variable notified;
+    uint32_t notifications = 0;
+};
+
+struct HostQueue
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<uint8_t> items;
+    size_t itemSize = 0;
+    size_t length = 0;
+    size_t head = 0;
+    size_t count = 0;
+};
+
+struct HostMutex
+{
+    std::timed_mutex mutex;
+};
+
+static std::deque<HostTask> tasks;
+static std::deque<HostQueue> queues;
+static std::deque<HostMutex> mutexes;
+static std::mutex registry;
+
+static HostTask loopTask{"loopTask"};
+static thread_local HostTask *currentTask = &loopTask;
+
+// Waits until ready() holds or the ticks have passed, false on timeout
+template <typename Ready>
+static bool waitFor(std::condition_variable &condition, std::unique_lock<std::mutex> &lock, TickType_t ticks, Ready ready)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        condition.wait(lock, ready);
+        return true;
+    }
+    // A zero timeout still sleeps in wait_for(), for the timer slack
+    if (ticks == 0)
+        return ready();
+    return condition.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+}
+
+// Tasks never return, the thread is left running until the test exits
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t, void *parameters, UBaseType_t,
+                       TaskHandle_t *created)
+{
+    HostTask *task;
+    {
+        std::lock_guard<std::mutex> guard(registry);
+        tasks.emplace_back();
+        task = &tasks.back();
+        task->name = name;
+    }
+    if (created != nullptr)
+        *created = task;
+
+    std::thread([=] {
+        currentTask = task;
+        code(parameters);
+    }).detach();
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return currentTask;
+}
+
+const char *pcTaskGetName(TaskHandle_t task)
+{
+    return task != nullptr ? task->name : currentTask->name;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    delay(ticks);
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return millis();
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait)
+{
+    HostTask &task = *currentTask;
+    std::unique_lock<std::mutex> lock(task.mutex);
+    waitFor(task.notified, lock, ticksToWait, [&] { return task.notifications > 0; });
+
+    uint32_t count = task.notifications;
+    if (count > 0)
+        task.notifications = clearCountOnExit ? 0 : count - 1;
+    return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    if (task == nullptr)
+        return pdFALSE;
+
+    std::lock_guard<std::mutex> guard(task->mutex);
+    task->notifications++;
+    task->notified.notify_all();
+    return pdPASS;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    std::lock_guard<std::mutex> guard(registry);
+    queues.emplace_back();
+    HostQueue &queue = queues.back();
+    queue.items.resize(length * itemSize);
+    queue.itemSize = itemSize;
+    queue.length = length;
+    return &queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!waitFor(queue->changed, lock, ticksToWait, [&] { return queue->count < queue->length; }))
+        return pdFALSE;
+
+    size_t slot = (queue->head + queue->count) % queue->length;
+    memcpy(&queue->items[slot * queue->itemSize], item, queue->itemSize);
+    queue->count++;
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticksToWait)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!waitFor(queue->changed, lock, ticksToWait, [&] { return queue->count > 0; }))
+        return pdFALSE;
+
+    memcpy(buffer, &queue->items[queue->head * queue->itemSize], queue->itemSize);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    std::lock_guard<std::mutex> guard(queue->mutex);
+    return queue->length - queue->count;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    std::lock_guard<std::mutex> guard(queue->mutex);
+    return queue->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    std::lock_guard<std::mutex> guard(registry);
+    mutexes.emplace_back();
+    return &mutexes.back();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticksToWait)
+{
+    if (ticksToWait == portMAX_DELAY)
+    {
+        mutex->mutex.lock();
+        return pdTRUE;
+    }
+    return mutex->mutex.try_lock_for(std::chrono::milliseconds(ticksToWait)) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    mutex->mutex.unlock();
+    return pdTRUE;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+// Host stand-in for HTTPClient. Requests go to hostHttpHandler, a fake
+// server the tests install; it sees each request and decides the status,
+// the reply and how long the answer takes. Without a handler every request
+// is refused.
+#include "Arduino.h"
+#include <functional>
+
+#define HTTPC_ERROR_CONNECTION_REFUSED -1
+#define HTTPC_ERROR_READ_TIMEOUT -11
+
+struct HostHttpExchange
+{
+    // The request
+    String url;
+    String method;
+    String body;
+    unsigned long sentAt = 0; // micros()
+
+    // The answer, set by the handler
+    int code = 200;
+    String reply;
+    uint32_t delayMs = 0;
+    bool refuse = false;
+};
+
+extern std::function<void(HostHttpExchange &)> hostHttpHandler;
+
+// Reads a String that the stream keeps
+class HostMemoryStream : public Stream
+{
+public:
+    void reset(const String &text)
+    {
+        data = text;
+        at = 0;
+    }
+    int available() override { return data.length() - at; }
+    int read() override { return at < data.length() ? (unsigned char)data[at++] : -1; }
+    int peek() override { return at < data.length() ? (unsigned char)data[at] : -1; }
+
+private:
+    String data;
+    unsigned int at = 0;
+};
+
+class HTTPClient
+{
+public:
+    bool begin(const char *url)
+    {
+        this->url = url;
+        return true;
+    }
+    bool begin(const String &url) { return begin(url.c_str()); }
+    void setConnectTimeout(int32_t ms) { connectTimeoutMs = ms; }
+    void setTimeout(uint16_t ms) { readTimeoutMs = ms; }
+    void addHeader(const String &, const String &) {}
+    void end() { reply.reset(""); }
+
+    int GET() { return send("GET", nullptr, 0); }
+    int POST(uint8_t *body, size_t length) { return send("POST", body, length); }
+    int POST(const String &body) { return send("POST", (const uint8_t *)body.c_str(), body.length()); }
+
+    int getSize() { return replySize; }
+    Stream &getStream() { return reply; }
+    String getString()
+    {
+        String text;
+        while (reply.available() > 0)
+            text += (char)reply.read();
+        return text;
+    }
+
+private:
+    String url;
+    uint32_t connectTimeoutMs = 5000;
+    uint32_t readTimeoutMs = 5000;
+    HostMemoryStream reply;
+    int replySize = -1;
+
+    int send(const char *method, const uint8_t *body, size_t length)
+    {
+        HostHttpExchange exchange;
+        exchange.url = url;
+        exchange.method = method;
+        if (body != nullptr)
+            exchange.body = String(std::string((const char *)body, length).c_str());
+        exchange.sentAt = micros();
+        exchange.refuse = !hostHttpHandler;
+        if (hostHttpHandler)
+            hostHttpHandler(exchange);
+
+        replySize = -1;
+        if (exchange.refuse)
+        {
+            delay(min(exchange.delayMs, connectTimeoutMs));
+            return HTTPC_ERROR_CONNECTION_REFUSED;
+        }
+        if (exchange.delayMs > readTimeoutMs)
+        {
+            delay(readTimeoutMs);
+            return HTTPC_ERROR_READ_TIMEOUT;
+        }
+        delay(exchange.delayMs);
+        reply.reset(exchange.reply);
+        replySize = exchange.reply.length();
+        return exchange.code;
+    }
+};
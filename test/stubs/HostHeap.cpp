@@ -0,0 +1,85 @@
+#include "esp_heap_caps.h"
+#include <new>
+
+// Counts every operator new of the process, so tests can report allocations
+// per request and peak heap use. Each block carries its size in front.
+
+static const size_t HEADER_SIZE = 16;
+
+size_t hostHeapSize = 320 * 1024;
+static std::atomic<size_t> inUse(0);
+static std::atomic<size_t> peak(0);
+static std::atomic<uint64_t> allocations(0);
+static thread_local uint64_t threadAllocations = 0;
+
+void *operator new(size_t size)
+{
+    uint8_t *block = (uint8_t *)malloc(size + HEADER_SIZE);
+    if (block == nullptr)
+        throw std::bad_alloc();
+    *(size_t *)block = size;
+
+    size_t now = inUse.fetch_add(size) + size;
+    size_t highest = peak.load();
+    while (now > highest && !peak.compare_exchange_weak(highest, now))
+    {
+    }
+    allocations++;
+    threadAllocations++;
+    return block + HEADER_SIZE;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+    if (pointer == nullptr)
+        return;
+    uint8_t *block = (uint8_t *)pointer - HEADER_SIZE;
+    inUse -= *(size_t *)block;
+    free(block);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+HostHeapStats hostHeapStats()
+{
+    return {inUse.load(), peak.load(), allocations.load()};
+}
+
+void hostHeapResetPeak()
+{
+    peak.store(inUse.load());
+}
+
+uint64_t hostThreadAllocations()
+{
+    return threadAllocations;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t)
+{
+    size_t used = inUse.load();
+    return used < hostHeapSize ? hostHeapSize - used : 0;
+}
+
+uint32_t EspClass::getFreeHeap()
+{
+    return heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+}
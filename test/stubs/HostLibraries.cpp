@@ -0,0 +1,314 @@
+#include "HTTPClient.h"
+#include "LittleFS.h"
+#include "PubSubClient.h"
+#include "Update.h"
+#include "WiFi.h"
+#include <mutex>
+
+// Objects the Arduino libraries define, and the parts of the stand-ins that
+// are too long for their headers
+
+WiFiClass WiFi;
+LittleFSClass LittleFS;
+UpdateClass Update;
+HostBroker hostBroker;
+std::function<void(HostHttpExchange &)> hostHttpHandler;
+
+// MD5 (RFC 1321)
+
+static const uint32_t md5Sines[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+static const uint8_t md5Shifts[64] = {7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+                                      5, 9,  14, 20, 5, 9,  14, 20, 5, 9,  14, 20, 5, 9,  14, 20,
+                                      4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+                                      6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+void MD5Builder::begin()
+{
+    state[0] = 0x67452301;
+    state[1] = 0xefcdab89;
+    state[2] = 0x98badcfe;
+    state[3] = 0x10325476;
+    length = 0;
+}
+
+void MD5Builder::transform(const uint8_t *chunk)
+{
+    uint32_t words[16];
+    for (int i = 0; i < 16; i++)
+        words[i] = chunk[i * 4] | chunk[i * 4 + 1] << 8 | chunk[i * 4 + 2] << 16 | (uint32_t)chunk[i * 4 + 3] << 24;
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t f;
+        int g;
+        if (i < 16)
+        {
+            f = (b & c) | (~b & d);
+            g = i;
+        }
+        else if (i < 32)
+        {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        }
+        else if (i < 48)
+        {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+        uint32_t rotated = a + f + md5Sines[i] + words[g];
+        a = d;
+        d = c;
+        c = b;
+        b += rotated << md5Shifts[i] | rotated >> (32 - md5Shifts[i]);
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+void MD5Builder::add(const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        block[length++ % 64] = data[i];
+        if (length % 64 == 0)
+            transform(block);
+    }
+}
+
+void MD5Builder::calculate()
+{
+    uint64_t bits = length * 8;
+    uint8_t padding = 0x80;
+    add(&padding, 1);
+    padding = 0;
+    while (length % 64 != 56)
+        add(&padding, 1);
+    for (int i = 0; i < 8; i++)
+    {
+        uint8_t byte = bits >> (8 * i);
+        add(&byte, 1);
+    }
+    for (int i = 0; i < 16; i++)
+        digest[i] = state[i / 4] >> (8 * (i % 4));
+}
+
+String MD5Builder::toString() const
+{
+    char text[33];
+    for (int i = 0; i < 16; i++)
+        snprintf(text + i * 2, 3, "%02x", digest[i]);
+    return String(text);
+}
+
+// Fake flash for OTA updates
+
+bool UpdateClass::begin(size_t size, int)
+{
+    if (size != UPDATE_SIZE_UNKNOWN && size > hostPartitionSize)
+    {
+        error = "Not Enough Space";
+        return false;
+    }
+    if (hostPartition == nullptr)
+        hostPartition = (uint8_t *)malloc(hostPartitionSize);
+    running = true;
+    hostWritten = 0;
+    hostBootSwitched = false;
+    expectedMd5[0] = '\0';
+    error = "No Error";
+    md5.begin();
+    return true;
+}
+
+bool UpdateClass::setMD5(const char *expected)
+{
+    if (strlen(expected) != 32)
+        return false;
+    strlcpy(expectedMd5, expected, sizeof(expectedMd5));
+    return true;
+}
+
+size_t UpdateClass::write(uint8_t *data, size_t length)
+{
+    if (!running)
+        return 0;
+    if (hostWritten + length > hostPartitionSize)
+    {
+        error = "Not Enough Space";
+        return 0;
+    }
+    memcpy(hostPartition + hostWritten, data, length);
+    hostWritten += length;
+    md5.add(data, length);
+    return length;
+}
+
+bool UpdateClass::end(bool)
+{
+    if (!running)
+        return false;
+    running = false;
+    md5.calculate();
+    if (expectedMd5[0] != '\0' && md5.toString() != expectedMd5)
+    {
+        error = "MD5 Check Failed";
+        return false;
+    }
+    hostBootSwitched = true;
+    return true;
+}
+
+void UpdateClass::abort()
+{
+    running = false;
+    error = "Aborted";
+}
+
+// In-process MQTT broker
+
+struct HostDelivery
+{
+    HostMqttMessage message;
+    unsigned long deliverAt;
+};
+
+static std::mutex brokerMutex;
+static std::vector<PubSubClient *> brokerClients;
+static std::vector<HostDelivery> brokerQueue;
+
+void HostBroker::publish(const char *topic, const char *payload)
+{
+    std::lock_guard<std::mutex> guard(brokerMutex);
+    unsigned long now = micros();
+    brokerQueue.push_back({{topic, payload, now}, now + latencyMs * 1000UL});
+}
+
+PubSubClient::~PubSubClient()
+{
+    disconnect();
+}
+
+bool PubSubClient::connect(const char *, const char *, const char *)
+{
+    std::lock_guard<std::mutex> guard(brokerMutex);
+    if (!hostBroker.up || WiFi.status() != WL_CONNECTED)
+        return false;
+    if (!session)
+        brokerClients.push_back(this);
+    session = true;
+    subscriptions.clear();
+    return true;
+}
+
+void PubSubClient::disconnect()
+{
+    std::lock_guard<std::mutex> guard(brokerMutex);
+    session = false;
+    brokerClients.erase(std::remove(brokerClients.begin(), brokerClients.end(), this), brokerClients.end());
+}
+
+bool PubSubClient::connected()
+{
+    if (session && !hostBroker.up)
+        disconnect();
+    return session;
+}
+
+bool PubSubClient::subscribe(const char *topic)
+{
+    if (!connected())
+        return false;
+    subscriptions.push_back(topic);
+    return true;
+}
+
+bool PubSubClient::publish(const char *topic, const uint8_t *payload, unsigned int length)
+{
+    if (!connected() || strlen(topic) + length + 5 > bufferSize)
+        return false;
+    HostMqttMessage message;
+    message.topic = topic;
+    message.payload = String(std::string((const char *)payload, length).c_str());
+    message.publishedAt = micros();
+    if (hostBroker.onPublish)
+        hostBroker.onPublish(message);
+    return true;
+}
+
+// Single level + wildcards only, that is all the sketch subscribes with
+bool PubSubClient::matches(const String &topic) const
+{
+    for (auto &filter : subscriptions)
+    {
+        const char *f = filter.c_str();
+        const char *t = topic.c_str();
+        bool same = true;
+        while (same && *f != '\0' && *t != '\0')
+        {
+            if (*f == '+')
+            {
+                while (*t != '\0' && *t != '/')
+                    t++;
+                f++;
+            }
+            else
+            {
+                same = *f++ == *t++;
+            }
+        }
+        if (same && *f == '\0' && *t == '\0')
+            return true;
+    }
+    return false;
+}
+
+bool PubSubClient::loop()
+{
+    if (!connected())
+        return false;
+
+    std::vector<HostMqttMessage> due;
+    {
+        std::lock_guard<std::mutex> guard(brokerMutex);
+        unsigned long now = micros();
+        for (auto it = brokerQueue.begin(); it != brokerQueue.end();)
+        {
+            if ((long)(now - it->deliverAt) >= 0)
+            {
+                due.push_back(it->message);
+                it = brokerQueue.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    for (auto &message : due)
+    {
+        if (callback == nullptr || !matches(message.topic))
+            continue;
+        std::vector<char> topic(message.topic.c_str(), message.topic.c_str() + message.topic.length() + 1);
+        callback(topic.data(), (uint8_t *)message.payload.c_str(), message.payload.length());
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+// Host stand-in for LittleFS: files live in memory for the life of the
+// process, so a simulated restart finds what was stored before it
+#include "Arduino.h"
+#include <map>
+#include <memory>
+
+class File : public Stream
+{
+public:
+    File() {}
+    File(std::shared_ptr<std::string> contents, bool writing) : contents(contents), writing(writing) {}
+
+    explicit operator bool() const { return contents != nullptr; }
+    size_t size() const { return contents != nullptr ? contents->size() : 0; }
+    void close() { contents.reset(); }
+
+    int available() override { return contents != nullptr && !writing ? contents->size() - at : 0; }
+    int read() override { return available() > 0 ? (unsigned char)(*contents)[at++] : -1; }
+    int peek() override { return available() > 0 ? (unsigned char)(*contents)[at] : -1; }
+    size_t read(uint8_t *buffer, size_t length)
+    {
+        size_t count = min(length, (size_t)available());
+        memcpy(buffer, contents->data() + at, count);
+        at += count;
+        return count;
+    }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *data, size_t length) override
+    {
+        if (contents == nullptr || !writing)
+            return 0;
+        contents->append((const char *)data, length);
+        return length;
+    }
+    using Print::write;
+
+private:
+    std::shared_ptr<std::string> contents;
+    bool writing = false;
+    size_t at = 0;
+};
+
+class LittleFSClass
+{
+public:
+    bool begin(bool) { return true; }
+    bool exists(const char *path) const { return files.count(path) > 0; }
+    bool remove(const char *path) { return files.erase(path) > 0; }
+    bool rename(const char *from, const char *to)
+    {
+        auto it = files.find(from);
+        if (it == files.end())
+            return false;
+        files[to] = it->second;
+        files.erase(it);
+        return true;
+    }
+
+    // "w" truncates, anything else reads
+    File open(const char *path, const char *mode)
+    {
+        bool writing = mode[0] == 'w';
+        if (writing)
+        {
+            files[path] = std::make_shared<std::string>();
+        }
+        else if (!exists(path))
+        {
+            return File();
+        }
+        return File(files[path], writing);
+    }
+
+private:
+    std::map<std::string, std::shared_ptr<std::string>> files;
+};
+extern LittleFSClass LittleFS;
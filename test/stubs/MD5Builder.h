@@ -0,0 +1,23 @@
+#pragma once
+
+// Host stand-in for the ESP32 MD5Builder
+#include "Arduino.h"
+
+class MD5Builder
+{
+public:
+    void begin();
+    void add(const uint8_t *data, size_t length);
+    void add(const String &text) { add((const uint8_t *)text.c_str(), text.length()); }
+    void calculate();
+    void getBytes(uint8_t *out) const { memcpy(out, digest, sizeof(digest)); }
+    String toString() const;
+
+private:
+    uint32_t state[4];
+    uint64_t length;
+    uint8_t block[64];
+    uint8_t digest[16];
+
+    void transform(const uint8_t *chunk);
+};
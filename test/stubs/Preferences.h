@@ -0,0 +1,66 @@
+#pragma once
+
+// Host stand-in for the NVS backed Preferences: keeps values in memory and
+// counts writes. Reopening after a simulated restart keeps the contents.
+#include "Arduino.h"
+#include <map>
+
+class Preferences
+{
+public:
+    uint32_t writes = 0;
+
+    bool begin(const char *, bool) { return true; }
+
+    size_t putBytes(const char *key, const void *value, size_t length)
+    {
+        const uint8_t *bytes = (const uint8_t *)value;
+        blobs[key].assign(bytes, bytes + length);
+        writes++;
+        return length;
+    }
+
+    size_t getBytesLength(const char *key)
+    {
+        auto it = blobs.find(key);
+        return it == blobs.end() ? 0 : it->second.size();
+    }
+
+    size_t getBytes(const char *key, void *buffer, size_t maxLength)
+    {
+        auto it = blobs.find(key);
+        if (it == blobs.end() || it->second.size() > maxLength)
+            return 0;
+        memcpy(buffer, it->second.data(), it->second.size());
+        return it->second.size();
+    }
+
+    // Everything else is stored as text
+    size_t putString(const char *key, const String &value) { return putBytes(key, value.c_str(), value.length()); }
+    size_t putUInt(const char *key, uint32_t value) { return putString(key, String((unsigned long)value)); }
+    size_t putInt(const char *key, int32_t value) { return putString(key, String((long)value)); }
+    size_t putBool(const char *key, bool value) { return putString(key, value ? "1" : "0"); }
+
+    String getString(const char *key, const String &fallback = String())
+    {
+        auto it = blobs.find(key);
+        if (it == blobs.end())
+            return fallback;
+        return String(std::string(it->second.begin(), it->second.end()).c_str());
+    }
+    uint32_t getUInt(const char *key, uint32_t fallback = 0)
+    {
+        return blobs.count(key) ? strtoul(getString(key).c_str(), nullptr, 10) : fallback;
+    }
+    int32_t getInt(const char *key, int32_t fallback = 0)
+    {
+        return blobs.count(key) ? strtol(getString(key).c_str(), nullptr, 10) : fallback;
+    }
+    bool getBool(const char *key, bool fallback = false)
+    {
+        return blobs.count(key) ? getString(key) == "1" : fallback;
+    }
+
+private:
+    std::map<std::string, std::vector<uint8_t>> blobs;
+};
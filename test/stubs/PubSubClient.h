@@ -0,0 +1,69 @@
+#pragma once
+
+// Host stand-in for PubSubClient, talking to an in-process broker (see
+// HostLibraries.cpp). Tests take the broker up and down, add latency and
+// publish state messages as a device would.
+#include "Arduino.h"
+#include "WiFi.h"
+#include <functional>
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTED 0
+
+struct HostMqttMessage
+{
+    String topic;
+    String payload;
+    unsigned long publishedAt; // micros()
+};
+
+struct HostBroker
+{
+    bool up = true;
+    uint32_t latencyMs = 0; // One way, broker to subscriber and back
+    std::function<void(const HostMqttMessage &)> onPublish; // Messages from the knob
+
+    // Delivers a message to the subscribed clients, the next time they loop
+    void publish(const char *topic, const char *payload);
+};
+extern HostBroker hostBroker;
+
+class PubSubClient
+{
+public:
+    typedef void (*Callback)(char *, uint8_t *, unsigned int);
+
+    explicit PubSubClient(WiFiClient &) {}
+    ~PubSubClient();
+
+    PubSubClient &setServer(const char *, uint16_t) { return *this; }
+    PubSubClient &setCallback(Callback callback)
+    {
+        this->callback = callback;
+        return *this;
+    }
+    bool setBufferSize(uint16_t size)
+    {
+        bufferSize = size;
+        return true;
+    }
+    PubSubClient &setSocketTimeout(uint16_t) { return *this; }
+    PubSubClient &setKeepAlive(uint16_t) { return *this; }
+
+    bool connect(const char *id) { return connect(id, nullptr, nullptr); }
+    bool connect(const char *id, const char *user, const char *password);
+    void disconnect();
+    bool connected();
+    int state() { return connected() ? MQTT_CONNECTED : MQTT_CONNECTION_TIMEOUT; }
+    bool subscribe(const char *topic);
+    bool publish(const char *topic, const uint8_t *payload, unsigned int length);
+    bool loop();
+
+private:
+    Callback callback = nullptr;
+    uint16_t bufferSize = 256;
+    bool session = false;
+    std::vector<String> subscriptions;
+
+    bool matches(const String &topic) const;
+};
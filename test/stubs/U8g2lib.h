@@ -0,0 +1,6 @@
+#pragma once
+
+// Host stand-in: only the font the sketch selects
+#include "Arduino.h"
+
+static const uint8_t u8g2_font_7x14_tr[1] = {0};
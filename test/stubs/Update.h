@@ -0,0 +1,34 @@
+#pragma once
+
+// Host stand-in for the OTA writer. The image goes to a fake flash
+// partition that is allocated with malloc(), so it does not count against
+// the modeled heap (see HostHeap.cpp), and is checked against the MD5 set.
+#include "Arduino.h"
+#include "MD5Builder.h"
+
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+#define U_FLASH 0
+
+class UpdateClass
+{
+public:
+    // The partition, for the tests to look at
+    size_t hostPartitionSize = 1920 * 1024;
+    uint8_t *hostPartition = nullptr;
+    size_t hostWritten = 0;
+    bool hostBootSwitched = false;
+
+    bool begin(size_t size, int command);
+    bool setMD5(const char *expected);
+    size_t write(uint8_t *data, size_t length);
+    bool end(bool evenIfRemaining = false);
+    void abort();
+    const char *errorString() const { return error; }
+
+private:
+    bool running = false;
+    const char *error = "No Error";
+    MD5Builder md5;
+    char expectedMd5[33] = "";
+};
+extern UpdateClass Update;
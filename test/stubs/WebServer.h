@@ -0,0 +1,221 @@
+#pragma once
+
+// Host stand-in for the ESP32 WebServer. Tests queue requests with
+// hostQueue() or hostUpload(); handleClient() runs the handler of each one
+// and the reply is kept in response.
+#include "Arduino.h"
+#include <deque>
+#include <functional>
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define HTTP_UPLOAD_BUFLEN 1436
+
+typedef enum
+{
+    HTTP_ANY,
+    HTTP_GET,
+    HTTP_POST
+} HTTPMethod;
+
+typedef enum
+{
+    UPLOAD_FILE_START,
+    UPLOAD_FILE_WRITE,
+    UPLOAD_FILE_END,
+    UPLOAD_FILE_ABORTED
+} HTTPUploadStatus;
+
+struct HTTPUpload
+{
+    HTTPUploadStatus status;
+    String filename;
+    String name;
+    String type;
+    size_t totalSize;
+    size_t currentSize;
+    uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+
+struct HostHttpRequest
+{
+    HTTPMethod method = HTTP_GET;
+    String uri;
+    std::vector<std::pair<String, String>> args;
+    String user; // Basic auth credentials sent, if any
+    String password;
+    const uint8_t *upload = nullptr;
+    size_t uploadSize = 0;
+};
+
+struct HostHttpResponse
+{
+    int code = 0;
+    String type;
+    String body;
+    size_t contentLength = CONTENT_LENGTH_UNKNOWN;
+};
+
+class WebServer
+{
+public:
+    typedef std::function<void()> Handler;
+
+    HostHttpResponse response;
+    uint32_t handled = 0;
+
+    explicit WebServer(int) { response.body.reserve(64 * 1024); }
+
+    void on(const char *uri, HTTPMethod method, Handler handler) { on(uri, method, handler, nullptr); }
+    void on(const char *uri, HTTPMethod method, Handler handler, Handler upload)
+    {
+        routes.push_back({uri, method, handler, upload});
+    }
+    void begin() {}
+
+    void handleClient()
+    {
+        while (!queued.empty())
+        {
+            current = queued.front();
+            queued.pop_front();
+            dispatch();
+        }
+    }
+
+    String arg(const char *name) const
+    {
+        for (auto &arg : current.args)
+        {
+            if (arg.first == name)
+                return arg.second;
+        }
+        return String();
+    }
+    String arg(const String &name) const { return arg(name.c_str()); }
+    bool hasArg(const char *name) const
+    {
+        for (auto &arg : current.args)
+        {
+            if (arg.first == name)
+                return true;
+        }
+        return false;
+    }
+    const String &uri() const { return current.uri; }
+    HTTPUpload &upload() { return uploadState; }
+
+    bool authenticate(const char *user, const char *password) const
+    {
+        return current.user == user && current.password == password;
+    }
+    void requestAuthentication() { send(401, "text/plain", ""); }
+
+    void setContentLength(size_t length) { response.contentLength = length; }
+    void send(int code, const char *type, const String &content) { send_P(code, type, content.c_str(), content.length()); }
+    void send(int code, const char *type, const char *content) { send_P(code, type, content); }
+    void send_P(int code, const char *type, const char *content) { send_P(code, type, content, strlen(content)); }
+    void send_P(int code, const char *type, const char *content, size_t length)
+    {
+        response.code = code;
+        response.type = type;
+        response.body = "";
+        appendBody(content, length);
+    }
+    void sendContent(const char *content, size_t length) { appendBody(content, length); }
+    void sendContent(const String &content) { appendBody(content.c_str(), content.length()); }
+
+    // Queues a request for the next handleClient()
+    void hostQueue(HTTPMethod method, const char *uri, std::vector<std::pair<String, String>> args = {},
+                   const char *user = "", const char *password = "")
+    {
+        HostHttpRequest request;
+        request.method = method;
+        request.uri = uri;
+        request.args = std::move(args);
+        request.user = user;
+        request.password = password;
+        queued.push_back(std::move(request));
+    }
+
+    // Queues a file upload, handed to the upload handler in
+    // HTTP_UPLOAD_BUFLEN chunks like the real server does
+    void hostUpload(const char *uri, const uint8_t *data, size_t size, std::vector<std::pair<String, String>> args = {},
+                    const char *user = "", const char *password = "")
+    {
+        hostQueue(HTTP_POST, uri, std::move(args), user, password);
+        queued.back().upload = data;
+        queued.back().uploadSize = size;
+    }
+
+    // Runs one request right away and returns the reply
+    const HostHttpResponse &hostCall(HTTPMethod method, const char *uri,
+                                     std::vector<std::pair<String, String>> args = {}, const char *user = "",
+                                     const char *password = "")
+    {
+        hostQueue(method, uri, std::move(args), user, password);
+        handleClient();
+        return response;
+    }
+
+private:
+    struct Route
+    {
+        String uri;
+        HTTPMethod method;
+        Handler handler;
+        Handler upload;
+    };
+
+    std::vector<Route> routes;
+    std::deque<HostHttpRequest> queued;
+    HostHttpRequest current;
+    HTTPUpload uploadState;
+
+    void appendBody(const char *content, size_t length)
+    {
+        response.body.concat(content, length);
+    }
+
+    void dispatch()
+    {
+        handled++;
+        response.code = 0;
+        response.type = "";
+        response.body = "";
+        response.contentLength = CONTENT_LENGTH_UNKNOWN;
+
+        for (auto &route : routes)
+        {
+            if (route.uri != current.uri || (route.method != HTTP_ANY && route.method != current.method))
+                continue;
+
+            if (current.upload != nullptr && route.upload)
+                feedUpload(route.upload);
+            route.handler();
+            return;
+        }
+        send(404, "text/plain", "Not found");
+    }
+
+    void feedUpload(Handler &handler)
+    {
+        uploadState.filename = "upload.bin";
+        uploadState.totalSize = 0;
+        uploadState.currentSize = 0;
+        uploadState.status = UPLOAD_FILE_START;
+        handler();
+
+        uploadState.status = UPLOAD_FILE_WRITE;
+        for (size_t at = 0; at < current.uploadSize; at += HTTP_UPLOAD_BUFLEN)
+        {
+            uploadState.currentSize = min((size_t)HTTP_UPLOAD_BUFLEN, current.uploadSize - at);
+            memcpy(uploadState.buf, current.upload + at, uploadState.currentSize);
+            handler();
+            uploadState.totalSize += uploadState.currentSize;
+        }
+
+        uploadState.status = UPLOAD_FILE_END;
+        uploadState.currentSize = 0;
+        handler();
+    }
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+// Host stand-in for the ESP32 WiFi class. Tests set the link state and
+// signal strength the sketch sees.
+#include "Arduino.h"
+
+typedef enum
+{
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum
+{
+    WIFI_OFF = 0,
+    WIFI_STA = 1,
+    WIFI_AP = 2
+} wifi_mode_t;
+
+typedef enum
+{
+    ARDUINO_EVENT_WIFI_STA_START,
+    ARDUINO_EVENT_WIFI_STA_CONNECTED,
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+    ARDUINO_EVENT_WIFI_STA_GOT_IP,
+    ARDUINO_EVENT_WIFI_STA_LOST_IP,
+    ARDUINO_EVENT_WIFI_AP_START,
+    ARDUINO_EVENT_WIFI_AP_STACONNECTED,
+    ARDUINO_EVENT_WIFI_AP_STADISCONNECTED
+} arduino_event_id_t;
+
+class IPAddress
+{
+public:
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : octets{a, b, c, d} {}
+    String toString() const
+    {
+        char text[16];
+        snprintf(text, sizeof(text), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+        return String(text);
+    }
+
+private:
+    uint8_t octets[4];
+};
+
+class WiFiClass
+{
+public:
+    // What the sketch sees, set by the tests
+    wl_status_t hostStatus = WL_CONNECTED;
+    int hostRssi = -55;
+    wifi_mode_t hostMode = WIFI_OFF;
+
+    wl_status_t status() { return hostStatus; }
+    bool mode(wifi_mode_t mode)
+    {
+        hostMode = mode;
+        return true;
+    }
+    wl_status_t begin(const char *, const char *) { return hostStatus; }
+    bool softAP(const char *, const char *) { return true; }
+    IPAddress localIP() { return IPAddress(192, 168, 1, 50); }
+    IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+    int8_t RSSI() { return hostStatus == WL_CONNECTED ? hostRssi : 0; }
+    String macAddress() { return "24:0A:C4:12:34:56"; }
+    void onEvent(void (*)(arduino_event_id_t)) {}
+};
+extern WiFiClass WiFi;
+
+class WiFiClient
+{
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "Arduino.h"
+
+typedef enum
+{
+    GPIO_INTR_LOW_LEVEL = 4,
+    GPIO_INTR_HIGH_LEVEL = 5
+} gpio_int_type_t;
+
+inline int gpio_get_level(gpio_num_t pin) { return digitalRead(pin); }
+inline int gpio_wakeup_enable(gpio_num_t, gpio_int_type_t) { return 0; }
+inline int gpio_wakeup_disable(gpio_num_t) { return 0; }
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Arduino.h"
+
+#define MALLOC_CAP_8BIT (1 << 2)
+
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+
+// Heap use of the host process, as the allocations counted by HostHeap.cpp.
+// The modeled ESP32 heap is hostHeapSize bytes; free heap is what is left
+// of it.
+struct HostHeapStats
+{
+    size_t inUse;
+    size_t peak;
+    uint64_t allocations;
+};
+extern size_t hostHeapSize;
+HostHeapStats hostHeapStats();
+void hostHeapResetPeak();
+// Allocations made by the calling thread so far
+uint64_t hostThreadAllocations();
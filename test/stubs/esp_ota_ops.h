@@ -0,0 +1,35 @@
+#pragma once
+
+// Host stand-in: the running image is always valid
+#include "Arduino.h"
+
+#ifndef ESP_OK
+typedef int esp_err_t;
+#define ESP_OK 0
+#endif
+
+typedef struct
+{
+    uint32_t address;
+} esp_partition_t;
+
+typedef enum
+{
+    ESP_OTA_IMG_NEW,
+    ESP_OTA_IMG_PENDING_VERIFY,
+    ESP_OTA_IMG_VALID
+} esp_ota_img_states_t;
+
+inline const esp_partition_t *esp_ota_get_running_partition()
+{
+    static const esp_partition_t running = {0x10000};
+    return &running;
+}
+
+inline esp_err_t esp_ota_get_state_partition(const esp_partition_t *, esp_ota_img_states_t *state)
+{
+    *state = ESP_OTA_IMG_VALID;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_ota_mark_app_valid_cancel_rollback() { return ESP_OK; }
@@ -0,0 +1,14 @@
+#pragma once
+
+// Host stand-in: light sleep returns at once
+#include "Arduino.h"
+#include "driver/gpio.h"
+
+#ifndef ESP_OK
+typedef int esp_err_t;
+#define ESP_OK 0
+#endif
+
+inline esp_err_t esp_sleep_enable_gpio_wakeup() { return ESP_OK; }
+inline esp_err_t esp_sleep_enable_timer_wakeup(uint64_t) { return ESP_OK; }
+inline esp_err_t esp_light_sleep_start() { return ESP_OK; }
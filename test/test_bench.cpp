@@ -0,0 +1,336 @@
+#include "HostSketch.h"
+#include <algorithm>
+#include <mutex>
+
+// End-to-end latency on the host: scripted input traces go through the
+// encoder and button stand-ins, navigation and rendering, sendDeviceRequest()
+// and the outbound workers to a stand-in for main_url that timestamps every
+// request it receives. Input-to-frame and input-to-backend percentiles are
+// measured with host timestamps, next to what the knob itself reports on
+// /latency, and printed as one JSON object per line. The host counts until
+// the request arrives, the knob until the backend's reply is back.
+//
+// The first tests run the knob's own traces through POST /bench: they need
+// the admin password, wake a dark screen and stop when the cursor leaves the
+// item they started on.
+
+static const char *PASSWORD = "bench-admin";
+static const uint32_t INTERVAL_MS = 16;
+static const uint32_t BACKEND_MS = 2;
+static const int SPOTS = 36;
+
+// What the stand-in for main_url received, keyed like the input that caused it
+struct Arrival
+{
+    String key;
+    uint64_t atNanos;
+};
+
+static std::mutex arrivalsMutex;
+static std::vector<Arrival> arrivals;
+static uint32_t backendDelayMs = 0;
+
+static String commandKey(const String &deviceId, const String &value)
+{
+    return deviceId + "=" + value;
+}
+
+static void backend(HostHttpExchange &exchange)
+{
+    Arrival arrival;
+    arrival.atNanos = hostNowNanos();
+    if (exchange.method == "POST")
+    {
+        DynamicJsonDocument doc(256);
+        if (deserializeJson(doc, exchange.body))
+            return;
+        arrival.key = commandKey(doc["device_id"].as<String>(), doc["value"].as<String>());
+    }
+    else
+    {
+        arrival.key = exchange.url;
+    }
+    exchange.delayMs = backendDelayMs;
+
+    std::lock_guard<std::mutex> guard(arrivalsMutex);
+    arrivals.push_back(arrival);
+}
+
+// A room long enough to spin through, and scenes to run
+static String benchMenuJson()
+{
+    String devices = R"({"name": "TV", "type": "onoff", "device_id": "tv1"},
+        {"name": "Light", "type": "onoff", "device_id": "light1"},
+        {"name": "Light Brightness", "type": "brightness", "device_id": "light_brightness1"})";
+    for (int i = 0; i < SPOTS; i++)
+    {
+        devices += ",{\"name\": \"Spot " + String(i) + "\", \"type\": \"onoff\", \"device_id\": \"spot" + String(i) +
+                   "\"}";
+    }
+    return String(R"({"menu": [
+        {"name": "Home", "submenus": [{"name": "Living Room", "devices": [)") +
+           devices + R"(]}]},
+        {"name": "Scenes", "actions": [
+            {"name": "Movie", "url": "http://hub.local:8123/scene/movie"},
+            {"name": "Dinner", "url": "http://hub.local:8123/scene/dinner"}]}],
+    "settings": {"wifi_ssid": "home", "main_url": "http://hub.local:8123/api/knobble"}})";
+}
+
+static bool inputPending()
+{
+    return myKnob.read() / 2 != lastEncoderValue || displayDirty;
+}
+
+static void goTo(MenuState state, int menu, int submenu, int device)
+{
+    inEditMode = false;
+    currentState = state;
+    currentMenuIndex = menu;
+    currentSubmenuIndex = submenu;
+    currentDeviceIndex = device;
+    requestRedraw();
+    do
+    {
+        loop();
+    } while (inputPending());
+}
+
+static bool traceRunning()
+{
+    DynamicJsonDocument doc(1024);
+    deserializeJson(doc, server.hostCall(HTTP_GET, "/latency").body);
+    return doc["running"].as<bool>();
+}
+
+static void runWhileTraceRuns()
+{
+    while (traceRunning())
+        loop();
+}
+
+static const HostHttpResponse &bench(const char *trace, const char *interval, const char *password)
+{
+    return server.hostCall(HTTP_POST, "/bench", {{"trace", trace}, {"interval_ms", interval}}, ADMIN_USER, password);
+}
+
+static void benchNeedsAdmin()
+{
+    goTo(DEVICE_CONTROL, 0, 0, 0);
+    CHECK_EQUAL(403, bench("toggle", "16", "").code);
+
+    server.hostCall(HTTP_POST, "/config", {{"admin_password", PASSWORD}});
+    CHECK_EQUAL(401, bench("toggle", "16", "guess").code);
+    CHECK(!traceRunning());
+}
+
+// Ten presses on a switch leave it as it was, unless one is taken as a wake up
+static void benchWakesTheScreen()
+{
+    goTo(DEVICE_CONTROL, 0, 0, 0);
+    while (powerState != POWER_OFF)
+        loop();
+
+    bool state = findDeviceById("tv1")->state;
+    CHECK_EQUAL(200, bench("toggle", "16", PASSWORD).code);
+    CHECK_EQUAL(POWER_ACTIVE, powerState);
+    runWhileTraceRuns();
+    CHECK_EQUAL(state, findDeviceById("tv1")->state);
+}
+
+static void benchStopsWhenCursorLeaves()
+{
+    goTo(DEVICE_CONTROL, 0, 0, 0);
+    bool tv = findDeviceById("tv1")->state;
+    bool light = findDeviceById("light1")->state;
+
+    CHECK_EQUAL(200, bench("toggle", "50", PASSWORD).code);
+    while (findDeviceById("tv1")->state == tv)
+        loop();
+    myKnob.hostTurn(1);
+    runWhileTraceRuns();
+
+    CHECK_EQUAL(!tv, findDeviceById("tv1")->state);
+    CHECK_EQUAL(light, findDeviceById("light1")->state);
+    CHECK_EQUAL(1, currentDeviceIndex);
+}
+
+// An input the host fed, and the request it should cause
+struct HostInput
+{
+    uint64_t atNanos;
+    String key; // What the backend should receive, empty for none
+};
+
+static uint64_t percentile(std::vector<uint64_t> &samples, int p)
+{
+    return samples.empty() ? 0 : samples[(samples.size() - 1) * p / 100];
+}
+
+static void report(const char *trace, const char *metric, const char *source, std::vector<uint64_t> micros)
+{
+    std::sort(micros.begin(), micros.end());
+    BENCH_RESULT("\"e2e\",\"trace\":\"%s\",\"metric\":\"%s\",\"source\":\"%s\",\"samples\":%u,\"p50_us\":%llu,"
+                 "\"p95_us\":%llu,\"p99_us\":%llu,\"max_us\":%llu",
+                 trace, metric, source, (unsigned)micros.size(), (unsigned long long)percentile(micros, 50),
+                 (unsigned long long)percentile(micros, 95), (unsigned long long)percentile(micros, 99),
+                 (unsigned long long)(micros.empty() ? 0 : micros.back()));
+}
+
+// What the knob measured itself, from /latency
+static void reportKnob(const char *trace, JsonObject stats, const char *metric)
+{
+    BENCH_RESULT("\"e2e\",\"trace\":\"%s\",\"metric\":\"%s\",\"source\":\"knob\",\"samples\":%u,\"p50_us\":%u,"
+                 "\"p95_us\":%u,\"p99_us\":%u,\"max_us\":%u",
+                 trace, metric, stats["count"].as<unsigned>(), stats["p50_us"].as<unsigned>(),
+                 stats["p95_us"].as<unsigned>(), stats["p99_us"].as<unsigned>(), stats["max_us"].as<unsigned>());
+}
+
+// The key of the request the input just handled should cause
+typedef String (*ExpectedKey)();
+
+struct TraceResult
+{
+    std::vector<uint64_t> toFrame;
+    std::vector<uint64_t> toBackend;
+    int inputs = 0;
+};
+
+// Feeds the steps (0 presses, +1/-1 turns) one every INTERVAL_MS, times
+// each until its frame is done, then matches what the backend received to
+// the latest input that asked for it. Inputs replaced by a newer command
+// before they were sent have no backend sample.
+static TraceResult replay(const char *name, const std::vector<int> &steps, ExpectedKey expected)
+{
+    server.hostCall(HTTP_GET, "/latency", {{"reset", "1"}});
+    {
+        std::lock_guard<std::mutex> guard(arrivalsMutex);
+        arrivals.clear();
+    }
+
+    TraceResult result;
+    std::vector<HostInput> inputs;
+    for (int step : steps)
+    {
+        uint64_t start = hostNowNanos();
+        if (step == 0)
+            button.hostPress();
+        else
+            myKnob.hostTurn(step);
+        do
+        {
+            loop();
+        } while (inputPending());
+        result.toFrame.push_back((hostNowNanos() - start) / 1000);
+        inputs.push_back({start, expected != nullptr ? expected() : String()});
+
+        while (hostNowNanos() - start < INTERVAL_MS * 1000000ULL)
+            loop();
+    }
+    result.inputs = inputs.size();
+
+    // Let the last requests arrive and their replies come back
+    unsigned long settle = millis();
+    while (millis() - settle < 200)
+        loop();
+
+    std::lock_guard<std::mutex> guard(arrivalsMutex);
+    for (auto &arrival : arrivals)
+    {
+        for (auto input = inputs.rbegin(); input != inputs.rend(); ++input)
+        {
+            if (input->atNanos < arrival.atNanos && input->key == arrival.key)
+            {
+                result.toBackend.push_back((arrival.atNanos - input->atNanos) / 1000);
+                input->key = "";
+                break;
+            }
+        }
+    }
+
+    report(name, "input_to_frame", "host", result.toFrame);
+    report(name, "input_to_backend", "host", result.toBackend);
+
+    DynamicJsonDocument doc(1024);
+    deserializeJson(doc, server.hostCall(HTTP_GET, "/latency").body);
+    reportKnob(name, doc["input_to_frame"], "input_to_frame");
+    reportKnob(name, doc["input_to_backend"], "input_to_backend");
+    return result;
+}
+
+static String noRequest()
+{
+    return String();
+}
+
+static String brightnessKey()
+{
+    return commandKey("light_brightness1", String(findDeviceById("light_brightness1")->brightness));
+}
+
+static String toggleKey()
+{
+    if (currentState == SUBMENU)
+        return mainMenu[1].requests[currentSubmenuIndex].url;
+    const Device &device = mainMenu[0].rooms[0].devices[currentDeviceIndex];
+    return commandKey(device.device_id, device.state ? "1" : "0");
+}
+
+static void checkBounded(const TraceResult &result)
+{
+    std::vector<uint64_t> toFrame = result.toFrame;
+    std::sort(toFrame.begin(), toFrame.end());
+    CHECK(percentile(toFrame, 99) <= 20000);
+}
+
+// Down a 39 item room and back up
+static void spin()
+{
+    goTo(DEVICE_CONTROL, 0, 0, 0);
+    std::vector<int> steps(SPOTS + 3, 1);
+    steps.insert(steps.end(), SPOTS + 3, -1);
+    TraceResult result = replay("spin", steps, noRequest);
+    CHECK_EQUAL(0, currentDeviceIndex);
+    CHECK(result.toBackend.empty());
+    checkBounded(result);
+}
+
+// Into the brightness gauge, 0 to 100 and back, out again
+static void sweep()
+{
+    goTo(DEVICE_CONTROL, 0, 0, 2);
+    findDeviceById("light_brightness1")->brightness = 0;
+    std::vector<int> steps = {0};
+    steps.insert(steps.end(), 20, 1);
+    steps.insert(steps.end(), 20, -1);
+    steps.push_back(0);
+    TraceResult result = replay("sweep", steps, brightnessKey);
+    CHECK(!inEditMode);
+    CHECK(result.toBackend.size() > 0);
+    checkBounded(result);
+}
+
+// A switch, then the scenes
+static void toggle()
+{
+    goTo(DEVICE_CONTROL, 0, 0, 1);
+    TraceResult lights = replay("toggle", std::vector<int>(10, 0), toggleKey);
+    CHECK_EQUAL(lights.inputs, lights.toBackend.size());
+    checkBounded(lights);
+
+    goTo(SUBMENU, 1, 0, 0);
+    TraceResult scenes = replay("scene", {0, 1, 0, -1, 0, 1, 0}, toggleKey);
+    CHECK_EQUAL(4, scenes.toBackend.size());
+    checkBounded(scenes);
+}
+
+HOST_TEST_MAIN(
+    hostHttpHandler = backend;
+    bootSketchWithMenu(benchMenuJson());
+    RUN_TEST(benchNeedsAdmin);
+    RUN_TEST(benchWakesTheScreen);
+    RUN_TEST(benchStopsWhenCursorLeaves);
+    hostUseRealClock();
+    backendDelayMs = BACKEND_MS;
+    RUN_TEST(spin);
+    RUN_TEST(sweep);
+    RUN_TEST(toggle))
@@ -0,0 +1,232 @@
+#include "HostSketch.h"
+
+// Optimistic device commands (Commands.cpp): what handleCommandResults()
+// does with each result the transport posts, first straight through the
+// result queue, then end to end through the outbound workers against a
+// local backend stand-in that answers late, or not with 2xx. Runs on the
+// real clock with the workers on threads of their own.
+
+static const uint32_t TIMEOUT_MS = 300;
+
+static int backendCode = 200;
+static String backendReply;
+static uint32_t backendDelayMs = 0;
+
+template <typename Done>
+static bool runUntil(Done done, uint32_t timeoutMs = 2000)
+{
+    unsigned long start = millis();
+    while (!done())
+    {
+        if (millis() - start > timeoutMs)
+            return false;
+        loop();
+    }
+    return true;
+}
+
+static Device &lamp()
+{
+    return *findDeviceById("light_brightness1");
+}
+
+// A confirmed starting point
+static void settle(int brightness)
+{
+    lamp().brightness = brightness;
+    confirmDevice(lamp());
+}
+
+// Turns the lamp to brightness like adjustValue() does, without a transport
+static uint32_t command(int brightness)
+{
+    lamp().brightness = brightness;
+    return beginDeviceCommand(lamp());
+}
+
+static void post(uint32_t sequence, const char *value, int code)
+{
+    postCommandResult(sequence, "light_brightness1", "brightness", value, code);
+    handleCommandResults();
+}
+
+static void confirmKeepsValue()
+{
+    settle(20);
+    uint32_t sequence = command(40);
+    CHECK(lamp().pending);
+    post(sequence, "40", 200);
+    CHECK(!lamp().pending);
+    CHECK(!lamp().failed);
+    CHECK_EQUAL(40, lamp().brightness);
+    CHECK_EQUAL(40, lamp().confirmedBrightness);
+}
+
+// The backend's answer is the device's real state
+static void confirmTakesBackendValue()
+{
+    settle(20);
+    uint32_t sequence = command(40);
+    post(sequence, "35", 204);
+    CHECK(!lamp().pending);
+    CHECK_EQUAL(35, lamp().brightness);
+    CHECK_EQUAL(35, lamp().confirmedBrightness);
+}
+
+static void non2xxRollsBack()
+{
+    const int codes[] = {-1, 301, 404, 500};
+    for (int code : codes)
+    {
+        settle(20);
+        uint32_t sequence = command(40);
+        post(sequence, "40", code);
+        CHECK(!lamp().pending);
+        CHECK(lamp().failed);
+        CHECK_EQUAL(20, lamp().brightness);
+        CHECK_EQUAL(20, lamp().confirmedBrightness);
+    }
+}
+
+// Only the result of the latest command counts; an earlier one failing
+// must not roll back a value the user has turned past
+static void olderResultIsIgnored()
+{
+    settle(20);
+    uint32_t first = command(40);
+    uint32_t second = command(60);
+    CHECK(second > first);
+
+    post(first, "40", 500);
+    CHECK(lamp().pending);
+    CHECK(!lamp().failed);
+    CHECK_EQUAL(60, lamp().brightness);
+
+    post(first, "40", 200);
+    CHECK(lamp().pending);
+    CHECK_EQUAL(60, lamp().brightness);
+    CHECK_EQUAL(20, lamp().confirmedBrightness);
+
+    post(second, "60", 200);
+    CHECK(!lamp().pending);
+    CHECK_EQUAL(60, lamp().confirmedBrightness);
+}
+
+static void timeoutRollsBack()
+{
+    settle(20);
+    command(40);
+    CHECK(runUntil([] { return !lamp().pending; }, TIMEOUT_MS * 3));
+    CHECK(lamp().failed);
+    CHECK_EQUAL(20, lamp().brightness);
+}
+
+// A reply that comes after the timeout still tells what the device did
+static void lateSuccessIsApplied()
+{
+    settle(20);
+    uint32_t sequence = command(40);
+    CHECK(runUntil([] { return !lamp().pending; }, TIMEOUT_MS * 3));
+    CHECK_EQUAL(20, lamp().brightness);
+
+    post(sequence, "40", 200);
+    CHECK(!lamp().failed);
+    CHECK_EQUAL(40, lamp().brightness);
+    CHECK_EQUAL(40, lamp().confirmedBrightness);
+}
+
+// A late failure changes nothing, the device was rolled back already
+static void lateFailureIsIgnored()
+{
+    settle(20);
+    uint32_t sequence = command(40);
+    CHECK(runUntil([] { return !lamp().pending; }, TIMEOUT_MS * 3));
+    lamp().failed = false;
+
+    post(sequence, "40", 500);
+    CHECK(!lamp().failed);
+    CHECK_EQUAL(20, lamp().brightness);
+}
+
+// End to end through sendDeviceRequest() and the workers
+
+static void send(int brightness)
+{
+    lamp().brightness = brightness;
+    sendDeviceRequest("light_brightness1", "brightness", String(brightness));
+}
+
+static void backendConfirms()
+{
+    settle(20);
+    backendCode = 200;
+    backendReply = "{\"value\": \"45\"}";
+    backendDelayMs = 20;
+    send(50);
+    CHECK(lamp().pending);
+    CHECK(runUntil([] { return !lamp().pending; }));
+    CHECK(!lamp().failed);
+    CHECK_EQUAL(45, lamp().brightness);
+}
+
+static void backendAnswersLate()
+{
+    settle(20);
+    backendCode = 200;
+    backendReply = "";
+    backendDelayMs = TIMEOUT_MS * 2;
+    send(50);
+    CHECK(runUntil([] { return !lamp().pending; }));
+    CHECK(lamp().failed);
+    CHECK_EQUAL(20, lamp().brightness);
+
+    CHECK(runUntil([] { return lamp().brightness == 50; }));
+    CHECK(!lamp().failed);
+    CHECK_EQUAL(50, lamp().confirmedBrightness);
+}
+
+static void backendSupersededReply()
+{
+    settle(20);
+    backendCode = 200;
+    backendReply = "";
+    backendDelayMs = 50;
+    send(40);
+    send(60);
+    CHECK(runUntil([] { return !lamp().pending; }));
+    CHECK(!lamp().failed);
+    CHECK_EQUAL(60, lamp().brightness);
+}
+
+static void backendFails()
+{
+    settle(20);
+    backendCode = 503;
+    backendReply = "";
+    backendDelayMs = 20;
+    send(50);
+    CHECK(runUntil([] { return !lamp().pending; }));
+    CHECK(lamp().failed);
+    CHECK_EQUAL(20, lamp().brightness);
+}
+
+HOST_TEST_MAIN(
+    hostHttpHandler = [](HostHttpExchange &exchange) {
+        exchange.code = backendCode;
+        exchange.reply = backendReply;
+        exchange.delayMs = backendDelayMs;
+    };
+    bootSketch("http://hub.local:8123/api/knobble");
+    hostUseRealClock();
+    request_timeout_ms = TIMEOUT_MS;
+    RUN_TEST(confirmKeepsValue);
+    RUN_TEST(confirmTakesBackendValue);
+    RUN_TEST(non2xxRollsBack);
+    RUN_TEST(olderResultIsIgnored);
+    RUN_TEST(timeoutRollsBack);
+    RUN_TEST(lateSuccessIsApplied);
+    RUN_TEST(lateFailureIsIgnored);
+    RUN_TEST(backendConfirms);
+    RUN_TEST(backendAnswersLate);
+    RUN_TEST(backendSupersededReply);
+    RUN_TEST(backendFails))
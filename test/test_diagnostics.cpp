@@ -0,0 +1,196 @@
+#include "HostSketch.h"
+
+// The diagnostics screen (Diagnostics.cpp): rates sampled over a window of
+// the test clock, each value field as it is printed on the panel, which
+// fields a refresh redraws, and the edit controls' partial redraws counted
+// as frames. Values are read back from the Arduino_GFX stand-in at the
+// screen's layout: one line per field, values at x = 110.
+
+enum Line
+{
+    LINE_FPS,
+    LINE_FRAME,
+    LINE_LOOP,
+    LINE_INPUT,
+    LINE_RTT,
+    LINE_ERRORS,
+    LINE_RSSI,
+    LINE_HEAP,
+    LINE_BLOCK
+};
+
+static String shown(Line line)
+{
+    return gfx->hostText[std::make_pair((int16_t)110, (int16_t)(45 + line * 16))];
+}
+
+static String label(Line line)
+{
+    return gfx->hostText[std::make_pair((int16_t)40, (int16_t)(45 + line * 16))];
+}
+
+static DynamicJsonDocument diagnostics()
+{
+    DynamicJsonDocument doc(512);
+    writeDiagnostics(doc.to<JsonObject>());
+    return doc;
+}
+
+static void openScreen()
+{
+    inEditMode = false;
+    currentState = DIAGNOSTICS;
+    requestRedraw();
+    renderDisplay();
+}
+
+// Starts a new sampling window
+static void resetWindow()
+{
+    updateDiagnostics();
+}
+
+// frames frames of frameMicros each over ms milliseconds, then a refresh
+static void sample(int frames, uint32_t frameMicros, unsigned long ms)
+{
+    for (int i = 0; i < frames; i++)
+        noteFrame(frameMicros);
+    hostMillis += ms;
+    updateDiagnostics();
+}
+
+static void showsEveryField()
+{
+    openScreen();
+    CHECK(label(LINE_FPS) == "FPS");
+    CHECK(label(LINE_BLOCK) == "Block");
+
+    resetWindow();
+    upstreamRecord("http://hub.local:8123/api/knobble", 500, 12);
+    sample(30, 4250, 500);
+
+    DynamicJsonDocument doc = diagnostics();
+    CHECK(shown(LINE_FPS) == "60.0");
+    CHECK(shown(LINE_FRAME) == "4.2 ms");
+    CHECK(shown(LINE_LOOP) == "0/s");
+    uint32_t input = doc["input_to_frame_us"].as<uint32_t>();
+    CHECK(shown(LINE_INPUT) == String(input / 1000) + "." + String(input % 1000 / 100) + " ms");
+    CHECK(shown(LINE_RTT) == "12 ms");
+    CHECK(doc["upstream_errors"].as<uint32_t>() >= 1);
+    CHECK(shown(LINE_ERRORS) == String(doc["upstream_errors"].as<uint32_t>()));
+    CHECK(shown(LINE_RSSI) == "-55 dBm");
+    CHECK(shown(LINE_HEAP) == String(doc["free_heap"].as<uint32_t>()));
+    CHECK(shown(LINE_BLOCK) == String(doc["largest_free_block"].as<uint32_t>()));
+    CHECK_EQUAL(60.0, doc["fps"].as<double>());
+    CHECK_EQUAL(4250, doc["frame_us"].as<uint32_t>());
+}
+
+// Tenths are truncated, not rounded
+static void fractions()
+{
+    resetWindow();
+    sample(1, 999, 300);
+    CHECK(shown(LINE_FPS) == "3.3");
+    CHECK(shown(LINE_FRAME) == "0.9 ms");
+
+    sample(0, 0, 1000);
+    CHECK(shown(LINE_FPS) == "0.0");
+}
+
+static void loopRate()
+{
+    // Lets the tasks that are due run first, updateDiagnostics() among them
+    runScheduler();
+    resetWindow();
+    for (int i = 0; i < 50; i++)
+        runScheduler();
+    hostMillis += 250;
+    updateDiagnostics();
+    CHECK(shown(LINE_LOOP) == "200/s");
+}
+
+static void rssiWithoutWifi()
+{
+    WiFi.hostStatus = WL_DISCONNECTED;
+    sample(0, 0, 1000);
+    CHECK(shown(LINE_RSSI) == "-");
+    CHECK_EQUAL(0, diagnostics()["rssi"].as<int>());
+
+    WiFi.hostStatus = WL_CONNECTED;
+    sample(0, 0, 1000);
+    CHECK(shown(LINE_RSSI) == "-55 dBm");
+}
+
+// A refresh clears and prints only the fields whose text changed
+static void refreshRedrawsChangedFields()
+{
+    uint64_t before = gfx->hostPixels;
+    openScreen();
+    uint64_t fullFrame = gfx->hostPixels - before;
+
+    resetWindow();
+    sample(20, 3000, 1000);
+    before = gfx->hostPixels;
+    sample(20, 3000, 1000);
+    uint64_t unchanged = gfx->hostPixels - before;
+
+    before = gfx->hostPixels;
+    sample(40, 3000, 1000);
+    uint64_t fpsChanged = gfx->hostPixels - before;
+    CHECK(shown(LINE_FPS) == "40.0");
+
+    BENCH_RESULT("\"diagnostics_refresh\",\"full_frame_pixels\":%llu,\"unchanged_pixels\":%llu,"
+                 "\"fps_changed_pixels\":%llu",
+                 (unsigned long long)fullFrame, (unsigned long long)unchanged, (unsigned long long)fpsChanged);
+
+    // The heap may move between refreshes, nothing else does
+    uint64_t field = (240 - 110) * 16 + 16 * 6 * 8;
+    CHECK(unchanged <= field);
+    CHECK(fpsChanged >= field / 2);
+    CHECK(fpsChanged <= 2 * field);
+}
+
+// Encoder steps on the gauge and the wheel only redraw what changed; they
+// are frames too
+static void editStepsAreFrames()
+{
+    inEditMode = false;
+    currentState = DEVICE_CONTROL;
+    currentMenuIndex = 0;
+    currentSubmenuIndex = 0;
+    currentDeviceIndex = 2;
+    findDeviceById("light_brightness1")->brightness = 0;
+    applyButtonPress();
+    renderDisplay();
+    CHECK(inEditMode);
+
+    resetWindow();
+    for (int i = 0; i < 10; i++)
+        applyEncoderStep(1);
+    hostMillis += 1000;
+    updateDiagnostics();
+    CHECK_EQUAL(10.0, diagnostics()["fps"].as<double>());
+    applyButtonPress();
+
+    currentDeviceIndex = 3;
+    applyButtonPress();
+    renderDisplay();
+    CHECK(inEditMode);
+
+    resetWindow();
+    for (int i = 0; i < 5; i++)
+        applyEncoderStep(1);
+    hostMillis += 1000;
+    updateDiagnostics();
+    CHECK_EQUAL(5.0, diagnostics()["fps"].as<double>());
+    applyButtonPress();
+}
+
+HOST_TEST_MAIN(
+    bootSketch("http://hub.local:8123/api/knobble");
+    RUN_TEST(showsEveryField);
+    RUN_TEST(fractions);
+    RUN_TEST(loopRate);
+    RUN_TEST(rssiWithoutWifi);
+    RUN_TEST(refreshRedrawsChangedFields);
+    RUN_TEST(editStepsAreFrames))
@@ -0,0 +1,122 @@
+#include "HostSketch.h"
+
+// JSON encoding on the request paths that share the arena (JsonBuffers.cpp):
+// how fast /status, /control and sendDeviceRequest() encode, and how many
+// heap allocations each request makes once the sketch is running. The arena
+// and the output buffer are allocated at boot, so encoding itself should
+// not allocate; what is left comes from the String arguments.
+
+static const int REQUESTS = 2000;
+
+// /status with every upstream host in use, the largest reply it sends
+static void fillUpstreamTable()
+{
+    for (int i = 0; i < UPSTREAM_MAX_HOSTS; i++)
+    {
+        char url[64];
+        snprintf(url, sizeof(url), "http://host%d.local:8080/api", i);
+        upstreamRecord(url, 200, 20 + i);
+    }
+}
+
+static void statusEncoding()
+{
+    fillUpstreamTable();
+
+    // Queued up front so that building the requests is not counted
+    for (int i = 0; i < REQUESTS; i++)
+        server.hostQueue(HTTP_GET, "/status");
+
+    size_t heapBefore = hostHeapStats().inUse;
+    uint64_t allocationsBefore = hostThreadAllocations();
+    uint64_t start = hostNowNanos();
+    server.handleClient();
+    uint64_t elapsed = hostNowNanos() - start;
+    uint64_t allocations = hostThreadAllocations() - allocationsBefore;
+
+    const HostHttpResponse &response = server.response;
+    CHECK_EQUAL(200, response.code);
+    CHECK_EQUAL(response.contentLength, response.body.length());
+    CHECK(response.body.length() > JSON_OUT_BUFFER_SIZE / 2);
+
+    // The reply parses and carries every host
+    DynamicJsonDocument doc(8192);
+    CHECK(!deserializeJson(doc, response.body));
+    CHECK_EQUAL(UPSTREAM_MAX_HOSTS, doc["upstream"].size());
+    CHECK(doc["diagnostics"].is<JsonObject>());
+
+    BENCH_RESULT("\"status\",\"requests\":%d,\"bytes\":%u,\"ns_per_request\":%llu,\"allocations_per_request\":%.2f",
+                 REQUESTS, response.body.length(), (unsigned long long)(elapsed / REQUESTS),
+                 (double)allocations / REQUESTS);
+    CHECK((double)allocations / REQUESTS <= 1);
+    CHECK(hostHeapStats().inUse <= heapBefore);
+}
+
+static void controlEncoding()
+{
+    for (int i = 0; i < REQUESTS; i++)
+    {
+        server.hostQueue(HTTP_POST, "/control",
+                         {{"device_id", "light_brightness1"}, {"type", "brightness"}, {"value", String(i % 100)}});
+    }
+
+    uint64_t allocationsBefore = hostThreadAllocations();
+    uint64_t start = hostNowNanos();
+    server.handleClient();
+    uint64_t elapsed = hostNowNanos() - start;
+    uint64_t allocations = hostThreadAllocations() - allocationsBefore;
+
+    CHECK_EQUAL(200, server.response.code);
+    CHECK(server.response.body == "{\"status\":\"success\"}");
+    CHECK_EQUAL((REQUESTS - 1) % 100, findDeviceById("light_brightness1")->brightness);
+
+    BENCH_RESULT("\"control\",\"requests\":%d,\"ns_per_request\":%llu,\"allocations_per_request\":%.2f", REQUESTS,
+                 (unsigned long long)(elapsed / REQUESTS), (double)allocations / REQUESTS);
+    CHECK((double)allocations / REQUESTS <= 6);
+}
+
+// The body sent to main_url, without the web server around it. The same
+// device over and over, so every command replaces the one still queued.
+static void deviceRequestEncoding()
+{
+    const String deviceId = "light_brightness1";
+    const String type = "brightness";
+    const String value = "55";
+
+    uint64_t allocationsBefore = hostThreadAllocations();
+    uint64_t start = hostNowNanos();
+    for (int i = 0; i < REQUESTS; i++)
+        sendDeviceRequest(deviceId, type, value);
+    uint64_t elapsed = hostNowNanos() - start;
+    uint64_t allocations = hostThreadAllocations() - allocationsBefore;
+
+    CHECK(jsonOutLength > 0);
+    CHECK(strncmp(jsonOutBuffer, "{\"device_id\":\"light_brightness1\",\"type\":\"brightness\",\"value\":\"55\"}",
+                  jsonOutLength) == 0);
+
+    BENCH_RESULT("\"device_request\",\"requests\":%d,\"bytes\":%u,\"ns_per_request\":%llu,"
+                 "\"allocations_per_request\":%.2f",
+                 REQUESTS, (unsigned)jsonOutLength, (unsigned long long)(elapsed / REQUESTS),
+                 (double)allocations / REQUESTS);
+    CHECK((double)allocations / REQUESTS <= 2);
+}
+
+// Overflowing the arena fails the request instead of sending half of it
+static void arenaOverflowIsAnError()
+{
+    JsonDocument &doc = beginJson();
+    JsonArray items = doc.createNestedArray("items");
+    for (int i = 0; i < JSON_ARENA_SIZE; i++)
+        items.add(i);
+    CHECK(jsonArena.overflowed());
+
+    sendJsonStreamed(200);
+    CHECK_EQUAL(500, server.response.code);
+}
+
+HOST_TEST_MAIN(
+    bootSketch("http://hub.local:8123/api/knobble");
+    RUN_TEST(statusEncoding);
+    RUN_TEST(controlEncoding);
+    RUN_TEST(deviceRequestEncoding);
+    RUN_TEST(arenaOverflowIsAnError))
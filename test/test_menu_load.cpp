@@ -0,0 +1,118 @@
+#include "HostSketch.h"
+
+// The whole reload path, loadMenuStructure(): read the config from flash,
+// parse it, build the new menu and merge it into the running one. Compared
+// with the same path into an empty menu, which builds every node like the
+// reload did before the merge. Parsing reads every device either way, so
+// the merge saves far less here than on its own (test_menu_reload).
+//
+// A config this large (about 110 KB) does not fit the ESP32-C3's heap with
+// its parsed document next to it, so the test models a larger heap.
+
+static const int ROOMS = 50;
+static const int DEVICES_PER_ROOM = 20;
+static const int RUNS = 5;
+
+// One home of ROOMS rooms, device 10 of room 25 renamed if renameOne is set
+static String largeMenuJson(bool renameOne)
+{
+    String json;
+    json.reserve(ROOMS * DEVICES_PER_ROOM * 120);
+    json += "{\"menu\": [{\"name\": \"Home\", \"submenus\": [";
+    for (int r = 0; r < ROOMS; r++)
+    {
+        json += r > 0 ? ",{\"name\": \"Room " : "{\"name\": \"Room ";
+        json += String(r);
+        json += "\", \"devices\": [";
+        for (int d = 0; d < DEVICES_PER_ROOM; d++)
+        {
+            char device[160];
+            bool renamed = renameOne && r == 25 && d == 10;
+            snprintf(device, sizeof(device),
+                     "%s{\"name\": \"%s %d/%d\", \"type\": \"brightness\", \"device_id\": \"light.room_%d_device_%d\"}",
+                     d > 0 ? "," : "", renamed ? "Renamed" : "Ceiling Light", r, d, r, d);
+            json += device;
+        }
+        json += "]}";
+    }
+    json += "]}], \"settings\": {\"wifi_ssid\": \"home\", \"main_url\": \"http://hub.local:8123/api/knobble\"}}";
+    return json;
+}
+
+static void storeMenu(const String &json)
+{
+    File file = LittleFS.open(MENU_CONFIG_PATH, "w");
+    file.print(json);
+    file.close();
+}
+
+struct LoadCost
+{
+    uint64_t bestNanos = 0;
+    uint64_t allocations = 0;
+};
+
+// Best of RUNS reloads of the stored config, after prepare() set up the
+// running menu
+template <typename Prepare>
+static LoadCost measure(Prepare prepare)
+{
+    LoadCost cost;
+    for (int run = 0; run < RUNS; run++)
+    {
+        prepare();
+        uint64_t allocationsBefore = hostThreadAllocations();
+        uint64_t start = hostNowNanos();
+        loadMenuStructure();
+        uint64_t elapsed = hostNowNanos() - start;
+        cost.allocations = hostThreadAllocations() - allocationsBefore;
+        if (cost.bestNanos == 0 || elapsed < cost.bestNanos)
+            cost.bestNanos = elapsed;
+    }
+    return cost;
+}
+
+static Device *lamp()
+{
+    return findDeviceById("light.room_3_device_4");
+}
+
+static void oneEditInLargeConfig()
+{
+    String original = largeMenuJson(false);
+    String edited = largeMenuJson(true);
+
+    LoadCost merged = measure([&] {
+        storeMenu(original);
+        loadMenuStructure();
+        if (lamp() != nullptr)
+            lamp()->brightness = 42;
+        storeMenu(edited);
+    });
+    CHECK_EQUAL(1, mainMenu.size());
+    if (mainMenu.size() != 1 || lamp() == nullptr)
+        return;
+    CHECK_EQUAL(ROOMS, mainMenu[0].rooms.size());
+    CHECK(mainMenu[0].rooms[25].devices[10].name == "Renamed 25/10");
+    CHECK_EQUAL(42, lamp()->brightness);
+
+    LoadCost rebuilt = measure([] { mainMenu.clear(); });
+    CHECK(mainMenu[0].rooms[25].devices[10].name == "Renamed 25/10");
+    CHECK_EQUAL(0, lamp()->brightness);
+
+    BENCH_RESULT("\"menu_load\",\"devices\":%d,\"config_bytes\":%u,\"merge_us\":%llu,\"merge_allocations\":%llu,"
+                 "\"rebuild_us\":%llu,\"rebuild_allocations\":%llu,\"ratio\":%.2f",
+                 ROOMS * DEVICES_PER_ROOM, edited.length(), (unsigned long long)(merged.bestNanos / 1000),
+                 (unsigned long long)merged.allocations, (unsigned long long)(rebuilt.bestNanos / 1000),
+                 (unsigned long long)rebuilt.allocations, (double)merged.bestNanos / rebuilt.bestNanos);
+
+    // Parsing builds the new menu in both cases; the merge must not cost
+    // more than it saves
+    CHECK(merged.allocations <= rebuilt.allocations);
+    CHECK(merged.bestNanos <= rebuilt.bestNanos * 5 / 4);
+}
+
+HOST_TEST_MAIN(
+    hostHeapSize = 1024 * 1024;
+    bootSketch("http://hub.local:8123/api/knobble");
+    RUN_TEST(oneEditInLargeConfig))
@@ -0,0 +1,385 @@
+#include "SmartMenuSystem.h"
+#include "HostTest.h"
+#include <esp_heap_caps.h>
+#include <chrono>
+
+// Merge of a reloaded menu into the running one (MenuReload.cpp): device
+// state, cursor remapping, redraw decisions and how much work a reload does.
+
+std::vector<MenuLevel> mainMenu;
+MenuState currentState = MAIN_MENU;
+int currentMenuIndex = 0;
+int currentSubmenuIndex = 0;
+int currentDeviceIndex = 0;
+int currentSettingIndex = 0;
+bool inEditMode = false;
+
+static int fullRedraws = 0;
+static std::vector<int> redrawnLines;
+
+void requestRedraw()
+{
+    fullRedraws++;
+}
+
+void redrawDeviceLine(int index)
+{
+    redrawnLines.push_back(index);
+}
+
+void markSnapshotDirty()
+{
+}
+
+static Device makeDevice(const char *name, const char *type, const char *id)
+{
+    Device device;
+    device.name = name;
+    device.type = type;
+    device.device_id = id;
+    return device;
+}
+
+// Home: Living Room (tv, lamp, strip), Bedroom (ceiling); Requests: one action
+static std::vector<MenuLevel> makeMenu()
+{
+    std::vector<MenuLevel> menu(2);
+    menu[0].name = "Home";
+    menu[0].rooms.resize(2);
+    menu[0].rooms[0].name = "Living Room";
+    menu[0].rooms[0].devices.push_back(makeDevice("TV", "onoff", "tv"));
+    menu[0].rooms[0].devices.push_back(makeDevice("Lamp", "brightness", "lamp"));
+    menu[0].rooms[0].devices.push_back(makeDevice("Strip", "color", "strip"));
+    menu[0].rooms[1].name = "Bedroom";
+    menu[0].rooms[1].devices.push_back(makeDevice("Ceiling", "onoff", "ceiling"));
+    menu[1].name = "Requests";
+    menu[1].requests.push_back({"Scene", "http://example.com/scene"});
+    return menu;
+}
+
+static Device &findDevice(const char *id)
+{
+    for (auto &level : mainMenu)
+        for (auto &room : level.rooms)
+            for (auto &device : room.devices)
+                if (device.device_id == id)
+                    return device;
+    static Device missing;
+    return missing;
+}
+
+static MenuDiffStats reload(std::vector<MenuLevel> incoming)
+{
+    fullRedraws = 0;
+    redrawnLines.clear();
+    return applyMenuStructure(incoming);
+}
+
+static void boot()
+{
+    mainMenu.clear();
+    currentState = MAIN_MENU;
+    currentMenuIndex = 0;
+    currentSubmenuIndex = 0;
+    currentDeviceIndex = 0;
+    inEditMode = false;
+    reload(makeMenu());
+}
+
+static void bootStartsOnFirstItem()
+{
+    boot();
+    CHECK_EQUAL(MAIN_MENU, currentState);
+    CHECK_EQUAL(0, currentMenuIndex);
+    CHECK_EQUAL(2, mainMenu.size());
+}
+
+static void identicalReloadKeepsStateAndDrawsNothing()
+{
+    boot();
+    findDevice("lamp").brightness = 40;
+    findDevice("tv").state = true;
+    currentState = DEVICE_CONTROL;
+    currentDeviceIndex = 1;
+
+    MenuDiffStats stats = reload(makeMenu());
+
+    CHECK_EQUAL(0, stats.added);
+    CHECK_EQUAL(0, stats.removed);
+    CHECK_EQUAL(0, stats.changed);
+    CHECK_EQUAL(4, stats.unchanged);
+    CHECK_EQUAL(MENU_REDRAW_NONE, stats.redraw);
+    CHECK_EQUAL(40, findDevice("lamp").brightness);
+    CHECK(findDevice("tv").state);
+}
+
+static void renamedDeviceRedrawsOnlyItsLine()
+{
+    boot();
+    currentState = DEVICE_CONTROL;
+    currentDeviceIndex = 0;
+
+    std::vector<MenuLevel> incoming = makeMenu();
+    incoming[0].rooms[0].devices[2].name = "LED Strip";
+    MenuDiffStats stats = reload(incoming);
+
+    CHECK_EQUAL(1, stats.changed);
+    CHECK_EQUAL(3, stats.unchanged);
+    CHECK_EQUAL(MENU_REDRAW_LINES, stats.redraw);
+    CHECK_EQUAL(0, fullRedraws);
+    CHECK_EQUAL(1, redrawnLines.size());
+    CHECK(redrawnLines.size() == 1 && redrawnLines[0] == 2);
+    CHECK(findDevice("strip").name == "LED Strip");
+}
+
+static void changeOnAnotherScreenDrawsNothing()
+{
+    boot();
+    currentState = DEVICE_CONTROL;
+    currentSubmenuIndex = 1; // Bedroom
+
+    std::vector<MenuLevel> incoming = makeMenu();
+    incoming[0].rooms[0].devices[0].name = "Television";
+    MenuDiffStats stats = reload(incoming);
+
+    CHECK_EQUAL(MENU_REDRAW_NONE, stats.redraw);
+    CHECK_EQUAL(0, fullRedraws);
+    CHECK(redrawnLines.empty());
+}
+
+static void movedDeviceKeepsItsState()
+{
+    boot();
+    findDevice("strip").color = "#FF0000";
+    findDevice("strip").confirmedColor = "#FF0000";
+
+    std::vector<MenuLevel> incoming = makeMenu();
+    Device strip = incoming[0].rooms[0].devices[2];
+    incoming[0].rooms[0].devices.pop_back();
+    incoming[0].rooms[1].devices.push_back(strip);
+    MenuDiffStats stats = reload(incoming);
+
+    CHECK_EQUAL(0, stats.added);
+    CHECK_EQUAL(0, stats.removed);
+    CHECK_EQUAL(4, stats.unchanged);
+    CHECK_EQUAL(2, mainMenu[0].rooms[1].devices.size());
+    CHECK(mainMenu[0].rooms[1].devices[1].color == "#FF0000");
+    CHECK(mainMenu[0].rooms[1].devices[1].confirmedColor == "#FF0000");
+}
+
+static void addedAndRemovedDevicesAreCounted()
+{
+    boot();
+    std::vector<MenuLevel> incoming = makeMenu();
+    incoming[0].rooms[1].devices[0] = makeDevice("Fan", "onoff", "fan");
+    MenuDiffStats stats = reload(incoming);
+
+    CHECK_EQUAL(1, stats.added);
+    CHECK_EQUAL(1, stats.removed);
+    CHECK_EQUAL(3, stats.unchanged);
+    CHECK(!findDevice("fan").state);
+}
+
+static void cursorFollowsDeviceWhenItemsAreInserted()
+{
+    boot();
+    currentState = DEVICE_CONTROL;
+    currentDeviceIndex = 1; // Lamp
+    findDevice("lamp").brightness = 70;
+
+    std::vector<MenuLevel> incoming = makeMenu();
+    auto &devices = incoming[0].rooms[0].devices;
+    devices.insert(devices.begin(), makeDevice("Radio", "onoff", "radio"));
+    MenuDiffStats stats = reload(incoming);
+
+    CHECK_EQUAL(DEVICE_CONTROL, currentState);
+    CHECK_EQUAL(2, currentDeviceIndex);
+    CHECK_EQUAL(70, findDevice("lamp").brightness);
+    CHECK_EQUAL(MENU_REDRAW_FULL, stats.redraw);
+    CHECK_EQUAL(1, fullRedraws);
+}
+
+static void cursorFollowsRoomWhenRoomsAreReordered()
+{
+    boot();
+    currentState = SUBMENU;
+    currentSubmenuIndex = 1; // Bedroom
+
+    std::vector<MenuLevel> incoming = makeMenu();
+    std::swap(incoming[0].rooms[0], incoming[0].rooms[1]);
+    reload(incoming);
+
+    CHECK_EQUAL(SUBMENU, currentState);
+    CHECK_EQUAL(0, currentSubmenuIndex);
+    CHECK(mainMenu[0].rooms[0].name == "Bedroom");
+}
+
+static void removedRoomFallsBackToSubmenu()
+{
+    boot();
+    currentState = DEVICE_CONTROL;
+    currentSubmenuIndex = 1; // Bedroom
+    currentDeviceIndex = 0;
+
+    std::vector<MenuLevel> incoming = makeMenu();
+    incoming[0].rooms.pop_back();
+    MenuDiffStats stats = reload(incoming);
+
+    CHECK_EQUAL(SUBMENU, currentState);
+    CHECK_EQUAL(1, currentSubmenuIndex); // Back
+    CHECK_EQUAL(1, stats.removed);
+    CHECK_EQUAL(1, fullRedraws);
+}
+
+static void removedLevelFallsBackToMainMenu()
+{
+    boot();
+    currentState = SUBMENU;
+    currentMenuIndex = 1; // Requests
+
+    std::vector<MenuLevel> incoming = makeMenu();
+    incoming.pop_back();
+    reload(incoming);
+
+    CHECK_EQUAL(MAIN_MENU, currentState);
+    CHECK_EQUAL(1, currentMenuIndex); // Settings
+}
+
+static void settingsStayOnSettings()
+{
+    boot();
+    currentState = MAIN_MENU;
+    currentMenuIndex = 2; // Settings
+
+    std::vector<MenuLevel> incoming = makeMenu();
+    incoming.push_back(MenuLevel());
+    incoming.back().name = "Scenes";
+    reload(incoming);
+
+    CHECK_EQUAL(MAIN_MENU, currentState);
+    CHECK_EQUAL(3, currentMenuIndex);
+}
+
+static void editModeSurvivesOnlyOnTheSameDevice()
+{
+    boot();
+    currentState = DEVICE_CONTROL;
+    currentDeviceIndex = 1; // Lamp
+    inEditMode = true;
+
+    MenuDiffStats stats = reload(makeMenu());
+    CHECK(inEditMode);
+    CHECK_EQUAL(MENU_REDRAW_NONE, stats.redraw);
+
+    std::vector<MenuLevel> incoming = makeMenu();
+    incoming[0].rooms[0].devices.erase(incoming[0].rooms[0].devices.begin() + 1);
+    stats = reload(incoming);
+    CHECK(!inEditMode);
+    CHECK_EQUAL(MENU_REDRAW_FULL, stats.redraw);
+}
+
+static long long elapsedMicros(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// 1,000 devices, one renamed. The merge is compared with what the old reload
+// did to the running menu: clear it and build every node again. Times are
+// the best of a few runs; heap allocations are what costs on the ESP32 and
+// do not depend on the host, so the ratio is asserted on those.
+static void oneEditInLargeMenu()
+{
+    const int roomCount = 50;
+    const int devicesPerRoom = 20;
+    const int runs = 5;
+    std::vector<MenuLevel> menu(1);
+    menu[0].name = "Home";
+    menu[0].rooms.resize(roomCount);
+    for (int r = 0; r < roomCount; r++)
+    {
+        menu[0].rooms[r].name = ("Room " + std::to_string(r)).c_str();
+        for (int d = 0; d < devicesPerRoom; d++)
+        {
+            // Names and ids as long as real ones, past the small string buffer
+            std::string name = "Ceiling Light " + std::to_string(r) + "/" + std::to_string(d);
+            std::string id = "light.room_" + std::to_string(r) + "_device_" + std::to_string(d);
+            menu[0].rooms[r].devices.push_back(makeDevice(name.c_str(), "brightness", id.c_str()));
+        }
+    }
+
+    std::vector<MenuLevel> edited = menu;
+    edited[0].rooms[25].devices[10].name = "Renamed";
+
+    long long mergeMicros = -1;
+    uint32_t mergeCopies = 0;
+    uint64_t mergeAllocations = 0;
+    for (int run = 0; run < runs; run++)
+    {
+        mainMenu.clear();
+        currentState = MAIN_MENU;
+        currentMenuIndex = 0;
+        inEditMode = false;
+        reload(menu);
+        findDevice("light.room_3_device_4").brightness = 42;
+
+        std::vector<MenuLevel> incoming = edited;
+        String::copies = 0;
+        uint64_t allocationsBefore = hostThreadAllocations();
+        auto start = std::chrono::steady_clock::now();
+        MenuDiffStats stats = applyMenuStructure(incoming);
+        long long micros = elapsedMicros(start);
+        mergeAllocations = hostThreadAllocations() - allocationsBefore;
+        mergeCopies = String::copies;
+        if (mergeMicros < 0 || micros < mergeMicros)
+            mergeMicros = micros;
+
+        CHECK_EQUAL(1, stats.changed);
+        CHECK_EQUAL(999, stats.unchanged);
+        CHECK(findDevice("light.room_25_device_10").name == "Renamed");
+        CHECK_EQUAL(42, findDevice("light.room_3_device_4").brightness);
+    }
+
+    long long rebuildMicros = -1;
+    uint32_t rebuildCopies = 0;
+    uint64_t rebuildAllocations = 0;
+    for (int run = 0; run < runs; run++)
+    {
+        String::copies = 0;
+        uint64_t allocationsBefore = hostThreadAllocations();
+        auto start = std::chrono::steady_clock::now();
+        mainMenu.clear();
+        mainMenu = edited;
+        long long micros = elapsedMicros(start);
+        rebuildAllocations = hostThreadAllocations() - allocationsBefore;
+        rebuildCopies = String::copies;
+        if (rebuildMicros < 0 || micros < rebuildMicros)
+            rebuildMicros = micros;
+    }
+
+    BENCH_RESULT("\"menu_merge\",\"devices\":%d,\"merge_us\":%lld,\"merge_allocations\":%llu,"
+                 "\"merge_string_copies\":%u,\"rebuild_us\":%lld,\"rebuild_allocations\":%llu,"
+                 "\"rebuild_string_copies\":%u",
+                 roomCount * devicesPerRoom, mergeMicros, (unsigned long long)mergeAllocations, mergeCopies,
+                 rebuildMicros, (unsigned long long)rebuildAllocations, rebuildCopies);
+
+    // Only the cursor and the lines on screen are copied, never the menu itself
+    CHECK(mergeCopies <= 8);
+    CHECK(rebuildCopies >= 3 * roomCount * devicesPerRoom);
+    CHECK(mergeAllocations * 100 <= rebuildAllocations);
+    CHECK(mergeMicros < rebuildMicros);
+}
+
+HOST_TEST_MAIN(
+    RUN_TEST(bootStartsOnFirstItem);
+    RUN_TEST(identicalReloadKeepsStateAndDrawsNothing);
+    RUN_TEST(renamedDeviceRedrawsOnlyItsLine);
+    RUN_TEST(changeOnAnotherScreenDrawsNothing);
+    RUN_TEST(movedDeviceKeepsItsState);
+    RUN_TEST(addedAndRemovedDevicesAreCounted);
+    RUN_TEST(cursorFollowsDeviceWhenItemsAreInserted);
+    RUN_TEST(cursorFollowsRoomWhenRoomsAreReordered);
+    RUN_TEST(removedRoomFallsBackToSubmenu);
+    RUN_TEST(removedLevelFallsBackToMainMenu);
+    RUN_TEST(settingsStayOnSettings);
+    RUN_TEST(editModeSurvivesOnlyOnTheSameDevice);
+    RUN_TEST(oneEditInLargeMenu))
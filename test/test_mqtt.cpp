@@ -0,0 +1,181 @@
+#include "HostSketch.h"
+#include <PubSubClient.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+// The MQTT transport (Transport.cpp) against the in-process broker: commands,
+// state pushed by the backend, reconnecting, and command latency next to the
+// HTTP path. Runs on the real clock with the MQTT task and the outbound
+// workers on threads of their own.
+//
+// The wire is modeled with the same one-way delay for both transports. An
+// HTTP command opens a connection for every request (one round trip) and
+// then waits for the reply (another one); an MQTT command is one message on
+// the open session and is confirmed once it is published.
+
+static const uint32_t WIRE_MS = 5;
+static const int COMMANDS = 40;
+
+static std::atomic<uint64_t> backendSawAt(0);
+static std::atomic<int> published(0);
+static String lastTopic;
+static String lastPayload;
+static std::mutex lastMutex;
+
+template <typename Done>
+static bool runUntil(Done done, uint32_t timeoutMs = 2000)
+{
+    unsigned long start = millis();
+    while (!done())
+    {
+        if (millis() - start > timeoutMs)
+            return false;
+        loop();
+    }
+    return true;
+}
+
+static Device *device(const char *id)
+{
+    return findDeviceById(id);
+}
+
+static void connects()
+{
+    CHECK(usingMqtt());
+    CHECK(runUntil([] { return mqttConnected(); }));
+}
+
+static void commandIsPublished()
+{
+    int before = published;
+    sendDeviceRequest("light_brightness1", "brightness", "55");
+    CHECK(runUntil([&] { return published > before && !device("light_brightness1")->pending; }));
+
+    std::lock_guard<std::mutex> guard(lastMutex);
+    CHECK(lastTopic == "knobble/light_brightness1/set");
+    CHECK(lastPayload == "{\"device_id\":\"light_brightness1\",\"type\":\"brightness\",\"value\":\"55\"}");
+    CHECK(!device("light_brightness1")->failed);
+}
+
+// Values in state messages may be strings, numbers or bools
+static void stateOfAnyType()
+{
+    hostBroker.publish("knobble/light_brightness1/state", "{\"value\": 40}");
+    CHECK(runUntil([] { return device("light_brightness1")->brightness == 40; }));
+
+    hostBroker.publish("knobble/tv1/state", "{\"type\": \"onoff\", \"value\": true}");
+    CHECK(runUntil([] { return device("tv1")->state; }));
+
+    hostBroker.publish("knobble/tv1/state", "{\"value\": false}");
+    CHECK(runUntil([] { return !device("tv1")->state; }));
+
+    hostBroker.publish("knobble/light1/state", "1");
+    CHECK(runUntil([] { return device("light1")->state; }));
+
+    hostBroker.publish("knobble/light_color1/state", "{\"value\": \"#00FF00\"}");
+    CHECK(runUntil([] { return device("light_color1")->color == "#00FF00"; }));
+    CHECK(device("light_color1")->confirmedColor == "#00FF00");
+}
+
+// A state change for a device that is not on screen draws nothing
+static void stateOffScreenDrawsNothing()
+{
+    currentState = MAIN_MENU;
+    inEditMode = false;
+    requestRedraw();
+    CHECK(runUntil([] { return !displayDirty; }));
+
+    hostBroker.publish("knobble/light_brightness1/state", "{\"value\": 15}");
+    CHECK(runUntil([] { return device("light_brightness1")->brightness == 15; }));
+    loop();
+    CHECK(!displayDirty);
+}
+
+static void reconnectsAfterOutage()
+{
+    hostBroker.up = false;
+    CHECK(runUntil([] { return !mqttConnected(); }));
+
+    // Commands fail while the broker is away
+    sendDeviceRequest("light1", "onoff", "0");
+    CHECK(runUntil([] { return !device("light1")->pending; }));
+    CHECK(device("light1")->failed);
+
+    hostBroker.up = true;
+    CHECK(runUntil([] { return mqttConnected(); }, MQTT_RETRY_MIN_MS * 3));
+
+    // Subscribed again
+    hostBroker.publish("knobble/light1/state", "0");
+    CHECK(runUntil([] { return !device("light1")->state && !device("light1")->failed; }));
+}
+
+static uint64_t percentile(std::vector<uint64_t> samples, int p)
+{
+    std::sort(samples.begin(), samples.end());
+    return samples[(samples.size() - 1) * p / 100];
+}
+
+// Brightness commands one after the other: time until the backend has the
+// command and until the knob shows it as confirmed
+static void measure(const char *name, std::vector<uint64_t> &toBackend, std::vector<uint64_t> &toConfirm)
+{
+    for (int i = 0; i < COMMANDS; i++)
+    {
+        backendSawAt = 0;
+        uint64_t start = hostNowNanos();
+        sendDeviceRequest("light_brightness1", "brightness", String(i % 100));
+        bool done = runUntil([] { return !device("light_brightness1")->pending; });
+        CHECK(done);
+        CHECK(!device("light_brightness1")->failed);
+        CHECK(backendSawAt > start);
+        toConfirm.push_back(hostNowNanos() - start);
+        toBackend.push_back(backendSawAt - start);
+    }
+    BENCH_RESULT("\"command_latency\",\"transport\":\"%s\",\"wire_ms\":%u,\"commands\":%d,"
+                 "\"to_backend_us_p50\":%llu,\"to_backend_us_p99\":%llu,\"to_confirm_us_p50\":%llu,"
+                 "\"to_confirm_us_p99\":%llu",
+                 name, WIRE_MS, COMMANDS, (unsigned long long)percentile(toBackend, 50) / 1000,
+                 (unsigned long long)percentile(toBackend, 99) / 1000,
+                 (unsigned long long)percentile(toConfirm, 50) / 1000,
+                 (unsigned long long)percentile(toConfirm, 99) / 1000);
+}
+
+static void latencyAgainstHttp()
+{
+    std::vector<uint64_t> mqttToBackend, mqttToConfirm;
+    measure("mqtt", mqttToBackend, mqttToConfirm);
+
+    transport = "http";
+    std::vector<uint64_t> httpToBackend, httpToConfirm;
+    measure("http", httpToBackend, httpToConfirm);
+    transport = "mqtt";
+
+    CHECK(percentile(mqttToBackend, 50) < percentile(httpToBackend, 50));
+    CHECK(percentile(mqttToConfirm, 50) < percentile(httpToConfirm, 50));
+}
+
+HOST_TEST_MAIN(
+    hostBroker.latencyMs = WIRE_MS;
+    hostBroker.onPublish = [](const HostMqttMessage &message) {
+        backendSawAt = hostNowNanos() + WIRE_MS * 1000000ULL;
+        std::lock_guard<std::mutex> guard(lastMutex);
+        lastTopic = message.topic;
+        lastPayload = message.payload;
+        published++;
+    };
+    hostHttpHandler = [](HostHttpExchange &exchange) {
+        // Connection set up, then the request on its way
+        backendSawAt = hostNowNanos() + 3 * WIRE_MS * 1000000ULL;
+        exchange.delayMs = 4 * WIRE_MS;
+    };
+    bootSketchWithMenu(hostMenuJson("http://hub.local:8123/api/knobble",
+                                     ", \"transport\": \"mqtt\", \"mqtt\": {\"host\": \"broker.local\"}"));
+    hostUseRealClock();
+    RUN_TEST(connects);
+    RUN_TEST(commandIsPublished);
+    RUN_TEST(stateOfAnyType);
+    RUN_TEST(stateOffScreenDrawsNothing);
+    RUN_TEST(reconnectsAfterOutage);
+    RUN_TEST(latencyAgainstHttp))
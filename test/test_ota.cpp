@@ -0,0 +1,132 @@
+#include "HostSketch.h"
+#include <Update.h>
+
+// Streaming firmware updates through /update into the fake flash
+// (Update.h): who may upload, and that the RAM an upload needs does not
+// grow with the image. Images are a few MB, more than the modeled heap.
+
+static const char *PASSWORD = "hunter22";
+
+// Deterministic image contents, so a corrupted byte shows up
+static std::vector<uint8_t> makeImage(size_t size)
+{
+    std::vector<uint8_t> image(size);
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < size; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        image[i] = x;
+    }
+    return image;
+}
+
+static String md5Of(const std::vector<uint8_t> &image)
+{
+    MD5Builder md5;
+    md5.begin();
+    md5.add(image.data(), image.size());
+    md5.calculate();
+    return md5.toString();
+}
+
+static const HostHttpResponse &upload(const std::vector<uint8_t> &image, const String &md5, const char *password)
+{
+    server.hostUpload("/update", image.data(), image.size(), {{"target", "firmware"}, {"md5", md5}}, ADMIN_USER,
+                      password);
+    server.handleClient();
+    return server.response;
+}
+
+static void updatesAreOffWithoutPassword()
+{
+    std::vector<uint8_t> image = makeImage(64 * 1024);
+    Update.hostWritten = 0;
+    CHECK_EQUAL(403, upload(image, md5Of(image), "").code);
+    CHECK_EQUAL(0, Update.hostWritten);
+    CHECK(!Update.hostBootSwitched);
+}
+
+static void firstPasswordIsSetFreely()
+{
+    server.hostCall(HTTP_POST, "/config", {{"admin_password", PASSWORD}});
+    CHECK_EQUAL(200, server.response.code);
+    CHECK(admin_password == PASSWORD);
+    CHECK(preferences.getString("admin_pass", "") == PASSWORD);
+}
+
+static void changingPasswordNeedsTheOldOne()
+{
+    server.hostCall(HTTP_POST, "/config", {{"admin_password", "mine now"}});
+    CHECK_EQUAL(401, server.response.code);
+    CHECK(admin_password == PASSWORD);
+
+    server.hostCall(HTTP_POST, "/config", {{"admin_password", "mine now"}}, ADMIN_USER, "guess");
+    CHECK_EQUAL(401, server.response.code);
+    CHECK(admin_password == PASSWORD);
+}
+
+static void wrongPasswordWritesNothing()
+{
+    std::vector<uint8_t> image = makeImage(64 * 1024);
+    Update.hostWritten = 0;
+    CHECK_EQUAL(401, upload(image, md5Of(image), "guess").code);
+    CHECK_EQUAL(0, Update.hostWritten);
+    CHECK(!Update.hostBootSwitched);
+}
+
+static void corruptImageIsNotBooted()
+{
+    std::vector<uint8_t> image = makeImage(256 * 1024);
+    String md5 = md5Of(image);
+    image[1000] ^= 1;
+    CHECK_EQUAL(500, upload(image, md5, PASSWORD).code);
+    CHECK(!Update.hostBootSwitched);
+}
+
+// Peak heap above what was in use before the upload
+static size_t streamImage(size_t size, double &mbPerSecond)
+{
+    std::vector<uint8_t> image = makeImage(size);
+    String md5 = md5Of(image);
+    int restarts = hostBoard.restarts;
+
+    size_t before = hostHeapStats().inUse;
+    hostHeapResetPeak();
+    uint64_t start = hostNowNanos();
+    const HostHttpResponse &response = upload(image, md5, PASSWORD);
+    uint64_t elapsed = hostNowNanos() - start;
+    size_t peak = hostHeapStats().peak - before;
+
+    CHECK_EQUAL(200, response.code);
+    CHECK_EQUAL(size, Update.hostWritten);
+    CHECK(Update.hostBootSwitched);
+    CHECK(memcmp(Update.hostPartition, image.data(), size) == 0);
+    CHECK_EQUAL(restarts + 1, hostBoard.restarts);
+
+    mbPerSecond = size / 1048576.0 / (elapsed / 1e9);
+    BENCH_RESULT("\"ota_stream\",\"bytes\":%u,\"peak_heap_bytes\":%u,\"mb_per_s\":%.1f", (unsigned)size, (unsigned)peak,
+                 mbPerSecond);
+    return peak;
+}
+
+static void peakRamDoesNotGrowWithTheImage()
+{
+    double small, large;
+    size_t smallPeak = streamImage(512 * 1024, small);
+    size_t largePeak = streamImage(3 * 1024 * 1024 + 517, large);
+
+    CHECK(largePeak <= smallPeak);
+    CHECK(largePeak <= 16 * 1024);
+}
+
+HOST_TEST_MAIN(
+    Update.hostPartitionSize = 4 * 1024 * 1024;
+    bootSketch("http://hub.local:8123/api/knobble");
+    RUN_TEST(updatesAreOffWithoutPassword);
+    RUN_TEST(firstPasswordIsSetFreely);
+    RUN_TEST(changingPasswordNeedsTheOldOne);
+    RUN_TEST(wrongPasswordWritesNothing);
+    RUN_TEST(corruptImageIsNotBooted);
+    RUN_TEST(peakRamDoesNotGrowWithTheImage))
@@ -0,0 +1,218 @@
+#include "HostSketch.h"
+#include <algorithm>
+#include <mutex>
+
+// Tail latency of the outbound path (HttpRequests.cpp, Upstream.cpp) under
+// injected faults, against an in-process server that slows down, fails or
+// refuses requests on a fixed pattern. Device commands are timed from
+// sendDeviceRequest() until the knob has confirmed or rolled them back;
+// actions from executeRequest() until the first copy is answered, as the
+// server sees it. Runs on the real clock with the workers on threads.
+
+static const uint32_t CONNECT_TIMEOUT_MS = 200;
+static const uint32_t READ_TIMEOUT_MS = 300;
+static const uint32_t HEDGE_DELAY_MS = 50;
+static const uint32_t SLACK_MS = 100;
+static const int REQUESTS = 40;
+
+enum Fault
+{
+    HEALTHY,
+    FLAKY, // Every 5th request a 500, every 7th hangs past the read timeout
+    DOWN,  // Every connection refused after the connect timeout
+    SLOW_TAIL // Every 10th request answers just within the read timeout
+};
+
+struct FakeServer
+{
+    std::mutex mutex;
+    Fault fault = HEALTHY;
+    int requests = 0;
+    uint64_t answeredAt = 0; // First answer to the action in flight
+    uint64_t busyUntil = 0;  // Until every copy of it is done
+};
+
+static FakeServer fakeServer;
+
+static void serve(HostHttpExchange &exchange)
+{
+    std::lock_guard<std::mutex> guard(fakeServer.mutex);
+    int n = fakeServer.requests++;
+    exchange.delayMs = 5;
+
+    switch (fakeServer.fault)
+    {
+    case HEALTHY:
+        break;
+    case FLAKY:
+        if (n % 5 == 1)
+            exchange.code = 500;
+        else if (n % 7 == 3)
+            exchange.delayMs = 1000;
+        break;
+    case DOWN:
+        exchange.refuse = true;
+        exchange.delayMs = 1000;
+        break;
+    case SLOW_TAIL:
+        if (n % 10 == 9)
+            exchange.delayMs = READ_TIMEOUT_MS - 50;
+        break;
+    }
+
+    uint64_t doneAt = hostNowNanos() + min(exchange.delayMs, READ_TIMEOUT_MS) * 1000000ULL;
+    fakeServer.busyUntil = max(fakeServer.busyUntil, doneAt);
+    if (!exchange.refuse && exchange.code == 200 && exchange.delayMs <= READ_TIMEOUT_MS &&
+        (fakeServer.answeredAt == 0 || doneAt < fakeServer.answeredAt))
+    {
+        fakeServer.answeredAt = doneAt;
+    }
+}
+
+static void inject(Fault fault)
+{
+    std::lock_guard<std::mutex> guard(fakeServer.mutex);
+    fakeServer.fault = fault;
+    fakeServer.requests = 0;
+}
+
+static uint64_t percentile(std::vector<uint64_t> samples, int p)
+{
+    std::sort(samples.begin(), samples.end());
+    return samples[(samples.size() - 1) * p / 100];
+}
+
+static void report(const char *path, const char *fault, const std::vector<uint64_t> &micros, int failed)
+{
+    BENCH_RESULT("\"outbound\",\"path\":\"%s\",\"fault\":\"%s\",\"requests\":%u,\"failed\":%d,\"p50_us\":%llu,"
+                 "\"p99_us\":%llu,\"max_us\":%llu",
+                 path, fault, (unsigned)micros.size(), failed, (unsigned long long)percentile(micros, 50),
+                 (unsigned long long)percentile(micros, 99), (unsigned long long)percentile(micros, 100));
+}
+
+static Device &lamp()
+{
+    return *findDeviceById("light_brightness1");
+}
+
+// One command at a time, each until it is confirmed or rolled back
+static std::vector<uint64_t> sendCommands(const char *fault, int &failed)
+{
+    std::vector<uint64_t> micros;
+    failed = 0;
+    for (int i = 0; i < REQUESTS; i++)
+    {
+        uint64_t start = hostNowNanos();
+        lamp().brightness = i % 100;
+        sendDeviceRequest("light_brightness1", "brightness", String(i % 100));
+        while (lamp().pending && hostNowNanos() - start < 2000000000ULL)
+            loop();
+        CHECK(!lamp().pending);
+        micros.push_back((hostNowNanos() - start) / 1000);
+        if (lamp().failed)
+            failed++;
+    }
+    report("command", fault, micros, failed);
+    return micros;
+}
+
+static void commandsHealthy()
+{
+    inject(HEALTHY);
+    int failed;
+    std::vector<uint64_t> micros = sendCommands("healthy", failed);
+    CHECK_EQUAL(0, failed);
+    CHECK(percentile(micros, 99) < 50000);
+}
+
+// Failures never come three in a row, the circuit stays closed and each
+// request is bounded by the read timeout
+static void commandsFlaky()
+{
+    inject(FLAKY);
+    int failed;
+    std::vector<uint64_t> micros = sendCommands("flaky", failed);
+    CHECK(failed > 0 && failed < REQUESTS / 2);
+    CHECK(percentile(micros, 50) < 50000);
+    CHECK(percentile(micros, 100) < (READ_TIMEOUT_MS + SLACK_MS) * 1000);
+}
+
+// The first failures wait for the connect timeout, then the circuit opens
+// and the rest fail at once
+static void commandsBackendDown()
+{
+    inject(DOWN);
+    int failed;
+    std::vector<uint64_t> micros = sendCommands("down", failed);
+    CHECK_EQUAL(REQUESTS, failed);
+    CHECK(percentile(micros, 50) < 20000);
+    CHECK(percentile(micros, 100) < (CONNECT_TIMEOUT_MS + SLACK_MS) * 1000);
+
+    std::lock_guard<std::mutex> guard(fakeServer.mutex);
+    CHECK_EQUAL(UPSTREAM_FAILURE_THRESHOLD, fakeServer.requests);
+}
+
+// Actions on their own host, one at a time: until the first answer, then
+// until the slower copy is done too
+static std::vector<uint64_t> runActions(const char *fault)
+{
+    std::vector<uint64_t> micros;
+    int failed = 0;
+    for (int i = 0; i < REQUESTS; i++)
+    {
+        {
+            std::lock_guard<std::mutex> guard(fakeServer.mutex);
+            fakeServer.answeredAt = 0;
+            fakeServer.busyUntil = 0;
+        }
+        uint64_t start = hostNowNanos();
+        executeRequest("http://scenes.local/scene/" + String(i));
+
+        uint64_t answeredAt = 0, busyUntil = 0;
+        do
+        {
+            loop();
+            std::lock_guard<std::mutex> guard(fakeServer.mutex);
+            answeredAt = fakeServer.answeredAt;
+            busyUntil = fakeServer.busyUntil;
+        } while ((busyUntil == 0 || hostNowNanos() < busyUntil + 5000000ULL) &&
+                 hostNowNanos() - start < 2000000000ULL);
+
+        if (answeredAt == 0)
+        {
+            failed++;
+            continue;
+        }
+        micros.push_back((answeredAt - start) / 1000);
+    }
+    CHECK_EQUAL(0, failed);
+    report("action", fault, micros, failed);
+    return micros;
+}
+
+// A hedge after HEDGE_DELAY_MS cuts the slow tail off
+static void actionsHedged()
+{
+    inject(SLOW_TAIL);
+    hedge_delay_ms = 0;
+    std::vector<uint64_t> plain = runActions("slow_tail");
+
+    inject(SLOW_TAIL);
+    hedge_delay_ms = HEDGE_DELAY_MS;
+    std::vector<uint64_t> hedged = runActions("slow_tail_hedged");
+    hedge_delay_ms = 0;
+
+    CHECK(percentile(plain, 99) >= (READ_TIMEOUT_MS - 50) * 1000);
+    CHECK(percentile(hedged, 99) < (HEDGE_DELAY_MS + 50) * 1000);
+    CHECK(percentile(hedged, 99) * 2 < percentile(plain, 99));
+}
+
+HOST_TEST_MAIN(
+    hostHttpHandler = serve;
+    bootSketchWithMenu(hostMenuJson("http://hub.local:8123/api/knobble",
+                                     ", \"upstream\": {\"connect_timeout_ms\": 200, \"read_timeout_ms\": 300}"));
+    hostUseRealClock();
+    RUN_TEST(commandsHealthy);
+    RUN_TEST(commandsFlaky);
+    RUN_TEST(actionsHedged);
+    RUN_TEST(commandsBackendDown))
@@ -0,0 +1,239 @@
+#include "HostSketch.h"
+#include <algorithm>
+
+// Power simulator: replays usage traces through loop() on the test clock and
+// reports how long the knob spent in each power state, at full CPU speed and
+// with the backlight on, and how long the input that woke a dark screen took
+// to be handled. Also checks what that input does (Navigation.cpp).
+
+struct UsageEvent
+{
+    uint32_t atMs;
+    char kind; // 'd' detent, 'p' press, 'w' web request
+    int direction;
+};
+
+struct PowerReport
+{
+    unsigned long stateMs[3] = {};
+    unsigned long fullSpeedMs = 0;
+    double backlightMs = 0; // Weighted by level
+    std::vector<unsigned long> wakeLatencies;
+};
+
+// One loop pass, with the time it took booked to the state it ended in
+static void step(PowerReport &report)
+{
+    unsigned long before = millis();
+    loop();
+    unsigned long elapsed = millis() - before;
+    report.stateMs[powerState] += elapsed;
+    if (hostBoard.cpuMhz == CPU_FREQ_ACTIVE_MHZ)
+        report.fullSpeedMs += elapsed;
+    report.backlightMs += (255 - hostBoard.analog[GFX_BL]) / 255.0 * elapsed;
+}
+
+static bool inputPending()
+{
+    return myKnob.read() / 2 != lastEncoderValue || displayDirty;
+}
+
+static PowerReport replay(const char *name, const std::vector<UsageEvent> &events, uint32_t endMs)
+{
+    PowerReport report;
+    unsigned long start = millis();
+
+    for (auto &event : events)
+    {
+        while (millis() - start < event.atMs)
+            step(report);
+
+        // The loop sleeps in slices, so the event may be seen a little late;
+        // latency is counted from when it happened
+        bool dark = powerState == POWER_OFF;
+        unsigned long happened = start + event.atMs;
+        switch (event.kind)
+        {
+        case 'd':
+            myKnob.hostTurn(event.direction);
+            break;
+        case 'p':
+            button.hostPress();
+            break;
+        case 'w':
+            server.hostQueue(HTTP_GET, "/status");
+            break;
+        }
+
+        if (dark && event.kind != 'w')
+        {
+            do
+            {
+                step(report);
+            } while (inputPending() || powerState == POWER_OFF);
+            report.wakeLatencies.push_back(millis() - happened);
+        }
+    }
+    while (millis() - start < endMs)
+        step(report);
+
+    std::vector<unsigned long> latencies = report.wakeLatencies;
+    std::sort(latencies.begin(), latencies.end());
+    unsigned long total = millis() - start;
+    BENCH_RESULT("\"power\",\"trace\":\"%s\",\"seconds\":%lu,\"active\":%.3f,\"dimmed\":%.3f,\"off\":%.3f,"
+                 "\"full_speed\":%.3f,\"backlight\":%.3f,\"wakes\":%u,\"wake_latency_ms_p50\":%lu,"
+                 "\"wake_latency_ms_max\":%lu",
+                 name, total / 1000, (double)report.stateMs[POWER_ACTIVE] / total,
+                 (double)report.stateMs[POWER_DIMMED] / total, (double)report.stateMs[POWER_OFF] / total,
+                 (double)report.fullSpeedMs / total, report.backlightMs / total, (unsigned)latencies.size(),
+                 latencies.empty() ? 0 : latencies[latencies.size() / 2], latencies.empty() ? 0 : latencies.back());
+    return report;
+}
+
+static unsigned long worstWake(const PowerReport &report)
+{
+    return report.wakeLatencies.empty()
+               ? 0
+               : *std::max_element(report.wakeLatencies.begin(), report.wakeLatencies.end());
+}
+
+// Browses, sets a light, puts the knob down and comes back five minutes later
+static void evening()
+{
+    std::vector<UsageEvent> events = {
+        {0, 'd', 1},      {400, 'd', 1},    {800, 'd', -1},   {1200, 'd', -1},  {2000, 'p', 0},
+        {2500, 'p', 0},   {3000, 'd', 1},   {3400, 'd', 1},   {4000, 'p', 0},   {4500, 'd', 1},
+        {4700, 'd', 1},   {4900, 'd', 1},   {6000, 'p', 0},   {306000, 'd', 1}, {307000, 'd', -1},
+        {308000, 'p', 0}, {309000, 'd', 1}, {310000, 'p', 0},
+    };
+    PowerReport report = replay("evening", events, 420000);
+    CHECK_EQUAL(1, report.wakeLatencies.size());
+    CHECK(worstWake(report) <= 20);
+    CHECK(report.stateMs[POWER_OFF] > report.stateMs[POWER_ACTIVE]);
+}
+
+// Nobody touches the knob, a home automation server polls /status
+static void polledWhileIdle()
+{
+    std::vector<UsageEvent> events;
+    for (uint32_t at = 0; at < 20 * 60000; at += 15000)
+        events.push_back({at, 'w', 0});
+    events.push_back({10 * 60000 + 7, 'd', 1});
+    std::sort(events.begin(), events.end(), [](const UsageEvent &a, const UsageEvent &b) { return a.atMs < b.atMs; });
+
+    PowerReport report = replay("polled_idle", events, 20 * 60000);
+    CHECK_EQUAL(1, report.wakeLatencies.size());
+    CHECK(worstWake(report) <= 20);
+    // Polls keep the CPU up for a moment, not the backlight
+    CHECK(report.stateMs[POWER_OFF] > 18 * 60000 * 8 / 10);
+    CHECK(report.fullSpeedMs < 20 * 60000 / 4);
+}
+
+// A glance at the knob every 90 seconds, each one in the dark
+static void bedside()
+{
+    std::vector<UsageEvent> events;
+    for (uint32_t at = 0; at < 15 * 60000; at += 90000)
+        events.push_back({at + 3 * (at / 90000), 'd', at / 90000 % 2 ? 1 : -1});
+
+    PowerReport report = replay("bedside", events, 15 * 60000);
+    CHECK(report.wakeLatencies.size() >= 8);
+    CHECK(worstWake(report) <= 20);
+}
+
+// Idles until the screen is off
+static void goDark()
+{
+    PowerReport ignored;
+    unsigned long start = millis();
+    while (powerState != POWER_OFF && millis() - start < BACKLIGHT_OFF_TIMEOUT_MS * 2)
+        step(ignored);
+    CHECK_EQUAL(POWER_OFF, powerState);
+}
+
+static void runUntilHandled()
+{
+    PowerReport ignored;
+    do
+    {
+        step(ignored);
+    } while (inputPending());
+}
+
+static void goTo(MenuState state, int menu, int submenu, int device)
+{
+    inEditMode = false;
+    currentState = state;
+    currentMenuIndex = menu;
+    currentSubmenuIndex = submenu;
+    currentDeviceIndex = device;
+}
+
+static void wakeDetentMovesTheCursor()
+{
+    goTo(MAIN_MENU, 0, 0, 0);
+    goDark();
+    myKnob.hostTurn(1);
+    runUntilHandled();
+    CHECK_EQUAL(POWER_ACTIVE, powerState);
+    CHECK_EQUAL(1, currentMenuIndex);
+}
+
+static void wakeDetentInEditModeOnlyWakes()
+{
+    goTo(DEVICE_CONTROL, 0, 0, 2);
+    inEditMode = true;
+    Device *light = findDeviceById("light_brightness1");
+    int brightness = light->brightness;
+
+    goDark();
+    myKnob.hostTurn(1);
+    runUntilHandled();
+    CHECK_EQUAL(POWER_ACTIVE, powerState);
+    CHECK_EQUAL(brightness, light->brightness);
+
+    // The next one changes it
+    myKnob.hostTurn(1);
+    runUntilHandled();
+    CHECK_EQUAL(brightness + 5, light->brightness);
+}
+
+static void wakePressOnSwitchOnlyWakes()
+{
+    goTo(DEVICE_CONTROL, 0, 0, 0);
+    Device *tv = findDeviceById("tv1");
+    bool state = tv->state;
+
+    goDark();
+    button.hostPress();
+    runUntilHandled();
+    CHECK_EQUAL(POWER_ACTIVE, powerState);
+    CHECK_EQUAL(state, tv->state);
+
+    button.hostPress();
+    runUntilHandled();
+    CHECK_EQUAL(!state, tv->state);
+}
+
+static void wakePressOnRoomEntersIt()
+{
+    goTo(SUBMENU, 0, 1, 0);
+    goDark();
+    button.hostPress();
+    runUntilHandled();
+    CHECK_EQUAL(DEVICE_CONTROL, currentState);
+    CHECK_EQUAL(1, currentSubmenuIndex);
+}
+
+HOST_TEST_MAIN(
+    // A backend that accepts every command, so none is rolled back
+    hostHttpHandler = [](HostHttpExchange &) {};
+    bootSketch("http://hub.local:8123/api/knobble");
+    RUN_TEST(wakeDetentMovesTheCursor);
+    RUN_TEST(wakeDetentInEditModeOnlyWakes);
+    RUN_TEST(wakePressOnSwitchOnlyWakes);
+    RUN_TEST(wakePressOnRoomEntersIt);
+    goTo(MAIN_MENU, 0, 0, 0);
+    RUN_TEST(evening);
+    RUN_TEST(polledWhileIdle);
+    RUN_TEST(bedside))
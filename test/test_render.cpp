@@ -0,0 +1,153 @@
+#include "HostSketch.h"
+#include <algorithm>
+
+// What one encoder step costs on the edit controls (Controls.cpp): pixels
+// pushed to the panel, counted by the Arduino_GFX stand-in, and host CPU
+// time, next to a full redraw of the same screen. The panel's SPI bus runs
+// at 80 MHz with 16 bits per pixel, so every pixel costs 0.2 us on the
+// board however fast the CPU is; a step has to fit a 60 fps frame.
+
+static const uint32_t FRAME_BUDGET_US = 1000000 / 60;
+
+static uint32_t spiMicros(uint64_t pixels)
+{
+    return pixels * 16 / 80;
+}
+
+struct StepCost
+{
+    std::vector<uint64_t> pixels;
+    std::vector<uint64_t> micros;
+};
+
+static uint64_t percentile(std::vector<uint64_t> samples, int p)
+{
+    std::sort(samples.begin(), samples.end());
+    return samples[(samples.size() - 1) * p / 100];
+}
+
+static void editDevice(int index)
+{
+    inEditMode = false;
+    currentState = DEVICE_CONTROL;
+    currentMenuIndex = 0;
+    currentSubmenuIndex = 0;
+    currentDeviceIndex = index;
+    applyButtonPress();
+    loop();
+    CHECK(inEditMode);
+}
+
+// One full redraw of the screen being edited
+static void fullFrame(uint64_t &pixels, uint64_t &micros)
+{
+    uint64_t before = gfx->hostPixels;
+    uint64_t start = hostNowNanos();
+    requestRedraw();
+    renderDisplay();
+    micros = (hostNowNanos() - start) / 1000;
+    pixels = gfx->hostPixels - before;
+}
+
+// Steps through applyEncoderStep() like the encoder task does, letting the
+// command results come back in between
+static void step(StepCost &cost, int direction)
+{
+    uint64_t before = gfx->hostPixels;
+    uint64_t start = hostNowNanos();
+    applyEncoderStep(direction);
+    cost.micros.push_back((hostNowNanos() - start) / 1000);
+    cost.pixels.push_back(gfx->hostPixels - before);
+    loop();
+}
+
+static void report(const char *control, const StepCost &cost, uint64_t framePixels, uint64_t frameMicros)
+{
+    BENCH_RESULT("\"render_step\",\"control\":\"%s\",\"steps\":%u,\"pixels_p50\":%llu,\"pixels_max\":%llu,"
+                 "\"cpu_us_p50\":%llu,\"cpu_us_p99\":%llu,\"spi_us_max\":%u,\"full_frame_pixels\":%llu,"
+                 "\"full_frame_cpu_us\":%llu",
+                 control, (unsigned)cost.pixels.size(), (unsigned long long)percentile(cost.pixels, 50),
+                 (unsigned long long)percentile(cost.pixels, 100), (unsigned long long)percentile(cost.micros, 50),
+                 (unsigned long long)percentile(cost.micros, 99), spiMicros(percentile(cost.pixels, 100)),
+                 (unsigned long long)framePixels, (unsigned long long)frameMicros);
+}
+
+// A step repaints a sliver of what a redraw does, and stays within a frame
+static void checkStep(const StepCost &cost, uint64_t framePixels)
+{
+    CHECK(percentile(cost.pixels, 100) * 10 <= framePixels);
+    CHECK(spiMicros(percentile(cost.pixels, 100)) < FRAME_BUDGET_US);
+    CHECK(percentile(cost.micros, 99) < FRAME_BUDGET_US);
+}
+
+// 0 to 100% and back in 5% steps
+static void brightnessGauge()
+{
+    findDeviceById("light_brightness1")->brightness = 0;
+    editDevice(2);
+
+    uint64_t framePixels, frameMicros;
+    fullFrame(framePixels, frameMicros);
+
+    StepCost cost;
+    for (int i = 0; i < 20; i++)
+        step(cost, 1);
+    CHECK_EQUAL(100, findDeviceById("light_brightness1")->brightness);
+    for (int i = 0; i < 20; i++)
+        step(cost, -1);
+    CHECK_EQUAL(0, findDeviceById("light_brightness1")->brightness);
+
+    report("brightness_gauge", cost, framePixels, frameMicros);
+    checkStep(cost, framePixels);
+    applyButtonPress();
+    loop();
+}
+
+// Once around the hue ring, then the saturation arc down and up
+static void colorWheel()
+{
+    findDeviceById("light_color1")->color = "#FF0000";
+    editDevice(3);
+
+    uint64_t framePixels, frameMicros;
+    fullFrame(framePixels, frameMicros);
+
+    StepCost hue;
+    for (int i = 0; i < 36; i++)
+        step(hue, 1);
+    CHECK(findDeviceById("light_color1")->color == "#FF0000");
+
+    applyButtonPress();
+    loop();
+    StepCost saturation;
+    for (int i = 0; i < 10; i++)
+        step(saturation, -1);
+    CHECK(findDeviceById("light_color1")->color == "#FFFFFF");
+    for (int i = 0; i < 10; i++)
+        step(saturation, 1);
+    CHECK(findDeviceById("light_color1")->color == "#FF0000");
+
+    report("hue_ring", hue, framePixels, frameMicros);
+    report("saturation_arc", saturation, framePixels, frameMicros);
+    checkStep(hue, framePixels);
+    checkStep(saturation, framePixels);
+    applyButtonPress();
+    loop();
+}
+
+// Values from the backend out of range draw within the gauge
+static void brightnessIsClamped()
+{
+    confirmDeviceState("light_brightness1", "brightness", "250");
+    CHECK_EQUAL(100, findDeviceById("light_brightness1")->brightness);
+    confirmDeviceState("light_brightness1", "brightness", "-5");
+    CHECK_EQUAL(0, findDeviceById("light_brightness1")->brightness);
+}
+
+HOST_TEST_MAIN(
+    hostHttpHandler = [](HostHttpExchange &) {};
+    bootSketch("http://hub.local:8123/api/knobble");
+    hostUseRealClock();
+    RUN_TEST(brightnessGauge);
+    RUN_TEST(colorWheel);
+    RUN_TEST(brightnessIsClamped))
@@ -0,0 +1,128 @@
+#include "HostSketch.h"
+#include <algorithm>
+#include <atomic>
+
+// Input-to-display latency while the network is stalled. The outbound
+// workers run on threads of their own and the fake backend holds every
+// request for longer than the read timeout, while the main thread turns the
+// knob, toggles devices and runs requests through loop(). Everything runs on
+// the real clock; latency is counted from the input until the frame that
+// shows it is done.
+
+static const int ROUNDS = 150;
+static const uint32_t READ_TIMEOUT_MS = 300;
+
+static std::atomic<uint32_t> backendDelayMs(0);
+static std::atomic<int> requestsSeen(0);
+
+static bool inputPending()
+{
+    return myKnob.read() / 2 != lastEncoderValue || displayDirty;
+}
+
+static uint32_t handleInputMicros()
+{
+    uint64_t start = hostNowNanos();
+    do
+    {
+        loop();
+    } while (inputPending());
+    return (hostNowNanos() - start) / 1000;
+}
+
+static void goTo(MenuState state, int menu, int submenu, int device)
+{
+    inEditMode = false;
+    currentState = state;
+    currentMenuIndex = menu;
+    currentSubmenuIndex = submenu;
+    currentDeviceIndex = device;
+    requestRedraw();
+    handleInputMicros();
+}
+
+static uint32_t percentile(std::vector<uint32_t> &samples, int p)
+{
+    std::sort(samples.begin(), samples.end());
+    return samples[(samples.size() - 1) * p / 100];
+}
+
+// Toggles the TV, turns the brightness and runs a request, every input sends
+// something to the backend
+static std::vector<uint32_t> useTheKnob()
+{
+    std::vector<uint32_t> latencies;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        goTo(DEVICE_CONTROL, 0, 0, 0);
+        button.hostPress();
+        latencies.push_back(handleInputMicros());
+
+        goTo(DEVICE_CONTROL, 0, 0, 2);
+        inEditMode = true;
+        myKnob.hostTurn(round % 2 ? 1 : -1);
+        latencies.push_back(handleInputMicros());
+
+        goTo(SUBMENU, 1, round % 2, 0);
+        button.hostPress();
+        latencies.push_back(handleInputMicros());
+    }
+    return latencies;
+}
+
+static std::vector<uint32_t> run(const char *name, uint32_t delayMs)
+{
+    backendDelayMs = delayMs;
+    requestsSeen = 0;
+    std::vector<uint32_t> latencies = useTheKnob();
+
+    uint32_t p50 = percentile(latencies, 50);
+    uint32_t p99 = percentile(latencies, 99);
+    BENCH_RESULT("\"input_to_frame\",\"backend\":\"%s\",\"backend_delay_ms\":%u,\"inputs\":%u,\"requests\":%d,"
+                 "\"p50_us\":%u,\"p99_us\":%u,\"max_us\":%u",
+                 name, delayMs, (unsigned)latencies.size(), requestsSeen.load(), p50, p99, latencies.back());
+    return latencies;
+}
+
+static void healthyBackend()
+{
+    std::vector<uint32_t> latencies = run("healthy", 0);
+    CHECK(requestsSeen > 0);
+    CHECK(percentile(latencies, 99) <= 20000);
+}
+
+// Every request answers just before the read timeout, the workers are
+// always busy waiting
+static void slowBackend()
+{
+    std::vector<uint32_t> latencies = run("slow", READ_TIMEOUT_MS - 50);
+    CHECK(requestsSeen > 0);
+    CHECK(percentile(latencies, 99) <= 20000);
+    CHECK(latencies.back() <= 100000);
+}
+
+// Every request times out until the circuit opens
+static void stalledBackend()
+{
+    std::vector<uint32_t> latencies = run("stalled", READ_TIMEOUT_MS * 3);
+    CHECK(requestsSeen > 0);
+    CHECK(percentile(latencies, 99) <= 20000);
+    CHECK(latencies.back() <= 100000);
+
+    // The stalls did happen
+    uint32_t lastRttMs, errors;
+    getUpstreamSummary(lastRttMs, errors);
+    CHECK(errors > 0);
+}
+
+HOST_TEST_MAIN(
+    hostHttpHandler = [](HostHttpExchange &exchange) {
+        requestsSeen++;
+        exchange.delayMs = backendDelayMs;
+    };
+    bootSketchWithMenu(hostMenuJson("http://hub.local:8123/api/knobble",
+                                     ", \"upstream\": {\"read_timeout_ms\": 300, \"connect_timeout_ms\": 300}"));
+    hostUseRealClock();
+    RUN_TEST(healthyBackend);
+    RUN_TEST(slowBackend);
+    RUN_TEST(stalledBackend))
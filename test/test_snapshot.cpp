@@ -0,0 +1,203 @@
+#include "SmartMenuSystem.h"
+#include "HostTest.h"
+
+// UI snapshot in NVS (Snapshot.cpp): blob size, how many flash writes a busy
+// knob causes, and what comes back after a restart.
+
+std::vector<MenuLevel> mainMenu;
+MenuState currentState = MAIN_MENU;
+int currentMenuIndex = 0;
+int currentSubmenuIndex = 0;
+int currentDeviceIndex = 0;
+int currentSettingIndex = 0;
+Preferences preferences;
+
+static const size_t HEADER_SIZE = 13;
+static const size_t DEVICE_SIZE = 9;
+
+// One level with a room of roomSize devices and a room with one more
+static void buildMenu(int roomSize)
+{
+    mainMenu.assign(1, MenuLevel());
+    mainMenu[0].name = "Home";
+    mainMenu[0].rooms.resize(2);
+    for (int i = 0; i < roomSize; i++)
+    {
+        Device device;
+        device.name = String(i);
+        device.type = "brightness";
+        device.device_id = String("light") + String(i);
+        mainMenu[0].rooms[0].devices.push_back(device);
+    }
+    Device fan;
+    fan.name = "Fan";
+    fan.type = "onoff";
+    fan.device_id = "fan";
+    mainMenu[0].rooms[1].devices.push_back(fan);
+}
+
+static Device &device(int room, int index)
+{
+    return mainMenu[0].rooms[room].devices[index];
+}
+
+static void confirm(Device &target, bool state, int brightness, const char *color)
+{
+    target.state = target.confirmedState = state;
+    target.brightness = target.confirmedBrightness = brightness;
+    target.color = target.confirmedColor = color;
+}
+
+static void navigate(MenuState state, int menu, int submenu, int deviceIndex)
+{
+    currentState = state;
+    currentMenuIndex = menu;
+    currentSubmenuIndex = submenu;
+    currentDeviceIndex = deviceIndex;
+    markSnapshotDirty();
+}
+
+// Power cycle: the menu comes back from the config with default values and
+// the cursor at the top, NVS keeps its contents
+static void restart(int roomSize)
+{
+    buildMenu(roomSize);
+    currentState = MAIN_MENU;
+    currentMenuIndex = currentSubmenuIndex = currentDeviceIndex = currentSettingIndex = 0;
+    restoreSnapshot();
+}
+
+static void keepsEveryDevice()
+{
+    buildMenu(299);
+    confirm(device(0, 298), true, 35, "#10A0FF");
+    navigate(DEVICE_CONTROL, 0, 0, 1);
+    flushSnapshot();
+
+    CHECK_EQUAL(HEADER_SIZE + 300 * DEVICE_SIZE, preferences.getBytesLength(SNAPSHOT_KEY));
+
+    restart(299);
+    CHECK(device(0, 298).confirmedState);
+    CHECK_EQUAL(35, device(0, 298).brightness);
+    CHECK(device(0, 298).color == "#10A0FF");
+}
+
+static void survivesRestartBeyondByteIndices()
+{
+    buildMenu(400);
+    confirm(device(0, 300), true, 80, "#FF0000");
+    confirm(device(1, 0), true, 0, "#FFFFFF");
+    navigate(DEVICE_CONTROL, 0, 0, 300);
+    flushSnapshot();
+
+    restart(400);
+    CHECK_EQUAL(DEVICE_CONTROL, currentState);
+    CHECK_EQUAL(0, currentSubmenuIndex);
+    CHECK_EQUAL(300, currentDeviceIndex);
+    CHECK(device(0, 300).state && device(0, 300).confirmedState);
+    CHECK_EQUAL(80, device(0, 300).confirmedBrightness);
+    CHECK(device(0, 300).confirmedColor == "#FF0000");
+    CHECK(device(1, 0).state);
+    CHECK(!device(0, 299).state);
+}
+
+static void devicesAreMatchedById()
+{
+    buildMenu(3);
+    confirm(device(0, 2), true, 60, "#00FF00");
+    flushSnapshot();
+    markSnapshotDirty();
+    flushSnapshot();
+
+    // The menu changed while the knob was off: light2 moved to the front
+    buildMenu(3);
+    std::swap(mainMenu[0].rooms[0].devices[0], mainMenu[0].rooms[0].devices[2]);
+    restoreSnapshot();
+    CHECK_EQUAL(60, device(0, 0).brightness);
+    CHECK_EQUAL(0, device(0, 2).brightness);
+}
+
+static void busyKnobWritesOncePerQuietPeriod()
+{
+    buildMenu(10);
+    navigate(MAIN_MENU, 0, 0, 0);
+    flushSnapshot();
+    uint32_t writesBefore = preferences.writes;
+
+    // A detent every 200 ms for 10 s, housekeeping every SNAPSHOT_CHECK_MS
+    for (int step = 0; step < 50; step++)
+    {
+        device(0, 0).confirmedBrightness = step;
+        markSnapshotDirty();
+        hostMillis += 200;
+        if (hostMillis % SNAPSHOT_CHECK_MS < 200)
+            updateSnapshot();
+    }
+    CHECK_EQUAL(writesBefore, preferences.writes);
+
+    for (int i = 0; i < SNAPSHOT_QUIET_MS / SNAPSHOT_CHECK_MS + 1; i++)
+    {
+        hostMillis += SNAPSHOT_CHECK_MS;
+        updateSnapshot();
+    }
+    CHECK_EQUAL(writesBefore + 1, preferences.writes);
+}
+
+static void neverQuietStillWritesAtMaxDelay()
+{
+    buildMenu(10);
+    flushSnapshot();
+    uint32_t writesBefore = preferences.writes;
+
+    // Turning without a break for a minute
+    unsigned long start = hostMillis;
+    int step = 0;
+    while (hostMillis - start < 60000)
+    {
+        device(0, 1).confirmedBrightness = step++ % 100;
+        markSnapshotDirty();
+        hostMillis += SNAPSHOT_CHECK_MS;
+        updateSnapshot();
+    }
+    CHECK_EQUAL(writesBefore + 60000 / SNAPSHOT_MAX_DELAY_MS, preferences.writes);
+}
+
+static void unchangedSnapshotIsNotWritten()
+{
+    buildMenu(10);
+    navigate(SUBMENU, 0, 1, 0);
+    flushSnapshot();
+    uint32_t writesBefore = preferences.writes;
+
+    // There and back again before housekeeping ran
+    navigate(SUBMENU, 0, 0, 0);
+    navigate(SUBMENU, 0, 1, 0);
+    hostMillis += SNAPSHOT_QUIET_MS;
+    updateSnapshot();
+    CHECK_EQUAL(writesBefore, preferences.writes);
+}
+
+static void oldVersionIsIgnored()
+{
+    buildMenu(2);
+    navigate(SETTINGS_MENU, 1, 0, 0);
+    flushSnapshot();
+
+    // Same layout, older version number
+    std::vector<uint8_t> blob(preferences.getBytesLength(SNAPSHOT_KEY));
+    preferences.getBytes(SNAPSHOT_KEY, blob.data(), blob.size());
+    blob[2] = SNAPSHOT_VERSION - 1;
+    preferences.putBytes(SNAPSHOT_KEY, blob.data(), blob.size());
+
+    restart(2);
+    CHECK_EQUAL(MAIN_MENU, currentState);
+}
+
+HOST_TEST_MAIN(
+    RUN_TEST(keepsEveryDevice);
+    RUN_TEST(survivesRestartBeyondByteIndices);
+    RUN_TEST(devicesAreMatchedById);
+    RUN_TEST(busyKnobWritesOncePerQuietPeriod);
+    RUN_TEST(neverQuietStillWritesAtMaxDelay);
+    RUN_TEST(unchangedSnapshotIsNotWritten);
+    RUN_TEST(oldVersionIsIgnored))
@@ -0,0 +1,193 @@
+#include "SmartMenuSystem.h"
+#include "HostTest.h"
+
+// Circuit breaker in Upstream.cpp: when a host's circuit opens, how requests
+// are turned away while it is open, and how probes close it again.
+
+static std::vector<String> probes;
+static bool probeQueueFull = false;
+
+bool enqueueProbe(const char *url)
+{
+    if (probeQueueFull)
+        return false;
+    probes.push_back(url);
+    return true;
+}
+
+// Probes sent to one host; other tests leave their hosts open too
+static int probesTo(const char *probeUrl)
+{
+    int count = 0;
+    for (auto &probe : probes)
+        if (probe == probeUrl)
+            count++;
+    return count;
+}
+
+static bool allowed(const char *url, bool probe = false)
+{
+    uint32_t connectTimeoutMs, readTimeoutMs;
+    return upstreamAllow(url, probe, connectTimeoutMs, readTimeoutMs);
+}
+
+static void fail(const char *url, int times)
+{
+    for (int i = 0; i < times; i++)
+    {
+        CHECK(allowed(url));
+        upstreamRecord(url, -1, 100);
+    }
+}
+
+// Fails the host until its circuit opens and waits out the open period
+static void openAndWait(const char *url)
+{
+    fail(url, UPSTREAM_FAILURE_THRESHOLD);
+    hostMillis += UPSTREAM_OPEN_MS;
+    probes.clear();
+}
+
+static void opensAfterThresholdFailuresInARow()
+{
+    const char *url = "http://a.local/api";
+    fail(url, UPSTREAM_FAILURE_THRESHOLD - 1);
+    CHECK(allowed(url));
+
+    upstreamRecord(url, 503, 100);
+    CHECK(!allowed(url));
+    CHECK(!allowed("http://a.local/other?x=1"));
+}
+
+// The table holds UPSTREAM_MAX_HOSTS hosts, the tests share them
+static void successResetsTheCount()
+{
+    const char *url = "http://b.local/api";
+    fail(url, UPSTREAM_FAILURE_THRESHOLD - 1);
+    upstreamRecord(url, 200, 50);
+    fail(url, UPSTREAM_FAILURE_THRESHOLD - 1);
+    CHECK(allowed(url));
+    upstreamRecord(url, 200, 50);
+}
+
+static void clientErrorsAreNotFailures()
+{
+    const char *url = "http://b.local/api";
+    for (int i = 0; i < UPSTREAM_FAILURE_THRESHOLD * 2; i++)
+    {
+        upstreamRecord(url, 404, 20);
+    }
+    CHECK(allowed(url));
+}
+
+static void hostsAreIndependent()
+{
+    fail("http://d.local/api", UPSTREAM_FAILURE_THRESHOLD);
+    CHECK(!allowed("http://d.local/api"));
+    CHECK(allowed("http://b.local/api"));
+    CHECK(allowed("http://d.local:8080/api"));
+}
+
+static void probesOnlyAfterTheOpenPeriod()
+{
+    const char *url = "https://f.local:8443/api/scene";
+    fail(url, UPSTREAM_FAILURE_THRESHOLD);
+    probes.clear();
+
+    hostMillis += UPSTREAM_OPEN_MS - 1;
+    probeUpstreams();
+    CHECK(probes.empty());
+
+    hostMillis += 1;
+    probeUpstreams();
+    CHECK_EQUAL(1, probesTo("https://f.local:8443/"));
+
+    // One probe at a time, everything else is still turned away
+    probeUpstreams();
+    CHECK_EQUAL(1, probesTo("https://f.local:8443/"));
+    CHECK(!allowed(url));
+    CHECK(allowed(url, true));
+}
+
+static void answeredProbeClosesTheCircuit()
+{
+    const char *url = "http://g.local/api";
+    openAndWait(url);
+    probeUpstreams();
+    CHECK_EQUAL(1, probesTo("http://g.local/"));
+
+    upstreamRecord("http://g.local/", 200, 30);
+    CHECK(allowed(url));
+
+    // Closed again means the full threshold before it opens next time
+    fail(url, UPSTREAM_FAILURE_THRESHOLD - 1);
+    CHECK(allowed(url));
+}
+
+static void failedProbeReopensForAnotherPeriod()
+{
+    const char *url = "http://h.local/api";
+    openAndWait(url);
+    probeUpstreams();
+    upstreamRecord("http://h.local/", -1, 0);
+    CHECK(!allowed(url));
+
+    probes.clear();
+    hostMillis += UPSTREAM_OPEN_MS / 2;
+    probeUpstreams();
+    CHECK_EQUAL(0, probesTo("http://h.local/"));
+
+    hostMillis += UPSTREAM_OPEN_MS / 2;
+    probeUpstreams();
+    CHECK_EQUAL(1, probesTo("http://h.local/"));
+    upstreamRecord("http://h.local/", 200, 30);
+}
+
+static void fullProbeQueueTriesAgainNextPeriod()
+{
+    const char *url = "http://i.local/api";
+    openAndWait(url);
+
+    probeQueueFull = true;
+    probeUpstreams();
+    probeQueueFull = false;
+    CHECK(probes.empty());
+    CHECK(!allowed(url));
+
+    probes.clear();
+    probeUpstreams();
+    CHECK_EQUAL(0, probesTo("http://i.local/"));
+    hostMillis += UPSTREAM_OPEN_MS;
+    probeUpstreams();
+    CHECK_EQUAL(1, probesTo("http://i.local/"));
+    upstreamRecord("http://i.local/", 200, 30);
+}
+
+static void summaryCountsFailuresAndRejections()
+{
+    uint32_t rttBefore, errorsBefore;
+    getUpstreamSummary(rttBefore, errorsBefore);
+
+    // Still open from the first test
+    const char *url = "http://a.local/api";
+    CHECK(!allowed(url));
+    CHECK(!allowed(url));
+    upstreamRecord(url, -1, 250);
+
+    uint32_t rtt, errors;
+    getUpstreamSummary(rtt, errors);
+    CHECK_EQUAL(errorsBefore + 3, errors);
+    CHECK_EQUAL(250, rtt);
+}
+
+HOST_TEST_MAIN(
+    initializeUpstream();
+    RUN_TEST(opensAfterThresholdFailuresInARow);
+    RUN_TEST(successResetsTheCount);
+    RUN_TEST(clientErrorsAreNotFailures);
+    RUN_TEST(hostsAreIndependent);
+    RUN_TEST(probesOnlyAfterTheOpenPeriod);
+    RUN_TEST(answeredProbeClosesTheCircuit);
+    RUN_TEST(failedProbeReopensForAnotherPeriod);
+    RUN_TEST(fullProbeQueueTriesAgainNextPeriod);
+    RUN_TEST(summaryCountsFailuresAndRejections))